@@ -0,0 +1,108 @@
+package main
+
+import (
+	"encoding/json"
+	"fmt"
+	"strings"
+)
+
+// compactField describes the quantisation of a compact frame field.
+type compactField struct {
+	Name       string
+	Resolution float64
+	Offset     float64
+}
+
+// compactSchemas is generated from the firmware's payload_schema.h.
+// BEGIN GENERATED PAYLOAD SCHEMA - generated by tools/generate_payload_schema.py from include/payload_schema.h, do not edit.
+var compactSchemas = map[string][]compactField{
+	"status": {
+		{"last_rx_sec", 1, 0},
+		{"uptime_sec", 1, 0},
+		{"heap_usage_kb", 1, 0},
+		{"batt_millivolt", 1, 0},
+		{"power_milliamp", 1, 0},
+		{"is_batt_charging", 1, 0},
+		{"ambient_temp_celcius", 0.01, 0},
+		{"ambient_humidity_pct", 1, 0},
+		{"ambient_pressure_hpa", 0.1, 0},
+		{"ambient_altitude_metre", 1, 0},
+		{"cpu0_reset_reason", 1, 0},
+		{"cpu1_reset_reason", 1, 0},
+		{"cpu_wake_up_cause", 1, 0},
+		{"esp_reset_reason", 1, 0},
+	},
+	"position": {
+		{"latitude", 0.00001, 0},
+		{"longitude", 0.00001, 0},
+		{"gps_speed_kmh", 1, 0},
+		{"gps_heading_deg", 1, 0},
+		{"altitude", 1, 0},
+		{"gps_pos_age_sec", 1, 0},
+		{"hdop", 1, 0},
+		{"sats", 1, 0},
+		{"wifi_inflight_pkts_all_chans", 1, 0},
+		{"wifi_loudest_tx_chan", 1, 0},
+		{"wifi_loudest_tx_rssi", 1, -120},
+		{"wifi_loudest_tx_mac_hi", 1, 0},
+		{"wifi_loudest_tx_mac_lo", 1, 0},
+		{"bt_num_devices", 1, 0},
+		{"bt_loudest_tx_rssi", 1, -120},
+		{"bt_loudest_tx_mac_hi", 1, 0},
+		{"bt_loudest_tx_mac_lo", 1, 0},
+		{"wifi_inflight_pkt_data_len_all_chans", 1, 0},
+	},
+}
+
+// END GENERATED PAYLOAD SCHEMA
+
+// compactKeyFrames is a map of hubName+deviceID+frame kind+key ID to the quantised field values of a compact key frame.
+var compactKeyFrames = make(map[string][]int64)
+
+// resolveCompactFrame remembers the values of a compact key frame, or fills in the fields of a compact delta frame by
+// applying the differences to the key frame it refers to.
+func (payload *IotDecodedPayload) resolveCompactFrame(deviceKey string) error {
+	schema, exists := compactSchemas[payload.CompactFrameKind]
+	if !exists {
+		return fmt.Errorf("unknown compact frame kind %q", payload.CompactFrameKind)
+	}
+	mapKey := fmt.Sprintf("%s/%s/%d", deviceKey, payload.CompactFrameKind, payload.CompactKeyID)
+	if !payload.CompactIsDelta {
+		if len(payload.CompactValues) != len(schema) {
+			return fmt.Errorf("compact key frame has %d values, want %d", len(payload.CompactValues), len(schema))
+		}
+		compactKeyFrames[mapKey] = payload.CompactValues
+		return nil
+	}
+	keyValues, exists := compactKeyFrames[mapKey]
+	if !exists {
+		return fmt.Errorf("compact delta frame refers to an unknown key frame %q", mapKey)
+	}
+	if len(payload.CompactDeltas) != len(schema) {
+		return fmt.Errorf("compact delta frame has %d values, want %d", len(payload.CompactDeltas), len(schema))
+	}
+	values := make([]int64, len(schema))
+	for i, keyValue := range keyValues {
+		values[i] = keyValue
+		if payload.CompactDeltas[i] != nil {
+			values[i] += *payload.CompactDeltas[i]
+		}
+	}
+	// Decode the absolute values in the same way the payload formatter decodes a key frame.
+	fields := make(map[string]any)
+	for i := 0; i < len(schema); i++ {
+		if strings.HasSuffix(schema[i].Name, "_mac_hi") && i+1 < len(schema) {
+			hi, lo := values[i], values[i+1]
+			fields[strings.TrimSuffix(schema[i].Name, "_hi")] = fmt.Sprintf("%02x:%02x:%02x:%02x:%02x:%02x",
+				hi>>16, (hi>>8)&255, hi&255, lo>>16, (lo>>8)&255, lo&255)
+			i++
+			continue
+		}
+		fields[schema[i].Name] = float64(values[i])*schema[i].Resolution + schema[i].Offset
+	}
+	serialised, err := json.Marshal(fields)
+	if err != nil {
+		return err
+	}
+	return json.Unmarshal(serialised, payload)
+}
@@ -34,36 +34,42 @@ type IotEventReported struct {
 }
 
 type IotDecodedPayload struct {
-	Altitude                        float64 `json:"altitude"`
-	AmbientAltitudeMetre            float64 `json:"ambient_altitude_metre"`
-	AmbientHumidityPct              int     `json:"ambient_humidity_pct"`
-	AmbientPressureHpa              float64 `json:"ambient_pressure_hpa"`
-	AmbientTempCelcius              float64 `json:"ambient_temp_celcius"`
-	BattMillivolt                   int     `json:"batt_millivolt"`
-	BluetoothLoudestTXMac           string  `json:"bt_loudest_tx_mac"`
-	BluetoothLoudestTXRssi          int     `json:"bt_loudest_tx_rssi"`
-	BluetoothNumDevices             int     `json:"bt_num_devices"`
-	Cpu0ResetReason                 int     `json:"cpu0_reset_reason"`
-	Cpu1ResetReason                 int     `json:"cpu1_reset_reason"`
-	CpuWakeUpCause                  int     `json:"cpu_wake_up_cause"`
-	EspResetReason                  int     `json:"esp_reset_reason"`
-	GpsHeadingDeg                   int     `json:"gps_heading_deg"`
-	GpsPosAgeSec                    int     `json:"gps_pos_age_sec"`
-	GpsSpeedKhm                     int     `json:"gps_speed_kmh"`
-	Hdop                            int     `json:"hdop"`
-	HeapUsageKB                     int     `json:"heap_usage_kb"`
-	IsBattCharging                  int     `json:"is_batt_charging"`
-	LastRxSec                       int     `json:"last_rx_sec"`
-	Latitude                        float64 `json:"latitude"`
-	Longitude                       float64 `json:"longitude"`
-	PowerMilliamp                   int     `json:"power_milliamp"`
-	Sats                            int     `json:"sats"`
-	UptimeSec                       int     `json:"uptime_sec"`
-	WifiInflightPktsDataLenAllChans int     `json:"wifi_inflight_pkt_data_len_all_chans"`
-	WifiInflightPktsAllChans        int     `json:"wifi_inflight_pkts_all_chans"`
-	WifiLoudestTXChan               int     `json:"wifi_loudest_tx_chan"`
-	WifiLoudestTXMac                string  `json:"wifi_loudest_tx_mac"`
-	WifiLoudestTXRssi               int     `json:"wifi_loudest_tx_rssi"`
+	Altitude                        float64              `json:"altitude"`
+	AmbientAltitudeMetre            float64              `json:"ambient_altitude_metre"`
+	AmbientHumidityPct              int                  `json:"ambient_humidity_pct"`
+	AmbientPressureHpa              float64              `json:"ambient_pressure_hpa"`
+	AmbientTempCelcius              float64              `json:"ambient_temp_celcius"`
+	BattMillivolt                   int                  `json:"batt_millivolt"`
+	BluetoothLoudestTXMac           string               `json:"bt_loudest_tx_mac"`
+	BluetoothLoudestTXRssi          int                  `json:"bt_loudest_tx_rssi"`
+	BluetoothNumDevices             int                  `json:"bt_num_devices"`
+	CompactDeltas                   []*int64             `json:"compact_deltas"`
+	CompactFrameKind                string               `json:"compact_frame_kind"`
+	CompactIsDelta                  bool                 `json:"compact_is_delta"`
+	CompactKeyID                    int                  `json:"compact_key_id"`
+	CompactValues                   []int64              `json:"compact_values"`
+	Cpu0ResetReason                 int                  `json:"cpu0_reset_reason"`
+	Cpu1ResetReason                 int                  `json:"cpu1_reset_reason"`
+	CpuWakeUpCause                  int                  `json:"cpu_wake_up_cause"`
+	EspResetReason                  int                  `json:"esp_reset_reason"`
+	GpsHeadingDeg                   int                  `json:"gps_heading_deg"`
+	GpsPosAgeSec                    int                  `json:"gps_pos_age_sec"`
+	GpsSpeedKhm                     int                  `json:"gps_speed_kmh"`
+	Hdop                            int                  `json:"hdop"`
+	HeapUsageKB                     int                  `json:"heap_usage_kb"`
+	IsBattCharging                  int                  `json:"is_batt_charging"`
+	LastRxSec                       int                  `json:"last_rx_sec"`
+	Latitude                        float64              `json:"latitude"`
+	Longitude                       float64              `json:"longitude"`
+	PowerMilliamp                   int                  `json:"power_milliamp"`
+	Sats                            int                  `json:"sats"`
+	SensorSeries                    []map[string]float64 `json:"sensor_series"`
+	UptimeSec                       int                  `json:"uptime_sec"`
+	WifiInflightPktsDataLenAllChans int                  `json:"wifi_inflight_pkt_data_len_all_chans"`
+	WifiInflightPktsAllChans        int                  `json:"wifi_inflight_pkts_all_chans"`
+	WifiLoudestTXChan               int                  `json:"wifi_loudest_tx_chan"`
+	WifiLoudestTXMac                string               `json:"wifi_loudest_tx_mac"`
+	WifiLoudestTXRssi               int                  `json:"wifi_loudest_tx_rssi"`
 }
 
 func (payload *IotDecodedPayload) IsRFSensingTelemetry() bool {
@@ -103,6 +109,8 @@ func flattenedRecord(evProps map[string]any, env, rf IotDecodedPayload) map[stri
 	ret["last_rx_sec"] = env.LastRxSec
 	ret["power_milliamp"] = env.PowerMilliamp
 	ret["uptime_sec"] = env.UptimeSec
+	// A sensor series uplink carries a batch of samples, the fields above are its newest sample.
+	ret["sensor_series"] = env.SensorSeries
 
 	ret["altitude"] = rf.Altitude
 	ret["bt_loudest_tx_mac"] = rf.BluetoothLoudestTXMac
@@ -224,6 +232,13 @@ func handleEvent(ev *azeventhubs.ReceivedEventData, appendBlobClient *appendblob
 		return
 	}
 
+	if decoded.Properties.Reported.DecodedPayload.CompactFrameKind != "" {
+		if err := decoded.Properties.Reported.DecodedPayload.resolveCompactFrame(hubName + deviceID); err != nil {
+			log.Printf("failed to resolve compact frame: %v", err)
+			return
+		}
+	}
+
 	if decoded.Properties.Reported.DecodedPayload.IsRFSensingTelemetry() {
 		// Save the latest RF sensing payload in memory.
 		// Later on it will be saved to Azure blob storage alongside environment sensing payload.
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The airtime accountant computes the time-on-air of each uplink frame and keeps track of two budgets:
+// - The 1% duty cycle of each EU868 sub-band (ETSI EN 300 220), over a rolling window of an hour.
+// - The 30 seconds of uplink airtime a day permitted by The Things Network fair use policy, over a rolling window of a day.
+// The budgets are retained across soft resets and deep sleep.
+
+// AIRTIME_MAC_OVERHEAD_BYTES is the size of LoRaWAN MAC header, frame header, port, and MIC surrounding the application payload.
+// MHDR (1) + DevAddr (4) + FCtrl (1) + FCnt (2) + FPort (1) + MIC (4).
+#define AIRTIME_MAC_OVERHEAD_BYTES 13
+// AIRTIME_FOPTS_ALLOWANCE_BYTES is the room left for MAC commands piggybacked in FOpts (e.g. a link check request)
+// when estimating the airtime of an uplink that is not yet built.
+#define AIRTIME_FOPTS_ALLOWANCE_BYTES 2
+// AIRTIME_PREAMBLE_SYMBOLS is the length of the LoRa preamble used by LoRaWAN.
+#define AIRTIME_PREAMBLE_SYMBOLS 8
+// AIRTIME_DUTY_CYCLE_WINDOW_SEC is the observation period of the sub-band duty cycle.
+#define AIRTIME_DUTY_CYCLE_WINDOW_SEC 3600
+// AIRTIME_DUTY_CYCLE_BUCKET_SEC is the granularity of the sub-band duty cycle bookkeeping.
+#define AIRTIME_DUTY_CYCLE_BUCKET_SEC 300
+// AIRTIME_FAIR_USE_WINDOW_SEC is the observation period of the fair use budget.
+#define AIRTIME_FAIR_USE_WINDOW_SEC (24 * 3600)
+// AIRTIME_FAIR_USE_BUCKET_SEC is the granularity of the fair use bookkeeping.
+#define AIRTIME_FAIR_USE_BUCKET_SEC 3600
+// AIRTIME_FAIR_USE_MS is the uplink airtime permitted by The Things Network fair use policy in each observation period.
+#define AIRTIME_FAIR_USE_MS 30000
+// AIRTIME_NUM_SUB_BANDS is the number of EU868 sub-bands with a duty cycle limit.
+#define AIRTIME_NUM_SUB_BANDS 6
+
+// airtime_get_symbol_us returns the duration in microseconds of a LoRa symbol at the data rate.
+uint32_t airtime_get_symbol_us(int datarate);
+// airtime_get_toa_us returns the time-on-air in microseconds of a LoRa frame transmitted at the data rate (e.g. DR_SF9),
+// with 4/5 coding rate, explicit header, and CRC. phy_payload_len is the size of the entire LoRaWAN frame.
+uint32_t airtime_get_toa_us(int datarate, size_t phy_payload_len);
+// airtime_get_downlink_toa_us returns the time-on-air in microseconds of a downlink frame, which unlike an uplink carries no CRC.
+uint32_t airtime_get_downlink_toa_us(int datarate, size_t phy_payload_len);
+// airtime_get_uplink_toa_ms returns the estimated time-on-air in milliseconds of an uplink carrying the application payload.
+uint32_t airtime_get_uplink_toa_ms(int datarate, size_t app_payload_len);
+// airtime_record_tx records the time-on-air of a frame transmitted on the frequency.
+void airtime_record_tx(uint32_t freq_hz, int datarate, size_t phy_payload_len);
+// airtime_get_duty_cycle_remaining_ms returns the airtime in milliseconds still permitted in the frequency's sub-band.
+int airtime_get_duty_cycle_remaining_ms(uint32_t freq_hz);
+// airtime_get_fair_use_remaining_ms returns the airtime in milliseconds still permitted by the fair use policy.
+int airtime_get_fair_use_remaining_ms();
+// airtime_get_max_payload_len returns the size of the largest application payload that may be transmitted at the data rate
+// within the airtime budget. It returns -1 if not even an empty uplink fits.
+int airtime_get_max_payload_len(int datarate, int budget_ms);
+// airtime_get_total_ms returns the total uplink airtime in milliseconds since startup.
+unsigned long airtime_get_total_ms();
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// The battery model estimates the state of charge (SoC) of the 18650 cell by counting the charge going in and out of it,
+// using the AXP192 coulomb counter where available. Counting drifts over time, hence the estimate is pulled towards the
+// SoC read off the voltage curve whenever the battery current is low enough for its voltage to be near the open circuit
+// voltage. The very first estimate is read off the voltage curve. The model is kept in RTC memory across deep sleep, and is
+// advanced by the whole deep sleep interval upon waking up.
+// The projected runtime is the remaining charge divided by the average draw, which is a moving average over
+// BATTERY_DRAW_AVERAGE_SEC, time-weighted so that a long deep sleep counts as much as the same time spent awake.
+
+// BATTERY_CAPACITY_MAH is the nominal capacity of the battery.
+#define BATTERY_CAPACITY_MAH 3000
+// BATTERY_REST_MAX_MILLIAMP is the largest battery current at which the voltage is close enough to the open circuit voltage.
+#define BATTERY_REST_MAX_MILLIAMP 40
+// BATTERY_VOLTAGE_CORRECTION_PER_HOUR is the fraction of the difference between the counted SoC and the voltage SoC
+// corrected in an hour of resting battery.
+#define BATTERY_VOLTAGE_CORRECTION_PER_HOUR 0.5
+// BATTERY_DRAW_AVERAGE_SEC is the time constant of the moving average of the power draw.
+#define BATTERY_DRAW_AVERAGE_SEC 3600
+// BATTERY_MIN_MILLIVOLT is the lowest voltage reading of an installed battery.
+#define BATTERY_MIN_MILLIVOLT 2500
+
+// battery_update advances the model by an interval. batt_milliamp_hours is the charge that entered (+) or left (-) the
+// battery, and draw_milliamp_hours is the charge consumed by the device from either the battery or USB. The draw should be
+// integrated from the current readings, the coulomb counter is too coarse for short intervals. There are no current
+// readings during deep sleep, the sleep interval takes the coulomb counter or an estimate instead.
+void battery_update(int batt_millivolt, float batt_milliamp, double batt_milliamp_hours, double draw_milliamp_hours, unsigned long duration_ms);
+// battery_get_soc_pct returns the estimated state of charge in percent, or -1 if no battery has been read yet.
+float battery_get_soc_pct();
+// battery_get_remaining_mah returns the estimated remaining charge of the battery.
+double battery_get_remaining_mah();
+// battery_get_avg_draw_milliamp returns the moving average of the power draw.
+double battery_get_avg_draw_milliamp();
+// battery_get_projected_runtime_sec returns how long the remaining charge lasts at the average draw, or -1 if unknown.
+long battery_get_projected_runtime_sec();
+// battery_get_soc_from_voltage reads the state of charge in percent off the voltage curve of a resting Li-ion cell.
+float battery_get_soc_from_voltage(int millivolt);
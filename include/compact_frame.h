@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "payload_schema.h"
+
+// A compact frame packs the fields of a status or position uplink into a bit stream according to a per-field schema.
+// The frame begins with a one-byte header:
+// - Bit 0, 1 - format version, currently COMPACT_FRAME_VERSION.
+// - Bit 2 - 0 for a key frame that carries all fields, 1 for a delta frame.
+// - Bit 3 - 7 - key frame ID (0 - 31). A delta frame carries the ID of the key frame it is relative to.
+// A key frame is followed by each field encoded according to the schema.
+// A delta frame is followed by a bitmap of changed fields (1 bit per field, in schema order), and then the zig-zag varint
+// difference between the quantised value and the key frame's quantised value of each changed field.
+// Delta frames are only ever relative to a key frame that the network has acknowledged, either with an ACK or by
+// responding with a downlink message in the RX windows following the key frame, the answer to a link check included.
+
+// COMPACT_FRAME_VERSION is the format version written into the header of each compact frame.
+#define COMPACT_FRAME_VERSION 1
+// COMPACT_FRAME_MAX_DELTAS is the maximum number of consecutive delta frames before a key frame is transmitted again.
+// The periodic key frame helps a decoder that has missed the previous key frame to catch up.
+#define COMPACT_FRAME_MAX_DELTAS 8
+
+// COMPACT_FIELD_UNSIGNED is a fixed-width unsigned integer field.
+#define COMPACT_FIELD_UNSIGNED 0
+// COMPACT_FIELD_SIGNED is a fixed-width two's complement integer field.
+#define COMPACT_FIELD_SIGNED 1
+// COMPACT_FIELD_VARINT is a variable-width unsigned integer field.
+#define COMPACT_FIELD_VARINT 2
+
+// COMPACT_FRAME_STATUS is the kind of frame that carries system status and environment sensor readings.
+#define COMPACT_FRAME_STATUS 0
+// COMPACT_FRAME_POS is the kind of frame that carries GPS location and wifi/bluetooth foxhunt info.
+#define COMPACT_FRAME_POS 1
+#define COMPACT_FRAME_KINDS 2
+
+// COMPACT_STATUS_FIELD_INDEX defines the index of a status frame field, e.g. COMPACT_STATUS_LAST_RX_SEC.
+#define COMPACT_STATUS_FIELD_INDEX(id, ...) COMPACT_STATUS_##id,
+// COMPACT_POS_FIELD_INDEX defines the index of a position frame field, e.g. COMPACT_POS_LATITUDE.
+#define COMPACT_POS_FIELD_INDEX(id, ...) COMPACT_POS_##id,
+
+// The fields of a status frame in transmission order, see payload_schema.h.
+enum
+{
+    PAYLOAD_SCHEMA_STATUS(COMPACT_STATUS_FIELD_INDEX)
+        COMPACT_STATUS_NUM_FIELDS
+};
+
+// The fields of a position frame in transmission order, see payload_schema.h.
+enum
+{
+    PAYLOAD_SCHEMA_POS(COMPACT_POS_FIELD_INDEX)
+        COMPACT_POS_NUM_FIELDS
+};
+
+#define COMPACT_FRAME_MAX_FIELDS COMPACT_POS_NUM_FIELDS
+
+// compact_field_t describes how a field is quantised and encoded.
+typedef struct
+{
+    // name is the name of the decoded field.
+    const char *name;
+    // encoding is one of COMPACT_FIELD_UNSIGNED, COMPACT_FIELD_SIGNED, and COMPACT_FIELD_VARINT.
+    uint8_t encoding;
+    // bits is the width of a fixed-width field, or the number of value bits in each group of a varint field.
+    uint8_t bits;
+    // delta_bits is the number of value bits in each group of the zig-zag varint carrying the field's difference in a delta frame.
+    uint8_t delta_bits;
+    // resolution is the value represented by the least significant bit, e.g. 0.01 for temperature in centidegrees.
+    double resolution;
+    // offset is subtracted from the value before quantisation, e.g. the RSSI floor.
+    double offset;
+} compact_field_t;
+
+// compact_frame_get_schema returns the field schema of the frame kind, and stores the number of fields in num_fields.
+const compact_field_t *compact_frame_get_schema(int kind, size_t *num_fields);
+// compact_frame_encode encodes the field values of the frame kind into buf, and returns the number of bytes written.
+// The values are in the order of the frame kind's schema. It returns 0 if buf is too small.
+size_t compact_frame_encode(int kind, const double *values, uint8_t *buf, size_t buf_len);
+// compact_frame_acknowledge tells that the network has received a frame of the kind, given its header byte.
+// If the frame is the latest key frame of the kind, subsequent frames of the kind may be encoded as deltas relative to it.
+void compact_frame_acknowledge(int kind, uint8_t header);
+// compact_frame_get_num_deltas returns the total number of delta frames encoded since startup.
+unsigned long compact_frame_get_num_deltas();
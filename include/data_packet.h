@@ -3,13 +3,42 @@
 #include <stdint.h>
 #include <stddef.h>
 
+// DataPacket writes values into a bit stream, the least significant bit of each value is written first.
+// The bits are packed tightly without padding, the last byte of the content is padded with zeros.
+// The bit stream is written in place into a buffer owned by the caller, e.g. the transmission queue, no memory is allocated.
 class DataPacket
 {
 public:
-    size_t cursor;
+    size_t bit_cursor, capacity;
     uint8_t *content;
-    DataPacket(size_t);
-    ~DataPacket();
-    void writeInteger(uint64_t, size_t);
-    void write32BitDouble(double);
+    // overflow is set when a write did not fit into the capacity. The write is discarded in that case.
+    bool overflow;
+    // DataPacket clears the buffer of the size given and begins writing at its first bit.
+    DataPacket(uint8_t *, size_t);
+    // length returns the number of bytes that hold the bits written so far.
+    size_t length();
+    void writeBits(uint32_t, size_t);
+    void writeSignedBits(int32_t, size_t);
+    void writeVarint(uint32_t, size_t);
+    void writeZigZagVarint(int32_t, size_t);
 };
+
+// DataPacketReader reads back the values written by DataPacket in the same order.
+class DataPacketReader
+{
+public:
+    size_t bit_cursor, len;
+    const uint8_t *content;
+    // overflow is set when a read went past the end of the content. The value read is 0 in that case.
+    bool overflow;
+    DataPacketReader(const uint8_t *, size_t);
+    uint32_t readBits(size_t);
+    int32_t readSignedBits(size_t);
+    uint32_t readVarint(size_t);
+    int32_t readZigZagVarint(size_t);
+};
+
+// data_packet_zigzag maps signed integers to unsigned integers so that small magnitudes use few bits: 0, -1, 1, -2, 2 => 0, 1, 2, 3, 4.
+uint32_t data_packet_zigzag(int32_t);
+// data_packet_unzigzag reverses data_packet_zigzag.
+int32_t data_packet_unzigzag(uint32_t);
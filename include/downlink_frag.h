@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "lorawan.h"
+
+// A message too long for a single downlink is split into fragments sent on LORAWAN_PORT_FRAGMENT. Each fragment begins
+// with a two-byte header:
+// - Byte 0 - message ID (0 - 255), chosen by the sender.
+// - Byte 1 - bit 0 - 3 is the fragment index (0 - 15), bit 4 - 7 is the number of fragments minus 1.
+// All fragments but the last carry exactly DOWNLINK_FRAG_PAYLOAD_LEN bytes of the message, hence the fragments may
+// arrive in any order. After each fragment, a reception report is transmitted on LORAWAN_PORT_FRAGMENT_REPORT:
+// - Byte 0 - message ID.
+// - Byte 1 - number of fragments.
+// - Byte 2 - bitmap of missing fragments, bit N is set if fragment N is still missing. It is 0 once the message is complete.
+// The sender should only resend the missing fragments.
+
+// DOWNLINK_FRAG_HEADER_LEN is the size of the header preceding each fragment.
+#define DOWNLINK_FRAG_HEADER_LEN 2
+// DOWNLINK_FRAG_PAYLOAD_LEN is the size of the message carried in each fragment but the last.
+// A fragment fits into the 51 bytes maximum payload of the slowest data rates.
+#define DOWNLINK_FRAG_PAYLOAD_LEN 48
+// DOWNLINK_FRAG_MAX_FRAGMENTS is the maximum number of fragments of a message.
+#define DOWNLINK_FRAG_MAX_FRAGMENTS ((LORAWAN_MAX_MESSAGE_LEN + DOWNLINK_FRAG_PAYLOAD_LEN - 1) / DOWNLINK_FRAG_PAYLOAD_LEN)
+// DOWNLINK_FRAG_NUM_SLOTS is the number of messages reassembled at the same time.
+#define DOWNLINK_FRAG_NUM_SLOTS 2
+// DOWNLINK_FRAG_TIMEOUT_SEC is the duration after which an incomplete message is discarded.
+// A downlink only arrives after an uplink, hence it takes several transmission intervals to receive all fragments.
+#define DOWNLINK_FRAG_TIMEOUT_SEC (15 * 60)
+// DOWNLINK_FRAG_REPORT_LEN is the size of a reception report.
+#define DOWNLINK_FRAG_REPORT_LEN 3
+
+// DOWNLINK_FRAG_MALFORMED is returned by downlink_frag_receive for a fragment that cannot be placed into a message.
+#define DOWNLINK_FRAG_MALFORMED -1
+// DOWNLINK_FRAG_INCOMPLETE is returned by downlink_frag_receive while fragments of the message are still missing.
+#define DOWNLINK_FRAG_INCOMPLETE 0
+// DOWNLINK_FRAG_COMPLETE is returned by downlink_frag_receive when the fragment completes the message.
+#define DOWNLINK_FRAG_COMPLETE 1
+
+// downlink_frag_receive handles a fragment and writes the reception report of its message into report.
+// When it returns DOWNLINK_FRAG_COMPLETE, the reassembled message is copied into message.
+// When it returns DOWNLINK_FRAG_MALFORMED, the report is left untouched.
+int downlink_frag_receive(const uint8_t *frag, size_t len, uint8_t report[DOWNLINK_FRAG_REPORT_LEN], lorawan_message_buf_t *message);
+// downlink_frag_get_num_pending returns the number of incomplete messages being reassembled.
+int downlink_frag_get_num_pending();
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The energy ledger tells which feature consumes the battery. The power task measures the charge consumed in between two
+// power status readings and books it to each state active during the interval, along with the duration. On battery power
+// the charge is read from the coulomb counter of AXP192, otherwise (and on AXP2101) it is integrated from the power draw
+// readings. The states overlap, hence the charge attributed to a peripheral is the extra draw while it is on compared to
+// while it is off, multiplied by its on-time. The two CPU states and deep sleep take turns, the charge booked to them adds
+// up to the total. The peripherals are all off during deep sleep, which is left out of their comparison.
+// The ledger is kept in RTC memory and accumulates across deep sleep. The first power status reading after waking up books
+// the interval since the last reading before deep sleep, measured by the RTC time, to deep sleep.
+//
+// The ledger is transmitted on LORAWAN_PORT_ENERGY:
+// - Bit 0, 1 - format version, currently ENERGY_LEDGER_REPORT_VERSION.
+// - 1 bit - 1 if the coulomb counter measured the latest interval.
+// - Varints (7 bits per group) - the total duration in seconds and the total charge in ENERGY_LEDGER_REPORT_UNIT_UAH.
+// - ENERGY_LEDGER_NUM_STATES pairs of varints (7 bits per group) - the duration in seconds and the charge in
+//   ENERGY_LEDGER_REPORT_UNIT_UAH booked to each state while it was active, in the order of the state numbers.
+// The values are written by DataPacket, least significant bit first. They accumulate from one report to the next.
+
+// ENERGY_LEDGER_LORAWAN is the state of LoRaWAN transmitting and listening to the receive windows.
+#define ENERGY_LEDGER_LORAWAN 0
+// ENERGY_LEDGER_WIFI is the state of WiFi scanning.
+#define ENERGY_LEDGER_WIFI 1
+// ENERGY_LEDGER_BLUETOOTH is the state of Bluetooth scanning.
+#define ENERGY_LEDGER_BLUETOOTH 2
+// ENERGY_LEDGER_GPS is the state of GPS powered on.
+#define ENERGY_LEDGER_GPS 3
+// ENERGY_LEDGER_OLED is the state of the OLED display turned on.
+#define ENERGY_LEDGER_OLED 4
+// ENERGY_LEDGER_CPU_FULL is the state of the CPU running at POWER_DEFAULT_CPU_FREQ_MHZ.
+#define ENERGY_LEDGER_CPU_FULL 5
+// ENERGY_LEDGER_CPU_REDUCED is the state of the CPU slowed down to POWER_LOWEST_CPU_FREQ_MHZ when there is nothing to do.
+#define ENERGY_LEDGER_CPU_REDUCED 6
+// ENERGY_LEDGER_DEEP_SLEEP is the state of the CPUs and peripherals powered off in deep sleep.
+#define ENERGY_LEDGER_DEEP_SLEEP 7
+// ENERGY_LEDGER_NUM_STATES is the number of states.
+#define ENERGY_LEDGER_NUM_STATES 8
+
+// ENERGY_LEDGER_AXP192_MAH_PER_COUNT is the charge in mAh of one count of the AXP192 coulomb counter, given its 0.5mA
+// current resolution and its 25Hz ADC sampling rate.
+#define ENERGY_LEDGER_AXP192_MAH_PER_COUNT (65536.0 * 0.5 / 3600.0 / 25.0)
+// ENERGY_LEDGER_REPORT_VERSION is the format version written into the header of each report.
+#define ENERGY_LEDGER_REPORT_VERSION 2
+// ENERGY_LEDGER_REPORT_UNIT_UAH is the unit of charge in micro-amp hours written into the report.
+#define ENERGY_LEDGER_REPORT_UNIT_UAH 10
+// ENERGY_LEDGER_REPORT_INTERVAL_SEC is the minimum duration booked to the ledger in between two reports.
+#define ENERGY_LEDGER_REPORT_INTERVAL_SEC 3600
+
+// energy_ledger_entry_t is the charge consumed over a duration.
+typedef struct
+{
+    unsigned long long duration_ms;
+    double milliamp_hours;
+} energy_ledger_entry_t;
+
+// energy_ledger_record books the charge consumed over an interval to the total and to each active state. states is a bit
+// field of the ENERGY_LEDGER_* state numbers.
+void energy_ledger_record(int states, double milliamp_hours, unsigned long duration_ms, bool from_coulomb_counter);
+// energy_ledger_get_total returns the charge consumed in total.
+energy_ledger_entry_t energy_ledger_get_total();
+// energy_ledger_get_state returns the charge consumed while the state was active.
+energy_ledger_entry_t energy_ledger_get_state(int state);
+// energy_ledger_get_attributed_mah returns the charge consumed because of the state.
+// If a peripheral has never been off, all of the charge consumed while it was on is attributed to it.
+double energy_ledger_get_attributed_mah(int state);
+// energy_ledger_get_state_name returns the short name of the state for display.
+const char *energy_ledger_get_state_name(int state);
+// energy_ledger_log logs the charge attributed to each state.
+void energy_ledger_log();
+// energy_ledger_is_report_due returns true if the ledger has not been transmitted for a while.
+bool energy_ledger_is_report_due();
+// energy_ledger_encode_report encodes the ledger into the buffer and returns its size. It returns 0 if the report does not
+// fit into max_len bytes.
+size_t energy_ledger_encode_report(uint8_t *buf, size_t max_len);
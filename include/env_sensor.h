@@ -1,15 +1,56 @@
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
 // ENV_SENSOR_TASK_LOOP_DELAY_MS is the sleep interval of the environment sensor task loop.
 #define ENV_SENSOR_TASK_LOOP_DELAY_MS 1500
 
+// A sensor series frame carries a batch of samples taken at a regular interval, oldest first:
+// - Bit 0, 1 - format version, currently ENV_SENSOR_SERIES_VERSION.
+// - Bit 2 - 7 - number of samples (1 - 63).
+// - Varint (7 bits per group) - the sampling interval in seconds.
+// - Varint (7 bits per group) - the age of the newest sample in seconds.
+// - The oldest sample - temperature in 0.01 celcius (14 bits signed), humidity in percentage (7 bits),
+//   pressure in 0.1 hpa (14 bits), battery voltage in millivolts (13 bits).
+// - Each subsequent sample - the zig-zag varint difference from the previous sample of temperature (4 bits per group),
+//   humidity (2 bits per group), pressure (3 bits per group), and battery voltage (3 bits per group).
+// The values are written by DataPacket, least significant bit first.
+
+// ENV_SENSOR_SERIES_VERSION is the format version written into the header of each sensor series frame.
+#define ENV_SENSOR_SERIES_VERSION 1
+// ENV_SENSOR_SERIES_INTERVAL_SEC is the interval between two samples of the sensor series.
+#define ENV_SENSOR_SERIES_INTERVAL_SEC 30
+// ENV_SENSOR_SERIES_CAPACITY is the maximum number of samples kept for the next series, the oldest sample is overwritten.
+#define ENV_SENSOR_SERIES_CAPACITY 63
+// ENV_SENSOR_SERIES_MIN_BATCH is the number of samples needed before the series is transmitted in place of a status frame.
+#define ENV_SENSOR_SERIES_MIN_BATCH 16
+
 struct env_data
 {
     double temp_celcius, humidity_pct, pressure_hpa, altitude_metre;
 };
 
+// env_sample_t is a quantised sample of the sensor series.
+typedef struct
+{
+    int16_t temp_centi_celcius;
+    uint8_t humidity_pct;
+    uint16_t pressure_deci_hpa;
+    uint16_t batt_millivolt;
+} env_sample_t;
+
 void env_sensor_setup();
 void env_sensor_read_decode();
 double env_sensor_get_sum_temp_readings();
 struct env_data env_sensor_get_data();
-void env_sensor_task_loop(void *_);
\ No newline at end of file
+// env_sensor_get_num_samples returns the number of samples waiting to be transmitted in a series.
+size_t env_sensor_get_num_samples();
+// env_sensor_encode_series encodes the latest samples that fit into max_len bytes into a sensor series frame, and
+// returns the number of bytes written. The samples stay in the series until env_sensor_release_series is called, hence
+// a frame that is discarded before transmission loses none of them. It returns 0 if there is no sample.
+size_t env_sensor_encode_series(uint8_t *buf, size_t max_len);
+// env_sensor_release_series removes the samples encoded by the latest env_sensor_encode_series from the series, along
+// with the older samples that did not fit into the frame. Call it once the frame has been handed over for transmission.
+void env_sensor_release_series();
+void env_sensor_task_loop(void *_);
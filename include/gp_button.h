@@ -24,10 +24,14 @@
 
 // GP_BUTTON_TASK_LOOP_DELAY_MS is the sleep interval of the GP button task loop.
 #define GP_BUTTON_TASK_LOOP_DELAY_MS (MORSE_DOT_PRESS_DURATION_MS / 5)
+// GP_BUTTON_ENQUEUE_RETRY_MS is the interval between two attempts at enqueuing a finished message while the transmission queue is full.
+#define GP_BUTTON_ENQUEUE_RETRY_MS 5000
 
 void gp_button_read();
 char gp_button_decode_morse(String);
 void gp_button_decode_morse_and_clear();
+// gp_button_enqueue_finished_message enqueues the typed message for transmission once the user has finished typing it.
+void gp_button_enqueue_finished_message();
 void gp_button_clear_morse_message_buf();
 String gp_button_get_latest_morse_signals();
 String gp_button_get_morse_message_buf();
@@ -2,6 +2,11 @@
 
 // GPS_TASK_LOOP_DELAY_MS is the sleep interval of the GPS receiver task loop.
 #define GPS_TASK_LOOP_DELAY_MS 1000
+// GPS_FIXED_TASK_LOOP_DELAY_MS is the sleep interval of the GPS receiver task loop once the position is fixed.
+#define GPS_FIXED_TASK_LOOP_DELAY_MS 4000
+// GPS_RECEPTION_WINDOW_MS is how long the GPS task keeps the UART receiving in each round. The receiver sends a burst of
+// NMEA sentences once a second, and the UART does not receive while the chip is in light sleep.
+#define GPS_RECEPTION_WINDOW_MS 1100
 
 // gps_data describes the coordinates and clock time read from GPS.
 struct gps_data
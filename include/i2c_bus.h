@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+// The I2C bus at I2C_FREQUENCY_HZ is shared by the PMU, the environment sensor, and the OLED display. It is granted to
+// one device at a time, and when it is released, it is handed over to the waiting device of the highest priority
+// regardless of the priority of the waiting tasks. The OLED display pushes its frame one page at a time and releases the
+// bus in between, so that the PMU and the sensor readings never wait for a whole frame. The task holding the bus inherits
+// the priority of a waiting task of higher priority until it releases the bus, so that a task of medium priority cannot
+// hold up the waiting task by preempting the holder. The duration each device waits for the bus and holds it is recorded
+// for the statistics.
+
+// I2C_BUS_DEVICE_PMU is the AXP power management chip, the device of the highest priority. A manual CPU frequency change
+// holds the bus as the PMU too, the APB clock of the I2C controller changes along with the CPU frequency below 80MHz.
+#define I2C_BUS_DEVICE_PMU 0
+// I2C_BUS_DEVICE_ENV_SENSOR is the BME280 environment sensor.
+#define I2C_BUS_DEVICE_ENV_SENSOR 1
+// I2C_BUS_DEVICE_OLED is the SSD1306 OLED display, the device of the lowest priority.
+#define I2C_BUS_DEVICE_OLED 2
+// I2C_BUS_NUM_DEVICES is the number of devices.
+#define I2C_BUS_NUM_DEVICES 3
+
+// i2c_bus_stats_t is the number of times a device has locked the bus, and how long it waited for the bus and held it.
+typedef struct
+{
+    unsigned long num_locks;
+    uint64_t total_wait_us, total_hold_us;
+    uint32_t max_wait_us, max_hold_us;
+} i2c_bus_stats_t;
+
+// i2c_bus_lock waits for the bus and grants it to the device.
+void i2c_bus_lock(int device);
+// i2c_bus_unlock releases the bus held by the device.
+void i2c_bus_unlock(int device);
+// i2c_bus_get_stats returns the statistics of the device.
+i2c_bus_stats_t i2c_bus_get_stats(int device);
+// i2c_bus_log_stats logs the statistics of each device.
+void i2c_bus_log_stats();
@@ -0,0 +1,70 @@
+#pragma once
+
+// The link adaptation picks the fastest data rate and the lowest transmission power that keep the link margin above
+// LINK_ADAPT_TARGET_MARGIN_DB. The data rate and power configured by the power mode are the most robust settings it
+// ever uses, and it falls back to them quickly when the network stops responding.
+// The link margin is the demodulation margin of the uplink at the best gateway, which the network reports in the answer to
+// a link check request (LinkCheckAns). The SNR of a downlink tells little about the uplink, the gateway transmits at a much
+// higher power (in RX2 especially) and the transmission power of the device does not affect it, hence it is only kept
+// for display. As the uplinks are unconfirmed, a link check request is attached to an uplink every now and then. The link
+// checks are budgeted by time rather than by uplinks, so that the downlinks stay within The Things Network fair use
+// policy (10 downlink messages a day) regardless of the transmission interval. Confirmed uplinks never carry a link check,
+// their acknowledgement serves as a response (without a margin) and counts against the budget alike.
+// A step towards a faster data rate or less power is verified by a link check shortly afterwards, and undone if the
+// margin falls short or the check goes unanswered.
+
+// LINK_ADAPT_TARGET_MARGIN_DB is the minimum link margin (SNR above the demodulation floor) to keep.
+#define LINK_ADAPT_TARGET_MARGIN_DB 10
+// LINK_ADAPT_HISTORY_LEN is the number of the latest link margin samples remembered for each data rate.
+#define LINK_ADAPT_HISTORY_LEN 8
+// LINK_ADAPT_MIN_SAMPLES is the number of link margin samples needed at the current settings before stepping down.
+#define LINK_ADAPT_MIN_SAMPLES 2
+// LINK_ADAPT_MAX_MISSES is the number of consecutive unanswered uplinks after which the settings return to the power mode's.
+#define LINK_ADAPT_MAX_MISSES 2
+// LINK_ADAPT_PROBE_INTERVAL_SEC is the interval between two link checks while the settings hold.
+#define LINK_ADAPT_PROBE_INTERVAL_SEC (6 * 3600)
+// LINK_ADAPT_MIN_PROBE_INTERVAL_SEC is the shortest interval between two solicited downlinks, which is also the interval
+// between a change of settings (or an unanswered uplink) and the link check that confirms it. It caps the link checks at
+// 8 a day, leaving room for the acknowledgements of a few user messages.
+#define LINK_ADAPT_MIN_PROBE_INTERVAL_SEC (3 * 3600)
+// LINK_ADAPT_VERIFY_PROBE_INTERVAL_SEC is the interval between a step towards a faster data rate or less power and the
+// link check that verifies it. A step needs LINK_ADAPT_MIN_SAMPLES samples since the previous change, hence there is at most
+// one verification per LINK_ADAPT_PROBE_INTERVAL_SEC.
+#define LINK_ADAPT_VERIFY_PROBE_INTERVAL_SEC (10 * 60)
+// LINK_ADAPT_MIN_POWER_DBM is the lowest transmission power to use.
+#define LINK_ADAPT_MIN_POWER_DBM 2
+// LINK_ADAPT_POWER_STEP_DB is the amount of transmission power adjusted in one step.
+#define LINK_ADAPT_POWER_STEP_DB 2
+// LINK_ADAPT_LMIC_RSSI_OFFSET is added to the RSSI reading by LMIC to keep it in an unsigned range (LMIC.rssi).
+#define LINK_ADAPT_LMIC_RSSI_OFFSET 64
+// LINK_ADAPT_MAX_DR is the fastest data rate supported by all channels, which is SF7 with 125kHz bandwidth.
+#define LINK_ADAPT_MAX_DR 5
+
+// link_adapt_reset returns the settings to the power mode's and forgets the link margin history.
+void link_adapt_reset();
+// link_adapt_get_datarate returns the data rate (e.g. DR_SF9) to use for the next uplink.
+int link_adapt_get_datarate();
+// link_adapt_get_power_dbm returns the transmission power to use for the next uplink.
+int link_adapt_get_power_dbm();
+// link_adapt_should_probe is called once before each uplink, it returns true if the uplink should carry a link check request.
+// is_confirmed is true if the uplink is a confirmed uplink, which never needs one.
+bool link_adapt_should_probe(bool is_confirmed);
+// link_adapt_record_uplink records the outcome of an uplink and adapts the settings for the next one.
+// expect_response is true if the uplink asked for a response (link check or confirmation).
+// responded is true if a downlink message arrived in either RX window, in which case lmic_rssi and lmic_snr are the raw LMIC readings.
+// gw_margin_db is the demodulation margin reported by the link check answer to the uplink, or -1 if there was none.
+void link_adapt_record_uplink(int datarate, bool expect_response, bool responded, int lmic_rssi, int lmic_snr, int gw_margin_db);
+// link_adapt_get_margin_db returns the latest gateway demodulation margin, or 0 if there is none.
+float link_adapt_get_margin_db();
+// link_adapt_get_rssi_dbm returns the RSSI of the latest downlink message.
+int link_adapt_get_rssi_dbm();
+// link_adapt_get_snr_db returns the SNR of the latest downlink message.
+float link_adapt_get_snr_db();
+// link_adapt_get_last_decision returns a short description of the latest adaptation decision.
+const char *link_adapt_get_last_decision();
+// link_adapt_get_num_responses returns the number of uplinks at the data rate answered by a downlink message.
+int link_adapt_get_num_responses(int datarate);
+// link_adapt_get_num_probes returns the number of uplinks at the data rate that asked for a response.
+int link_adapt_get_num_probes(int datarate);
+// link_adapt_get_spreading_factor returns the spreading factor (7 - 12) of a data rate.
+int link_adapt_get_spreading_factor(int datarate);
@@ -9,20 +9,52 @@
 #define LORAWAN_EV_IDLING_BEFORE_TXRX 101
 // LORAWAN_EV_ACK is a magic event number unrelated to LoRaWAN standard, it is exclusively used by this program's LoRaWAN event loop.
 #define LORAWAN_EV_ACK 102
-// LORAWAN_EV_RESPONSE is a magic event number unrelated to LoRaWAN standard, it is exclusively used by this program's LoRaWAN event loop.
-#define LORAWAN_EV_RESPONSE 103
 // LORAWAN_TASK_LOOP_DELAY_MS is the maximum sleep interval of the LoRaWAN transceiver task loop.
 // The actual interval will be determined at runtime depending on the deadline of LMIC internal tasks.
 #define LORAWAN_TASK_LOOP_DELAY_MS 256
+// LORAWAN_JOB_DEADLINE_MARGIN_MS is the time the task loop wakes up ahead of the deadline of the next LMIC internal task.
+#define LORAWAN_JOB_DEADLINE_MARGIN_MS 2
+// LORAWAN_RUNLOOP_BURST is the number of times the LMIC run loop runs each time the task loop wakes up.
+#define LORAWAN_RUNLOOP_BURST 4
+// LORAWAN_CLOCK_ERROR_PCT is the clock error LMIC compensates for by opening the receive windows earlier and longer.
+// rx_timing.h measures whether a tighter allowance would still catch the downlinks.
+#define LORAWAN_CLOCK_ERROR_PCT 12
+// LORAWAN_EVENT_QUEUE_CAPACITY is the maximum number of LMIC events waiting for the event task.
+// An uplink raises a handful of events, the event task catches up long before the next uplink.
+#define LORAWAN_EVENT_QUEUE_CAPACITY 16
+// LORAWAN_DOWNLINK_QUEUE_CAPACITY is the maximum number of downlink messages waiting for the event task.
+#define LORAWAN_DOWNLINK_QUEUE_CAPACITY 2
+// LORAWAN_EVENT_TASK_LOOP_DELAY_MS is the maximum sleep interval of the event task loop in between LMIC events.
+#define LORAWAN_EVENT_TASK_LOOP_DELAY_MS 1000
 
 // LORAWAN_PORT_COMMAND is the numeric port number used for transmitting uplink toolbox command messages.
 #define LORAWAN_PORT_COMMAND 112
 // LORAWAN_PORT_MESSAGE is the numeric port number used for transmitting uplink text messages.
 #define LORAWAN_PORT_MESSAGE 129
+// LORAWAN_PORT_MESSAGE_COMPACT is the numeric port number used for transmitting uplink text messages compressed by text_codec.
+#define LORAWAN_PORT_MESSAGE_COMPACT 132
 // LORAWAN_PORT_STATUS_SENSOR is the numeric port number used for transmitting system status and sensor readings.
 #define LORAWAN_PORT_STATUS_SENSOR 119
 // LORAWAN_PORT_STATUS_SENSOR is the numeric port number used for transmitting GPS location and wifi foxhunt info.
 #define LORAWAN_PORT_GPS_WIFI 120
+// LORAWAN_PORT_STATUS_SENSOR_COMPACT is the numeric port number used for transmitting system status and sensor readings in a compact frame.
+// The fixed-width frame format of LORAWAN_PORT_STATUS_SENSOR is no longer transmitted, though decoders still understand it.
+#define LORAWAN_PORT_STATUS_SENSOR_COMPACT 121
+// LORAWAN_PORT_GPS_WIFI_COMPACT is the numeric port number used for transmitting GPS location and wifi foxhunt info in a compact frame.
+// The fixed-width frame format of LORAWAN_PORT_GPS_WIFI is no longer transmitted, though decoders still understand it.
+#define LORAWAN_PORT_GPS_WIFI_COMPACT 122
+// LORAWAN_PORT_SENSOR_SERIES is the numeric port number used for transmitting a batch of environment sensor and battery samples.
+#define LORAWAN_PORT_SENSOR_SERIES 123
+// LORAWAN_PORT_FRAGMENT is the numeric port number of downlink messages carrying a fragment of a longer message (see downlink_frag.h).
+#define LORAWAN_PORT_FRAGMENT 130
+// LORAWAN_PORT_FRAGMENT_REPORT is the numeric port number used for transmitting the reception report of a fragmented downlink message.
+#define LORAWAN_PORT_FRAGMENT_REPORT 131
+// LORAWAN_PORT_KEEPALIVE is the numeric port number used for transmitting a keepalive in place of suppressed routine uplinks (see send_on_delta.h).
+#define LORAWAN_PORT_KEEPALIVE 133
+// LORAWAN_PORT_RX_TIMING is the numeric port number used for transmitting the receive window timing report (see rx_timing.h).
+#define LORAWAN_PORT_RX_TIMING 134
+// LORAWAN_PORT_ENERGY is the numeric port number used for transmitting the energy ledger (see energy_ledger.h).
+#define LORAWAN_PORT_ENERGY 135
 // LORAWAN_TX_INTERVAL_MS is the interval to wait in between two routine uplink transmissions.
 #define LORAWAN_TX_INTERVAL_MS 20000
 
@@ -36,6 +68,40 @@
 // LORAWAN_MAX_MESSAGE_LEN is the length never exceeded by a message received from or transmitted to The Things Network.
 static const size_t LORAWAN_MAX_MESSAGE_LEN = 256;
 
+// LORAWAN_QUEUE_CAPACITY is the maximum number of uplink messages waiting for transmission.
+#define LORAWAN_QUEUE_CAPACITY 8
+// LORAWAN_PRIORITY_IDLE is the priority of an empty uplink message that only gives the network an opportunity to send a downlink message.
+#define LORAWAN_PRIORITY_IDLE 0
+// LORAWAN_PRIORITY_TELEMETRY is the priority of status, sensor, and position uplink messages.
+// A telemetry message replaces the older message of the same port waiting in the queue.
+#define LORAWAN_PRIORITY_TELEMETRY 1
+// LORAWAN_PRIORITY_USER_MESSAGE is the priority of text messages and commands typed by the user.
+#define LORAWAN_PRIORITY_USER_MESSAGE 2
+// LORAWAN_PRIORITY_CONTROL is the priority of protocol messages such as the reception report of a fragmented downlink message.
+// A control message replaces the older message of the same port waiting in the queue.
+#define LORAWAN_PRIORITY_CONTROL 3
+// LORAWAN_TELEMETRY_TTL_SEC is the duration a telemetry message may wait in the queue before it is discarded.
+#define LORAWAN_TELEMETRY_TTL_SEC 180
+// LORAWAN_USER_MESSAGE_TTL_SEC is the duration a user message may wait in the queue before it is discarded.
+#define LORAWAN_USER_MESSAGE_TTL_SEC (30 * 60)
+// LORAWAN_USER_MESSAGE_REPEATS is the number of times a user message is transmitted again when the network has not
+// acknowledged it. User messages are the only confirmed uplinks, telemetry is not worth the downlink capacity of an acknowledgement.
+#define LORAWAN_USER_MESSAGE_REPEATS 4
+// LORAWAN_CONFIRMED_BACKOFF_SEC is the wait before the first retransmission of an unacknowledged uplink, it doubles after
+// each further attempt. The wait is never shorter than the off-time the 1% sub-band duty cycle imposes on the uplink's airtime.
+#define LORAWAN_CONFIRMED_BACKOFF_SEC 60
+// LORAWAN_CONFIRMED_MAX_BACKOFF_SEC is the longest wait before the retransmission of an unacknowledged uplink.
+#define LORAWAN_CONFIRMED_MAX_BACKOFF_SEC (10 * 60)
+
+// LORAWAN_DELIVERY_NONE means no user message has been enqueued since startup.
+#define LORAWAN_DELIVERY_NONE 0
+// LORAWAN_DELIVERY_PENDING means the user message is waiting for its first transmission or for an acknowledgement.
+#define LORAWAN_DELIVERY_PENDING 1
+// LORAWAN_DELIVERY_DELIVERED means the network has acknowledged the user message.
+#define LORAWAN_DELIVERY_DELIVERED 2
+// LORAWAN_DELIVERY_FAILED means the user message expired or ran out of retransmissions without an acknowledgement.
+#define LORAWAN_DELIVERY_FAILED 3
+
 // lorawan_message_buf_t represents a message received from or to be transmitted on The Things Network.
 typedef struct
 {
@@ -45,19 +111,95 @@ typedef struct
     int port;
 } lorawan_message_buf_t;
 
+// lorawan_queue_entry_t is an uplink message waiting in the transmission queue.
+typedef struct
+{
+    lorawan_message_buf_t message;
+    int priority;
+    unsigned long expiry_millis;
+    int retries_left;
+    // confirmed is true if the message is transmitted as a confirmed uplink and stays in the queue until acknowledged.
+    bool confirmed;
+    // attempts is the number of times the message has been transmitted.
+    int attempts;
+    // not_before_millis holds back the retransmission of an unacknowledged message.
+    unsigned long not_before_millis;
+    // delivery_id identifies the message for delivery tracking.
+    unsigned long delivery_id;
+} lorawan_queue_entry_t;
+
+// lorawan_transmission_t describes the uplink message in flight or last transmitted. Its content is only ever copied from the
+// queue into LMIC's own frame buffer.
+typedef struct
+{
+    size_t len;
+    unsigned long timestamp_millis;
+    int port;
+} lorawan_transmission_t;
+
+// lorawan_delivery_t is the delivery status of a user message.
+typedef struct
+{
+    unsigned long delivery_id;
+    int port;
+    size_t len;
+    int status;
+    int attempts;
+    unsigned long status_millis;
+} lorawan_delivery_t;
+
+// lorawan_callback_stats_t measures the LMIC event callback, which runs in the middle of the LMIC run loop.
+typedef struct
+{
+    unsigned long num_events;
+    // num_dropped is the number of events lost to a full event queue.
+    unsigned long num_dropped;
+    unsigned long last_us, max_us;
+    unsigned long long total_us;
+} lorawan_callback_stats_t;
+
 // lorawan_setup initialises LoRaWAN library and prepares it for transmission/receiving operations.
 void lorawan_setup();
 // lorawan_task_loop transmits the last message set repeatedly at regular interval and receives downlink messages.
 // The function blocks caller indefinitely.
 void lorawan_task_loop(void *);
-// lorawan_set_next_transmission sets the message to be transmitted repeatedly at regular intervals.
-void lorawan_set_next_transmission(uint8_t *buf, size_t len, int port);
+// lorawan_event_task_loop handles the LMIC events recorded by the LMIC callback: it logs them, processes downlink messages,
+// and updates delivery tracking, link adaptation, airtime, and session backup. It runs at a lower priority than the
+// LoRaWAN task loop. The function blocks caller indefinitely.
+void lorawan_event_task_loop(void *);
+// lorawan_enqueue_uplink adds a message to the transmission queue. The message with the highest priority that fits
+// into the current data rate is transmitted first, messages of the same priority are transmitted in order.
+// The message is discarded after ttl_sec, and it is transmitted again for the number of retries after the first transmission.
+// User messages (LORAWAN_PRIORITY_USER_MESSAGE) are transmitted as confirmed uplinks, they are only transmitted again
+// when unacknowledged, with a growing wait in between the attempts.
+// It returns false if the queue is full of messages with a higher priority.
+bool lorawan_enqueue_uplink(const uint8_t *buf, size_t len, int port, int priority, int ttl_sec, int retries);
+// lorawan_begin_uplink claims a slot in the transmission queue for a message built in place, with the same parameters and
+// policy as lorawan_enqueue_uplink. It returns the slot's buffer of LORAWAN_MAX_MESSAGE_LEN bytes, or NULL if the queue is
+// full of messages with a higher priority. Unless NULL is returned, the caller must serialise the message into the buffer
+// promptly and then call either lorawan_commit_uplink or lorawan_abort_uplink, the queue stays locked in the meantime.
+uint8_t *lorawan_begin_uplink(int port, int priority, int ttl_sec, int retries);
+// lorawan_commit_uplink adds the message built in the claimed slot to the transmission queue.
+void lorawan_commit_uplink(size_t len);
+// lorawan_abort_uplink gives up the claimed slot.
+void lorawan_abort_uplink();
+// lorawan_get_queue_len returns the number of messages waiting in the transmission queue.
+size_t lorawan_get_queue_len();
+// lorawan_get_max_payload_len returns the maximum application payload length permitted by the current data rate.
+size_t lorawan_get_max_payload_len();
+// lorawan_get_airtime_budget_ms returns the airtime in milliseconds still permitted for uplinks by the sub-band duty cycle and
+// the fair use policy, whichever is more restrictive.
+int lorawan_get_airtime_budget_ms();
+// lorawan_get_last_delivery returns the delivery status of the latest user message.
+lorawan_delivery_t lorawan_get_last_delivery();
 // lorawan_get_last_reception returns the last received downlink message.
 lorawan_message_buf_t lorawan_get_last_reception();
 void lorawan_prepare_uplink_transmission();
 // lorawan_get_transmission returns the message previously set for transmission.
 // If the transmission has already occurred, the returned value will contain the transmission's timestamp.
-lorawan_message_buf_t lorawan_get_transmission();
+lorawan_transmission_t lorawan_get_transmission();
+// lorawan_get_callback_stats returns the number of LMIC events and the execution time of the LMIC callback since startup.
+lorawan_callback_stats_t lorawan_get_callback_stats();
 
 void lorawan_reset();
 size_t lorawan_get_total_rx_bytes();
@@ -66,4 +208,8 @@ unsigned long lorawan_get_tx_counter();
 void lorawan_transceive();
 void lorawan_debug_to_log();
 void lorawan_reset_tx_stats();
-bool lorawan_is_warming_up();
\ No newline at end of file
+bool lorawan_is_warming_up();
+// lorawan_get_wakeups_last_uplink returns the number of times the task loop woke up to run LMIC for the previous uplink.
+unsigned long lorawan_get_wakeups_last_uplink();
+// lorawan_get_total_wakeups returns the number of times the task loop woke up to run LMIC since startup.
+unsigned long lorawan_get_total_wakeups();
\ No newline at end of file
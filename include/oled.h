@@ -21,11 +21,21 @@
 #define OLED_PAGE_POWER_MGMT 7
 // OLED_PAGE_DIAGNOSIS is the page index number of the diagnosis information page.
 #define OLED_PAGE_DIAGNOSIS 8
+// OLED_PAGE_ENERGY is the page index number of the energy ledger page.
+#define OLED_PAGE_ENERGY 9
 // OLED_PAGE_DIAGNOSIS is the page index number of the morse code table page.
-#define OLED_PAGE_MORSE_TABLE 9
+#define OLED_PAGE_MORSE_TABLE 10
 
 // OLED_TOTAL_PAGE_NUM is the total number of pages.
-#define OLED_TOTAL_PAGE_NUM 10
+#define OLED_TOTAL_PAGE_NUM 11
+
+// OLED_FRAME_WIDTH is the number of pixel columns of the display.
+#define OLED_FRAME_WIDTH 128
+// OLED_FRAME_NUM_PAGES is the number of frame pages of the display, each frame page is a stripe of 8 pixel rows and is
+// stored as one byte per pixel column. They are unrelated to the pages of information.
+#define OLED_FRAME_NUM_PAGES 8
+// OLED_PUSH_CHUNK_LEN is the number of bytes of frame data written to the display in one I2C transmission.
+#define OLED_PUSH_CHUNK_LEN 32
 
 // OLED_SLEEP_AFTER_INACTIVE_MS is the number of seconds after which the screen goes to sleep.
 #define OLED_SLEEP_AFTER_INACTIVE_MS (60 * 1000)
@@ -42,6 +52,8 @@ void oled_on();
 void oled_off();
 bool oled_get_state();
 bool oled_reset_last_input_timestamp();
+// oled_start_asleep keeps the screen off after boot until the user presses the button.
+void oled_start_asleep();
 unsigned int oled_get_ms_since_last_input();
 int oled_get_page_number();
 void oled_go_to_next_page();
@@ -55,6 +67,9 @@ void oled_display_page_env_sensor_info(char lines[OLED_MAX_NUM_LINES][OLED_MAX_L
 void oled_display_page_env_wifi_sniffer_info(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1]);
 void oled_display_page_env_bt_sniffer_info(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1]);
 void oled_display_page_diagnosis(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1]);
+void oled_display_page_energy(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1]);
 void oled_display_going_to_sleep(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1]);
 void oled_display_refresh();
+void oled_push_frame_page(int page, const uint8_t *data);
+void oled_push_frame();
 void oled_task_loop(void *_);
\ No newline at end of file
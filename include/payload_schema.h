@@ -0,0 +1,85 @@
+#pragma once
+
+// The payload schema is the single source of the compact frame layout (see compact_frame.h). The firmware's field
+// indices, schema tables, and key frame encoder are expanded from it at compile time. The schema tables of the TTN payload
+// formatter (ttn_v3_uplink_payload_formatter.js) and of the Go ingest (azure-event-to-blob-store/compact_frame.go) are
+// generated from it, run this after changing a field:
+//   python3 tools/generate_payload_schema.py
+// Decoders in the field only understand the layout of COMPACT_FRAME_VERSION. Append new fields at the end, and bump the
+// version when changing the width or encoding of an existing field.
+//
+// Each field is FIELD(id, name, encoding, bits, delta_bits, resolution, offset):
+// - id is the suffix of the field's index, e.g. LAST_RX_SEC for COMPACT_STATUS_LAST_RX_SEC.
+// - name is the name of the decoded field.
+// - encoding is UNSIGNED, SIGNED, or VARINT (see COMPACT_FIELD_UNSIGNED and so on).
+// - bits, delta_bits, resolution, and offset are described in compact_field_t.
+// The widths are chosen to cover the practical range of each reading, values outside of the range are clamped.
+
+// PAYLOAD_SCHEMA_STATUS lists the fields of a status frame (decoded as frame kind "status") in transmission order.
+#define PAYLOAD_SCHEMA_STATUS(FIELD)                                                        \
+    /* Seconds since the last downlink (0 - 65536). */                                      \
+    FIELD(LAST_RX_SEC, "last_rx_sec", VARINT, 7, 7, 1, 0)                                   \
+    /* Uptime in seconds. */                                                                \
+    FIELD(UPTIME_SEC, "uptime_sec", VARINT, 7, 7, 1, 0)                                     \
+    /* Heap usage in KB. */                                                                 \
+    FIELD(HEAP_USAGE_KB, "heap_usage_kb", VARINT, 4, 3, 1, 0)                               \
+    /* Battery voltage in millivolts (0 - 8191). */                                         \
+    FIELD(BATT_MILLIVOLT, "batt_millivolt", UNSIGNED, 13, 4, 1, 0)                          \
+    /* Power supply current draw in milliamps. */                                           \
+    FIELD(POWER_DRAW_MILLIAMP, "power_milliamp", VARINT, 5, 4, 1, 0)                        \
+    /* Is battery charging (0 - false, 1 - true). */                                        \
+    FIELD(IS_BATT_CHARGING, "is_batt_charging", UNSIGNED, 1, 1, 1, 0)                       \
+    /* Ambient temperature in 0.01 celcius (-81.92 - 81.91). */                             \
+    FIELD(TEMP_CELCIUS, "ambient_temp_celcius", SIGNED, 14, 5, 0.01, 0)                     \
+    /* Ambient humidity in percentage (0 - 127). */                                         \
+    FIELD(HUMIDITY_PCT, "ambient_humidity_pct", UNSIGNED, 7, 3, 1, 0)                       \
+    /* Ambient pressure in 0.1 hpa (0 - 1638.3). */                                         \
+    FIELD(PRESSURE_HPA, "ambient_pressure_hpa", UNSIGNED, 14, 4, 0.1, 0)                    \
+    /* Pressure altitude in metres (-16384 - 16383). */                                     \
+    FIELD(ALTITUDE_METRE, "ambient_altitude_metre", SIGNED, 15, 4, 1, 0)                    \
+    /* CPU core 0's lower-level reset reason. */                                            \
+    FIELD(CPU0_RESET_REASON, "cpu0_reset_reason", UNSIGNED, 5, 2, 1, 0)                     \
+    /* CPU core 1's lower-level reset reason. */                                            \
+    FIELD(CPU1_RESET_REASON, "cpu1_reset_reason", UNSIGNED, 5, 2, 1, 0)                     \
+    /* CPU's wake-up cause. */                                                              \
+    FIELD(WAKEUP_CAUSE, "cpu_wake_up_cause", UNSIGNED, 8, 3, 1, 0)                          \
+    /* ESP's higher-level reset reason. */                                                  \
+    FIELD(ESP_RESET_REASON, "esp_reset_reason", UNSIGNED, 5, 2, 1, 0)
+
+// PAYLOAD_SCHEMA_POS lists the fields of a position frame (decoded as frame kind "position") in transmission order.
+// The MAC addresses are split into halves of 3 bytes each, the first byte is the most significant in the upper half.
+#define PAYLOAD_SCHEMA_POS(FIELD)                                                           \
+    /* Latitude in 0.00001 degrees (roughly 1 metre). */                                    \
+    FIELD(LATITUDE, "latitude", SIGNED, 25, 6, 0.00001, 0)                                  \
+    /* Longitude in 0.00001 degrees. */                                                     \
+    FIELD(LONGITUDE, "longitude", SIGNED, 26, 6, 0.00001, 0)                                \
+    /* Speed in km/h. */                                                                    \
+    FIELD(SPEED_KMH, "gps_speed_kmh", VARINT, 4, 3, 1, 0)                                   \
+    /* Heading in degrees (0 - 511). */                                                     \
+    FIELD(HEADING_DEG, "gps_heading_deg", UNSIGNED, 9, 4, 1, 0)                             \
+    /* GPS altitude in metres (-16384 - 16383). */                                          \
+    FIELD(ALTITUDE_METRE, "altitude", SIGNED, 15, 4, 1, 0)                                  \
+    /* The age of last GPS fix in seconds. */                                               \
+    FIELD(AGE_SEC, "gps_pos_age_sec", VARINT, 4, 4, 1, 0)                                   \
+    /* HDOP in integer (0 - 255). */                                                        \
+    FIELD(HDOP, "hdop", UNSIGNED, 8, 3, 1, 0)                                               \
+    /* Number of GPS satellites in view (0 - 63). */                                        \
+    FIELD(SATELLITES, "sats", UNSIGNED, 6, 2, 1, 0)                                         \
+    /* WiFi monitor - number of inflight packets across all channels. */                    \
+    FIELD(WIFI_NUM_PKTS, "wifi_inflight_pkts_all_chans", VARINT, 5, 5, 1, 0)                \
+    /* WiFi monitor - the loudest sender's channel (0 - 15). */                             \
+    FIELD(WIFI_CHANNEL, "wifi_loudest_tx_chan", UNSIGNED, 4, 3, 1, 0)                       \
+    /* WiFi monitor - the loudest sender's RSSI above the RSSI floor (-120 - 7). */         \
+    FIELD(WIFI_RSSI, "wifi_loudest_tx_rssi", UNSIGNED, 7, 3, 1, -120)                       \
+    /* WiFi monitor - the loudest sender's MAC address, upper and lower halves. */          \
+    FIELD(WIFI_MAC_HI, "wifi_loudest_tx_mac_hi", UNSIGNED, 24, 7, 1, 0)                     \
+    FIELD(WIFI_MAC_LO, "wifi_loudest_tx_mac_lo", UNSIGNED, 24, 7, 1, 0)                     \
+    /* Bluetooth monitor - number of devices in the vicinity. */                            \
+    FIELD(BT_NUM_DEVICES, "bt_num_devices", VARINT, 4, 3, 1, 0)                             \
+    /* Bluetooth monitor - the loudest sender's RSSI above the RSSI floor (-120 - 7). */    \
+    FIELD(BT_RSSI, "bt_loudest_tx_rssi", UNSIGNED, 7, 3, 1, -120)                           \
+    /* Bluetooth monitor - the loudest sender's MAC address, upper and lower halves. */     \
+    FIELD(BT_MAC_HI, "bt_loudest_tx_mac_hi", UNSIGNED, 24, 7, 1, 0)                         \
+    FIELD(BT_MAC_LO, "bt_loudest_tx_mac_lo", UNSIGNED, 24, 7, 1, 0)                         \
+    /* WiFi monitor - the size of all inflight packets across all channels in KB. */        \
+    FIELD(WIFI_DATA_KB, "wifi_inflight_pkt_data_len_all_chans", VARINT, 5, 5, 1, 0)
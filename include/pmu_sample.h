@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+// The PMU sample reads the status and ADC registers of the AXP192 or AXP2101 chip in a few burst transactions, instead of
+// one transaction (or two) per reading as the XPowersLib getters do, and decodes all readings from the register dump in
+// one pass. The decoding follows the conversion of the XPowersLib getters, a reading of an absent power source is 0.
+
+// PMU_SAMPLE_I2C_ADDR is the I2C address of both AXP192 and AXP2101.
+#define PMU_SAMPLE_I2C_ADDR 0x34
+
+// PMU_SAMPLE_STATUS_REG is the first of the two status registers, the power input status and the charging status.
+#define PMU_SAMPLE_STATUS_REG 0x00
+// PMU_SAMPLE_STATUS_LEN is the number of status registers read in a burst.
+#define PMU_SAMPLE_STATUS_LEN 2
+
+// PMU_SAMPLE_AXP192_ADC_REG is the first register of the AXP192 ADC block, from the VBUS voltage to the battery discharge
+// current.
+#define PMU_SAMPLE_AXP192_ADC_REG 0x5A
+// PMU_SAMPLE_AXP192_ADC_LEN is the number of AXP192 ADC registers read in a burst.
+#define PMU_SAMPLE_AXP192_ADC_LEN 36
+// PMU_SAMPLE_AXP192_COULOMB_REG is the first register of the AXP192 battery charge and discharge coulomb counters.
+#define PMU_SAMPLE_AXP192_COULOMB_REG 0xB0
+// PMU_SAMPLE_AXP192_COULOMB_LEN is the number of AXP192 coulomb counter registers read in a burst.
+#define PMU_SAMPLE_AXP192_COULOMB_LEN 8
+
+// PMU_SAMPLE_AXP2101_ADC_REG is the first register of the AXP2101 ADC block, from the battery voltage to the VBUS voltage.
+// AXP2101 does not have coulomb counters.
+#define PMU_SAMPLE_AXP2101_ADC_REG 0x34
+// PMU_SAMPLE_AXP2101_ADC_LEN is the number of AXP2101 ADC registers read in a burst.
+#define PMU_SAMPLE_AXP2101_ADC_LEN 6
+
+// pmu_sample_t is the readings decoded from a register dump.
+typedef struct
+{
+    bool is_charging, is_batt_connected, is_vbus_present;
+    int batt_millivolt, vbus_millivolt;
+    // The currents and coulomb counters are only available on AXP192.
+    bool has_current;
+    float batt_charge_milliamp, batt_discharge_milliamp, vbus_milliamp;
+    bool has_coulomb;
+    uint32_t coulomb_charge, coulomb_discharge;
+} pmu_sample_t;
+
+// pmu_sample_read reads the registers of the chip selected by the AXP192 or AXP2101 build flag in burst transactions and
+// decodes them. The caller must hold the I2C bus. It returns false if a transaction failed, the sample is left untouched.
+bool pmu_sample_read(pmu_sample_t *sample);
+// pmu_sample_decode_axp192 decodes the readings from the AXP192 dumps of the status, ADC, and coulomb counter registers.
+void pmu_sample_decode_axp192(const uint8_t *status_regs, const uint8_t *adc_regs, const uint8_t *coulomb_regs, pmu_sample_t *sample);
+// pmu_sample_decode_axp2101 decodes the readings from the AXP2101 dumps of the status and ADC registers.
+void pmu_sample_decode_axp2101(const uint8_t *status_regs, const uint8_t *adc_regs, pmu_sample_t *sample);
@@ -30,6 +30,22 @@
 #define POWER_DEFAULT_CPU_FREQ_MHZ 80
 // POWER_LOWEST_CPU_FREQ_MHZ is the lowest CPU speed required to keep the program running, though insufficient for radio activities.
 #define POWER_LOWEST_CPU_FREQ_MHZ 10
+// POWER_DEEP_SLEEP_DRAW_MILLIAMP is the estimated power draw during deep sleep, which is booked to the energy ledger when
+// the coulomb counter cannot tell. The PMU, the voltage regulators, and the GPS backup battery keep drawing a few mA.
+#define POWER_DEEP_SLEEP_DRAW_MILLIAMP 3.0
+// POWER_PM_LIGHT_SLEEP_ENABLE lets the idle task put the chip into light sleep when no task holds a power management lock.
+// It takes effect only if the framework is built with tickless idle (CONFIG_FREERTOS_USE_TICKLESS_IDLE), which the
+// prebuilt Arduino framework of platformio.ini is not. The firmware as built only scales the CPU frequency, light sleep
+// needs the arduino and espidf frameworks combined with an sdkconfig that enables tickless idle.
+#define POWER_PM_LIGHT_SLEEP_ENABLE 1
+// POWER_PM_LOCK_RADIO is the power management lock held by LoRaWAN from the start of a transmission until its receive windows close.
+#define POWER_PM_LOCK_RADIO 0
+// POWER_PM_LOCK_GPS_UART is the power management lock held while the GPS task receives NMEA sentences.
+#define POWER_PM_LOCK_GPS_UART 1
+// POWER_PM_LOCK_I2C is the power management lock held along with the I2C bus lock.
+#define POWER_PM_LOCK_I2C 2
+// POWER_PM_NUM_LOCKS is the number of power management locks.
+#define POWER_PM_NUM_LOCKS 3
 
 // POWER_TODO_LORAWAN_TX_RX bit field tells the caller of power_get_todo to proceed with LoRa RX and TX.
 #define POWER_TODO_LORAWAN_TX_RX (1 << 1)
@@ -45,6 +61,11 @@
 #define POWER_TODO_TURN_ON_GPS (1 << 6)
 // POWER_TODO_ENTER_DEEP_SLEEP bit field tells the caller of power_get_todo to enter deep sleep for the duration configured in power config.
 #define POWER_TODO_ENTER_DEEP_SLEEP (1 << 7)
+// POWER_TODO_ALL is the union of all TODO bit fields.
+#define POWER_TODO_ALL (POWER_TODO_LORAWAN_TX_RX | POWER_TODO_REDUCE_CPU_FREQ | POWER_TODO_TURN_ON_BLUETOOTH | POWER_TODO_TURN_ON_WIFI | \
+                        POWER_TODO_READ_ENV_SENSOR | POWER_TODO_TURN_ON_GPS | POWER_TODO_ENTER_DEEP_SLEEP)
+// POWER_TODO_WAIT_TIMEOUT_MS is the longest a task loop blocks waiting for its TODO bit, it must be well within the watchdog timeout.
+#define POWER_TODO_WAIT_TIMEOUT_MS 10000
 
 // POWER_SLOWEST_TX_INTERVAL_SEC is the slowest LoRaWAN transmission interval used in a power mode.
 #define POWER_SLOWEST_TX_INTERVAL_SEC 90
@@ -70,6 +91,7 @@ struct power_status
 const static int POWER_BOOST = 19909;
 const static int POWER_REGULAR = 19905;
 const static int POWER_SAVER = 19901;
+const static int POWER_ADAPTIVE = 19903;
 
 typedef struct
 {
@@ -79,6 +101,8 @@ typedef struct
     int tx_interval_sec;
     int deep_sleep_start_sec;
     int deep_sleep_duration_sec;
+    // wifi_bt_scan is true if WiFi and Bluetooth take turns at scanning prior to transmitting foxhunt info.
+    bool wifi_bt_scan;
     String mode_name;
 } power_config_t;
 
@@ -95,6 +119,7 @@ const static power_config_t power_config_boost = {
     .tx_interval_sec = 20,
     .deep_sleep_start_sec = 0,
     .deep_sleep_duration_sec = 0,
+    .wifi_bt_scan = true,
     .mode_name = "boost"};
 const static power_config_t power_config_regular = {
     .mode_id = POWER_REGULAR,
@@ -103,6 +128,7 @@ const static power_config_t power_config_regular = {
     .tx_interval_sec = 60,
     .deep_sleep_start_sec = 0,
     .deep_sleep_duration_sec = 0,
+    .wifi_bt_scan = true,
     .mode_name = "regular"};
 const static power_config_t power_config_saver = {
     .mode_id = POWER_SAVER,
@@ -112,13 +138,37 @@ const static power_config_t power_config_saver = {
     .deep_sleep_start_sec = POWER_SAVER_WAKE_DURATION_SEC,
     // Enter deep sleep for 2/3rds of that duration.
     .deep_sleep_duration_sec = POWER_SAVER_WAKE_DURATION_SEC * 2 / 3,
+    .wifi_bt_scan = true,
     .mode_name = "saver"};
 
-power_config_t power_get_config();
+// The adaptive mode runs on battery until a target runtime. It moves down the levels, each consuming less power than the
+// one before it, while the projected runtime falls short of the time left until the target, and moves back up while the
+// projected runtime exceeds the time left by a margin. The adaptive mode replaces the power mode in use when the device
+// starts running on battery, unless it is the saver mode.
+
+// POWER_ADAPTIVE_NUM_LEVELS is the number of levels of the adaptive mode.
+#define POWER_ADAPTIVE_NUM_LEVELS 6
+// POWER_ADAPTIVE_NUM_TARGETS is the number of target runtimes the user may choose from.
+#define POWER_ADAPTIVE_NUM_TARGETS 3
+// POWER_ADAPTIVE_DEFAULT_TARGET_HOURS is the target runtime when the adaptive mode takes over upon running on battery.
+#define POWER_ADAPTIVE_DEFAULT_TARGET_HOURS (3 * 24)
+// POWER_ADAPTIVE_MIN_LEVEL_DURATION_SEC is the minimum duration at a level, which lets the average draw settle.
+#define POWER_ADAPTIVE_MIN_LEVEL_DURATION_SEC (15 * 60)
+// POWER_ADAPTIVE_STEP_UP_MARGIN is how much longer than the time left the projected runtime must be to move up a level.
+#define POWER_ADAPTIVE_STEP_UP_MARGIN 1.25
+
+const static int power_adaptive_target_hours[POWER_ADAPTIVE_NUM_TARGETS] = {24, 3 * 24, 7 * 24};
+const static power_config_t power_config_adaptive_levels[POWER_ADAPTIVE_NUM_LEVELS] = {
+    {.mode_id = POWER_ADAPTIVE, .power_dbm = 18, .spreading_factor = DR_SF8, .tx_interval_sec = 60, .deep_sleep_start_sec = 0, .deep_sleep_duration_sec = 0, .wifi_bt_scan = true, .mode_name = "adaptive"},
+    {.mode_id = POWER_ADAPTIVE, .power_dbm = 18, .spreading_factor = DR_SF7, .tx_interval_sec = 75, .deep_sleep_start_sec = 0, .deep_sleep_duration_sec = 0, .wifi_bt_scan = true, .mode_name = "adaptive"},
+    {.mode_id = POWER_ADAPTIVE, .power_dbm = 14, .spreading_factor = DR_SF7, .tx_interval_sec = POWER_SLOWEST_TX_INTERVAL_SEC, .deep_sleep_start_sec = 0, .deep_sleep_duration_sec = 0, .wifi_bt_scan = true, .mode_name = "adaptive"},
+    {.mode_id = POWER_ADAPTIVE, .power_dbm = 14, .spreading_factor = DR_SF7, .tx_interval_sec = POWER_SLOWEST_TX_INTERVAL_SEC, .deep_sleep_start_sec = 0, .deep_sleep_duration_sec = 0, .wifi_bt_scan = false, .mode_name = "adaptive"},
+    {.mode_id = POWER_ADAPTIVE, .power_dbm = 14, .spreading_factor = DR_SF7, .tx_interval_sec = POWER_SLOWEST_TX_INTERVAL_SEC, .deep_sleep_start_sec = POWER_SAVER_WAKE_DURATION_SEC, .deep_sleep_duration_sec = POWER_SAVER_WAKE_DURATION_SEC * 2 / 3, .wifi_bt_scan = false, .mode_name = "adaptive"},
+    {.mode_id = POWER_ADAPTIVE, .power_dbm = 14, .spreading_factor = DR_SF7, .tx_interval_sec = POWER_SLOWEST_TX_INTERVAL_SEC, .deep_sleep_start_sec = POWER_SAVER_WAKE_DURATION_SEC, .deep_sleep_duration_sec = POWER_SAVER_WAKE_DURATION_SEC * 2, .wifi_bt_scan = false, .mode_name = "adaptive"}};
+
+const power_config_t &power_get_config();
 
 void power_setup();
-void power_i2c_lock();
-void power_i2c_unlock();
 void power_wifi_bt_lock();
 void power_wifi_bt_unlock();
 void power_led_on();
@@ -126,18 +176,32 @@ void power_led_off();
 void power_start_conserving();
 void power_stop_conserving();
 void power_set_cpu_freq_mhz(int);
+// power_pm_lock keeps the APB clock at full speed and the chip out of light sleep until the lock is released.
+// The locks are counting, each lock must be released as many times as it is taken.
+void power_pm_lock(int lock_id);
+void power_pm_unlock(int lock_id);
 int power_get_uptime_sec();
 double power_get_sum_curr_draw_readings();
 void power_inc_lorawan_tx_counter();
 int power_get_lorawan_tx_counter();
 unsigned long power_get_last_transmission_timestamp();
 void power_set_last_transmission_timestamp();
+// power_restore_lorawan_tx_schedule continues the transmission schedule saved before a restart.
+// The next uplink goes out as soon as the interval since the last uplink has elapsed, which may be immediately.
+void power_restore_lorawan_tx_schedule(int tx_counter, uint32_t sec_since_last_tx);
 bool power_get_may_transmit_lorawan();
+// power_get_todo returns the TODO bits published by the power task loop during its latest tick.
 int power_get_todo();
+// power_wait_todo blocks the caller until any of the TODO bits is published, or until the timeout elapses.
+// It returns the TODO bits published at the time.
+int power_wait_todo(int bits, int timeout_ms);
 void power_enter_deep_sleep();
 struct power_status power_get_status();
 void power_set_config(int);
-power_config_t power_get_config();
+// power_set_adaptive_target_hours switches to the adaptive mode, which aims to run on battery for the hours from now on.
+void power_set_adaptive_target_hours(int hours);
+int power_get_adaptive_target_hours();
+int power_get_adaptive_level();
 void power_read_status();
 void power_log_status();
 void power_task_loop(void *);
@@ -0,0 +1,42 @@
+#pragma once
+
+// The preparation windows tell the power task how long before a transmission to turn a peripheral on, so that its
+// readings are ready just in time. The power task begins a measurement when it sets the TODO bit of the peripheral, and
+// the peripheral ends it once its result is valid. The window is an exponentially weighted moving average of the measured
+// durations plus a multiple of their mean deviation, which guards against the occasional slow start. A window that closes
+// before the result arrives was too short, the estimate grows. The estimates are kept in RTC memory across deep sleep.
+
+// PREP_WINDOW_BLUETOOTH is the window from turning on Bluetooth until PREP_WINDOW_SCAN_ROUNDS rounds of scan are done.
+#define PREP_WINDOW_BLUETOOTH 0
+// PREP_WINDOW_WIFI is the window from turning on WiFi until PREP_WINDOW_SCAN_ROUNDS rounds of channel sweep are done.
+#define PREP_WINDOW_WIFI 1
+// PREP_WINDOW_ENV_SENSOR is the window from asking for an environment sensor reading until it is taken.
+#define PREP_WINDOW_ENV_SENSOR 2
+// PREP_WINDOW_BT_WIFI_GAP is the gap from turning off Bluetooth until it has freed up the memory for WiFi.
+#define PREP_WINDOW_BT_WIFI_GAP 3
+// PREP_WINDOW_NUM_WINDOWS is the number of windows.
+#define PREP_WINDOW_NUM_WINDOWS 4
+
+// PREP_WINDOW_SCAN_ROUNDS is the number of rounds a scanner takes until its result is valid, the first round is often unreliable.
+#define PREP_WINDOW_SCAN_ROUNDS 2
+// PREP_WINDOW_MIN_SAMPLES is the number of measurements taken before the estimate replaces the worst case window.
+#define PREP_WINDOW_MIN_SAMPLES 4
+// PREP_WINDOW_MEAN_GAIN is the weight of a new measurement in the average.
+#define PREP_WINDOW_MEAN_GAIN 0.125
+// PREP_WINDOW_DEVIATION_GAIN is the weight of a new measurement in the mean deviation.
+#define PREP_WINDOW_DEVIATION_GAIN 0.25
+// PREP_WINDOW_DEVIATIONS is the number of mean deviations added to the average.
+#define PREP_WINDOW_DEVIATIONS 4
+// PREP_WINDOW_TOO_SHORT_GROWTH is the factor of the window duration the average grows to when the window closed before the
+// result arrived.
+#define PREP_WINDOW_TOO_SHORT_GROWTH 1.25
+
+// prep_window_begin starts measuring the window, unless a measurement is already in progress.
+void prep_window_begin(int window);
+// prep_window_end finishes the measurement in progress, if any, and adds it to the estimate.
+void prep_window_end(int window);
+// prep_window_close tells that the window has closed. If the measurement is still in progress the window was too short.
+void prep_window_close(int window);
+// prep_window_get_ms returns the estimated window plus the scheduling margin, capped to the worst case window.
+// The worst case is used until there are enough measurements.
+int prep_window_get_ms(int window, int worst_case_ms, int margin_ms);
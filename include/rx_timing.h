@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The RX timing instrument tells whether downlinks are lost over the air or because the receive windows opened late.
+// The radio raises a DIO interrupt at the end of each transmission (TX done on DIO0) and at the end of each receive window
+// (RX done on DIO0 when a preamble was detected and a frame followed, RX timeout on DIO1 otherwise). The interrupts are
+// timestamped as they arrive, along with the window LMIC scheduled. All instants are relative to the nominal opening of
+// the window according to LoRaWAN, i.e. RX1 delay (RX2 one second later) after the end of transmission:
+// - Scheduled open - when LMIC meant to open the window, it opens early by the clock error allowance.
+// - Actual open - when the radio started listening, that is when the window timed out minus the window duration.
+// - Downlink arrival - when the downlink began, that is when the frame was received minus the frame's time-on-air.
+//   It reflects the clock drift between the gateway and this transmitter.
+//
+// The measurements are aggregated into histograms that are logged and transmitted on LORAWAN_PORT_RX_TIMING:
+// - Bit 0, 1 - format version, currently RX_TIMING_REPORT_VERSION.
+// - 7 bits - the clock error allowance in percent given to LMIC.
+// - Varints (7 bits per group) - the number of uplinks, receive windows, preambles detected, uplinks expecting a
+//   response (confirmed uplinks and link checks), missed responses, and windows opened after the nominal instant.
+// - 3 histograms of RX_TIMING_NUM_BUCKETS varints (4 bits per group) - the number of windows whose actual open was
+//   later than scheduled by, the number of windows whose actual open was off the nominal instant by, and the number
+//   of downlinks whose arrival was off the nominal instant by the bucket's range.
+// The values are written by DataPacket, least significant bit first. The counters start over after each report.
+
+// RX_TIMING_REPORT_VERSION is the format version written into the header of each report.
+#define RX_TIMING_REPORT_VERSION 1
+// RX_TIMING_NUM_BUCKETS is the number of buckets of each histogram. The bucket boundaries in microseconds are
+// -64000, -32000, -16000, -8000, -4000, -2000, -1000, 0, 1000, 2000, 4000, 8000, 16000, 32000, 64000. A value
+// belongs to the first bucket whose upper boundary exceeds it, or to the last bucket.
+#define RX_TIMING_NUM_BUCKETS 16
+// RX_TIMING_MAX_DIO_EVENTS is the maximum number of DIO interrupts recorded during an uplink: TX done, RX1, and RX2.
+#define RX_TIMING_MAX_DIO_EVENTS 3
+// RX_TIMING_REPORT_INTERVAL_SEC is the minimum interval in between two reports.
+#define RX_TIMING_REPORT_INTERVAL_SEC 3600
+// RX_TIMING_REPORT_MIN_UPLINKS is the number of uplinks measured before a report is worth transmitting.
+#define RX_TIMING_REPORT_MIN_UPLINKS 20
+
+// rx_timing_record_dio timestamps a DIO interrupt, it is called by the interrupt service routine of DIO0 and DIO1.
+void rx_timing_record_dio(int dio);
+// rx_timing_begin_uplink starts measuring the receive windows of the uplink that is about to be transmitted.
+void rx_timing_begin_uplink();
+// rx_timing_end_uplink aggregates the measurements of the transmitted uplink once LMIC has closed its receive windows.
+// downlink_phy_len is the size of the entire downlink frame (MAC header, frame header, port, payload, and MIC), 0 if there was none.
+void rx_timing_end_uplink(bool expect_response, size_t downlink_phy_len);
+// rx_timing_is_report_due returns true if enough uplinks have been measured since the previous report.
+bool rx_timing_is_report_due();
+// rx_timing_encode_report encodes a report into the buffer, logs it, and returns its size. The counters and histograms
+// start over afterwards. It returns 0 if the report does not fit into max_len bytes.
+size_t rx_timing_encode_report(uint8_t *buf, size_t max_len, int clock_error_pct);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "compact_frame.h"
+
+// The send-on-delta policy suppresses a routine status or position uplink when none of its fields has changed
+// significantly since the frame of the same kind was last sent. Each field has its own rule and threshold, e.g. 0.2°C of
+// temperature or 25 metres of position. A frame is sent regardless once the kind has been silent for SEND_ON_DELTA_HEARTBEAT_SEC.
+// When a routine uplink is suppressed, a one-byte keepalive on LORAWAN_PORT_KEEPALIVE still gives the network an
+// opportunity to send a downlink message every SEND_ON_DELTA_KEEPALIVE_SEC. The byte is the number of frames suppressed
+// since the previous keepalive (0 - 255).
+
+// SEND_ON_DELTA_HEARTBEAT_SEC is the maximum duration a frame kind goes without being sent.
+#define SEND_ON_DELTA_HEARTBEAT_SEC (15 * 60)
+// SEND_ON_DELTA_KEEPALIVE_SEC is the maximum duration without any uplink, after which a keepalive is sent in place of a
+// suppressed frame.
+#define SEND_ON_DELTA_KEEPALIVE_SEC (4 * 60)
+
+// SEND_ON_DELTA_IGNORE is the rule of a field that never makes a frame significant, e.g. uptime or cumulative counters.
+#define SEND_ON_DELTA_IGNORE 0
+// SEND_ON_DELTA_ABSOLUTE is the rule of a field that is significant when it differs by at least the threshold.
+#define SEND_ON_DELTA_ABSOLUTE 1
+// SEND_ON_DELTA_ANY_CHANGE is the rule of an enumeration or identifier field that is significant whenever it differs.
+#define SEND_ON_DELTA_ANY_CHANGE 2
+// SEND_ON_DELTA_DISTANCE is the rule of a latitude field followed by its longitude field, which are significant when the
+// position has moved by at least the threshold in metres.
+#define SEND_ON_DELTA_DISTANCE 3
+
+// send_on_delta_rule_t tells when a field makes a frame significant.
+typedef struct
+{
+    uint8_t rule;
+    double threshold;
+} send_on_delta_rule_t;
+
+// send_on_delta_check returns true if the frame should be sent, otherwise the frame counts as suppressed.
+// The values are in the order of the frame kind's compact frame schema.
+bool send_on_delta_check(int kind, const double *values);
+// send_on_delta_commit remembers the field values of a frame as the latest sent. Call it once the frame has made it
+// into the transmission queue, a frame that failed to be encoded or queued does not count as sent.
+void send_on_delta_commit(int kind, const double *values);
+// send_on_delta_take_num_suppressed returns the number of frames suppressed since the previous call.
+int send_on_delta_take_num_suppressed();
+// send_on_delta_get_total_suppressed returns the total number of frames suppressed since startup.
+unsigned long send_on_delta_get_total_suppressed();
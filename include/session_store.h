@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+// The session store keeps the LoRaWAN session state that must survive a restart: the frame counters (the network rejects
+// an uplink with a frame counter it has already seen as a replay), the channel mask, and the transmission schedule.
+// A checkpoint is written to RTC memory after each uplink, which survives deep sleep and soft resets. A backup copy is
+// written to NVS (flash) every SESSION_STORE_NVS_INTERVAL uplinks for surviving a power loss.
+
+// SESSION_STORE_MAGIC identifies a valid checkpoint in RTC memory.
+#define SESSION_STORE_MAGIC 0x4C4D4943
+// SESSION_STORE_NVS_NAMESPACE is the NVS namespace of the backup copy.
+#define SESSION_STORE_NVS_NAMESPACE "lorawan"
+// SESSION_STORE_NVS_KEY is the NVS key of the backup copy.
+#define SESSION_STORE_NVS_KEY "session"
+// SESSION_STORE_NVS_INTERVAL is the number of uplinks between two writes of the backup copy.
+// The flash endures ~100k erase cycles per sector, the interval keeps the wear to an uplink-a-minute device below 1 write per half an hour.
+// The uplink frame counter restored from the backup copy skips ahead by the interval, and the skipped-ahead counter is
+// written back to NVS before transmitting, so that it is never reused even if the power is lost again.
+#define SESSION_STORE_NVS_INTERVAL 32
+
+// session_checkpoint_t is the session state saved in RTC memory and NVS.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t devaddr;
+    uint32_t seqno_up, seqno_dn;
+    uint16_t channel_map;
+    int tx_counter;
+    // last_tx_time_sec is the RTC time of the last uplink, the RTC keeps running during deep sleep and across soft resets.
+    uint32_t last_tx_time_sec;
+    uint32_t checksum;
+} session_checkpoint_t;
+
+// session_store_checkpoint saves the session state after an uplink. It is called with the LoRaWAN mutex held.
+void session_store_checkpoint();
+// session_store_restore restores the session state of the device address into LMIC and the transmission schedule.
+// It returns true if a checkpoint was found in either RTC memory or NVS.
+bool session_store_restore(uint32_t devaddr);
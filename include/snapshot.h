@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <type_traits>
+
+// Snapshot publishes the latest copy of a record written by one task and read by any number of other tasks.
+// The writer alternates between two copies of the record, and a sequence counter tells the readers which copy is
+// complete: the counter is odd while the writer is busy, and it advances by two with each copy published.
+// Neither the writer nor the readers ever block. A reader only retries when the writer has published twice while the
+// reader was copying, which takes the writer much longer than it takes the reader to copy a record.
+// There must be only one writer of each Snapshot, the readers may run on either CPU core.
+template <typename T>
+class Snapshot
+{
+    static_assert(std::is_trivially_copyable<T>::value, "Snapshot copies the record byte by byte");
+
+public:
+    // publish makes a copy of the record visible to the readers.
+    void publish(const T &record)
+    {
+        uint32_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        // Write into the copy that the readers are not reading.
+        memcpy(&copies[((seq >> 1) + 1) & 1], &record, sizeof(T));
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    // read returns the copy of the record most recently published, or a zeroed record if none was published yet.
+    T read() const
+    {
+        T ret;
+        while (true)
+        {
+            uint32_t seq = sequence.load(std::memory_order_acquire);
+            memcpy(&ret, &copies[(seq >> 1) & 1], sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            // The copy just read is overwritten by the second publication starting after seq was loaded. An odd seq
+            // means the first of them had already started.
+            if (sequence.load(std::memory_order_relaxed) - (seq & ~(uint32_t)1) <= 2)
+            {
+                return ret;
+            }
+        }
+    }
+
+private:
+    std::atomic<uint32_t> sequence{0};
+    T copies[2] = {};
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <type_traits>
+
+// SpscQueue passes records from one producer to one consumer without locking, in the order they were pushed.
+// The producer only ever writes tail and the consumer only ever writes head, hence neither of them ever waits for the other.
+// Each side may be taken by several tasks as long as they take turns, e.g. by holding the same mutex.
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SpscQueue copies the records");
+    static_assert(N > 0, "SpscQueue needs room for at least one record");
+
+public:
+    // push copies the record to the end of the queue. It returns false if the queue is full, and the record is discarded.
+    bool push(const T &record)
+    {
+        uint32_t tail_pos = tail.load(std::memory_order_relaxed);
+        if (tail_pos - head.load(std::memory_order_acquire) >= N)
+        {
+            return false;
+        }
+        records[tail_pos % N] = record;
+        tail.store(tail_pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // pop moves the oldest record out of the queue. It returns false if the queue is empty.
+    bool pop(T *record)
+    {
+        uint32_t head_pos = head.load(std::memory_order_relaxed);
+        if (head_pos == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        *record = records[head_pos % N];
+        head.store(head_pos + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::atomic<uint32_t> head{0}, tail{0};
+    T records[N];
+};
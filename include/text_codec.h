@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// The text codec compresses the messages typed in morse with a static canonical Huffman code over 64 symbols:
+// - Symbol 0 - end of message, the bits after it are padding.
+// - Symbol 1 - toggle between lower case and upper case for the letters that follow. Messages start in lower case.
+// - Symbol 2 - space.
+// - Symbol 3 - 28 - letters a - z.
+// - Symbol 29 - 38 - digits 0 - 9.
+// - Symbol 39 - 56 - punctuation . , ? ' ! / ( ) & : ; = + - _ " $ @
+// - Symbol 57 - 63 - frequent English fragments "the ", "and ", "ing", "you", "to ", "of ", "er" (lower case only).
+// The code lengths are tuned for the letter frequency of short English messages, a message takes ~4.5 bits per character.
+// The code of each symbol is written most significant bit first, one bit at a time, by DataPacket.
+// The symbol table and code lengths must be kept in sync with the TTN payload formatter (decode_compact_text), which hands
+// the decoded text over to the Go ingest.
+
+// TEXT_CODEC_NUM_SYMBOLS is the number of symbols in the code.
+#define TEXT_CODEC_NUM_SYMBOLS 64
+// TEXT_CODEC_MAX_CODE_LEN is the length of the longest code.
+#define TEXT_CODEC_MAX_CODE_LEN 11
+// TEXT_CODEC_SYMBOL_END marks the end of a message.
+#define TEXT_CODEC_SYMBOL_END 0
+// TEXT_CODEC_SYMBOL_TOGGLE_CASE toggles the case of the letters that follow.
+#define TEXT_CODEC_SYMBOL_TOGGLE_CASE 1
+
+// text_codec_encode compresses the text into buf and returns the number of bytes written.
+// It returns 0 if the text has a character outside of the symbol table or buf is too small.
+size_t text_codec_encode(const char *text, uint8_t *buf, size_t buf_len);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// The ULP wake program keeps the device responsive during deep sleep. The main cores are woken by the timer, and the
+// ULP coprocessor polls the user button (GENERIC_PURPOSE_BUTTON) and the PMU IRQ line (POWER_PMU_IRQ) in the meantime.
+// Both lines are active low. A line wakes the main cores once it has been seen high and then low for
+// ULP_WAKE_DEBOUNCE_SAMPLES consecutive samples, a bounce or a line stuck low (e.g. an uncleared IRQ) wakes nothing.
+// The ULP program writes the line that woke the main cores into RTC slow memory, the reason is read once at boot.
+// If the framework is built without the ULP coprocessor, the button alone wakes the main cores through EXT0.
+
+// ULP_WAKE_SAMPLE_INTERVAL_MS is the interval of the ULP timer in between two samples of the lines.
+#define ULP_WAKE_SAMPLE_INTERVAL_MS 20
+// ULP_WAKE_DEBOUNCE_SAMPLES is the number of consecutive low samples that make a real press.
+#define ULP_WAKE_DEBOUNCE_SAMPLES 3
+// ULP_WAKE_PROGRAM_OFFSET is the word offset of the program in RTC slow memory, the variables of the program come first.
+#define ULP_WAKE_PROGRAM_OFFSET 8
+
+// ULP_WAKE_REASON_POWER_ON is the reason of a boot that did not come out of deep sleep.
+#define ULP_WAKE_REASON_POWER_ON 0
+// ULP_WAKE_REASON_TIMER is the reason of a wake up by the deep sleep timer.
+#define ULP_WAKE_REASON_TIMER 1
+// ULP_WAKE_REASON_BUTTON is the reason of a wake up by a press of the user button.
+#define ULP_WAKE_REASON_BUTTON 2
+// ULP_WAKE_REASON_PMU_IRQ is the reason of a wake up by the PMU, e.g. USB power plugged in or the power key pressed.
+#define ULP_WAKE_REASON_PMU_IRQ 3
+// ULP_WAKE_REASON_OTHER is the reason of a wake up by any other source.
+#define ULP_WAKE_REASON_OTHER 4
+// ULP_WAKE_NUM_REASONS is the number of wake up reasons.
+#define ULP_WAKE_NUM_REASONS 5
+
+// ulp_wake_setup reads why the main cores woke up and stops the ULP program. It must be called at the beginning of setup.
+void ulp_wake_setup();
+// ulp_wake_arm starts the ULP program and enables the wake up sources. It must be called right before entering deep sleep.
+void ulp_wake_arm();
+// ulp_wake_get_reason returns the ULP_WAKE_REASON_* of the latest boot.
+int ulp_wake_get_reason();
+// ulp_wake_is_fast_boot returns true if the timer woke the main cores up. Nothing has changed since entering deep sleep,
+// and nobody is looking at the screen, hence the boot may skip everything the next scheduled uplink does not need.
+bool ulp_wake_is_fast_boot();
+// ulp_wake_get_reason_name returns the short name of the wake up reason for display.
+const char *ulp_wake_get_reason_name(int reason);
+// ulp_wake_get_count returns the number of wake ups for the reason, counted across deep sleep.
+unsigned long ulp_wake_get_count(int reason);
@@ -0,0 +1,212 @@
+#include <Arduino.h>
+#include <math.h>
+#include <time.h>
+#include "airtime.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// airtime_sub_band_t is an EU868 sub-band with a duty cycle limit.
+typedef struct
+{
+    uint32_t min_freq_hz, max_freq_hz;
+    // duty_cycle_permille is the maximum fraction of the observation period spent transmitting, in 0.1%.
+    int duty_cycle_permille;
+} airtime_sub_band_t;
+
+// The sub-bands of ETSI EN 300 220 used by LoRaWAN EU863-870.
+static const airtime_sub_band_t sub_bands[AIRTIME_NUM_SUB_BANDS] = {
+    {.min_freq_hz = 863000000, .max_freq_hz = 865000000, .duty_cycle_permille = 1},
+    // Channels 3 - 7 (867.1 - 867.9MHz) of The Things Network.
+    {.min_freq_hz = 865000000, .max_freq_hz = 868000000, .duty_cycle_permille = 10},
+    // Channels 0 - 2 (868.1 - 868.5MHz) of The Things Network.
+    {.min_freq_hz = 868000000, .max_freq_hz = 868600000, .duty_cycle_permille = 10},
+    {.min_freq_hz = 868700000, .max_freq_hz = 869200000, .duty_cycle_permille = 1},
+    // RX2 of The Things Network.
+    {.min_freq_hz = 869400000, .max_freq_hz = 869650000, .duty_cycle_permille = 100},
+    {.min_freq_hz = 869700000, .max_freq_hz = 870000000, .duty_cycle_permille = 10},
+};
+
+// airtime_bucket_t sums up the airtime spent during a slot of time.
+typedef struct
+{
+    uint32_t slot;
+    uint32_t airtime_ms;
+} airtime_bucket_t;
+
+#define AIRTIME_DUTY_CYCLE_NUM_BUCKETS (AIRTIME_DUTY_CYCLE_WINDOW_SEC / AIRTIME_DUTY_CYCLE_BUCKET_SEC)
+#define AIRTIME_FAIR_USE_NUM_BUCKETS (AIRTIME_FAIR_USE_WINDOW_SEC / AIRTIME_FAIR_USE_BUCKET_SEC)
+
+static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+// The buckets are retained across soft resets and deep sleep, the RTC keeps the time running in the meantime.
+RTC_DATA_ATTR static airtime_bucket_t duty_cycle_buckets[AIRTIME_NUM_SUB_BANDS][AIRTIME_DUTY_CYCLE_NUM_BUCKETS];
+RTC_DATA_ATTR static airtime_bucket_t fair_use_buckets[AIRTIME_FAIR_USE_NUM_BUCKETS];
+static unsigned long total_airtime_ms = 0;
+
+// airtime_get_modulation determines the spreading factor and bandwidth of the data rate.
+void airtime_get_modulation(int datarate, int *sf, int *bw_khz)
+{
+    // EU868 DR0 - DR5 are SF12 - SF7 with 125kHz bandwidth, DR6 is SF7 with 250kHz bandwidth.
+    *sf = 7;
+    *bw_khz = 125;
+    if (datarate >= 0 && datarate <= 5)
+    {
+        *sf = 12 - datarate;
+    }
+    else if (datarate == 6)
+    {
+        *bw_khz = 250;
+    }
+}
+
+uint32_t airtime_get_symbol_us(int datarate)
+{
+    int sf, bw_khz;
+    airtime_get_modulation(datarate, &sf, &bw_khz);
+    return (uint32_t)((1 << sf) * 1000 / bw_khz);
+}
+
+// airtime_get_frame_toa_us returns the time-on-air in microseconds of a LoRa frame with 4/5 coding rate and explicit header.
+uint32_t airtime_get_frame_toa_us(int datarate, size_t phy_payload_len, bool has_crc)
+{
+    int sf, bw_khz;
+    airtime_get_modulation(datarate, &sf, &bw_khz);
+    double symbol_us = (double)(1 << sf) * 1000 / bw_khz;
+    // Low data rate optimisation is mandated when the symbol duration exceeds 16ms.
+    int low_dr_optimise = symbol_us > 16000 ? 1 : 0;
+    // The formula is from Semtech's "LoRa Modem Designer's Guide" (AN1200.13), with CR=1 (4/5) and explicit header.
+    double payload_symbols = ceil((8.0 * phy_payload_len - 4 * sf + 28 + (has_crc ? 16 : 0)) / (4.0 * (sf - 2 * low_dr_optimise))) * 5;
+    if (payload_symbols < 0)
+    {
+        payload_symbols = 0;
+    }
+    return (uint32_t)ceil((AIRTIME_PREAMBLE_SYMBOLS + 4.25 + 8 + payload_symbols) * symbol_us);
+}
+
+uint32_t airtime_get_toa_us(int datarate, size_t phy_payload_len)
+{
+    return airtime_get_frame_toa_us(datarate, phy_payload_len, true);
+}
+
+uint32_t airtime_get_downlink_toa_us(int datarate, size_t phy_payload_len)
+{
+    // LoRaWAN downlinks are transmitted without the payload CRC.
+    return airtime_get_frame_toa_us(datarate, phy_payload_len, false);
+}
+
+uint32_t airtime_get_uplink_toa_ms(int datarate, size_t app_payload_len)
+{
+    return (airtime_get_toa_us(datarate, app_payload_len + AIRTIME_MAC_OVERHEAD_BYTES + AIRTIME_FOPTS_ALLOWANCE_BYTES) + 999) / 1000;
+}
+
+// airtime_get_now_sec returns the RTC time in seconds, which keeps running during deep sleep and across soft resets.
+uint32_t airtime_get_now_sec()
+{
+    return (uint32_t)time(NULL);
+}
+
+int airtime_get_sub_band(uint32_t freq_hz)
+{
+    for (int i = 0; i < AIRTIME_NUM_SUB_BANDS; ++i)
+    {
+        if (freq_hz >= sub_bands[i].min_freq_hz && freq_hz < sub_bands[i].max_freq_hz)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// airtime_add adds the airtime to the bucket of the current slot.
+void airtime_add(airtime_bucket_t *buckets, size_t num_buckets, uint32_t slot, uint32_t airtime_ms)
+{
+    airtime_bucket_t *bucket = &buckets[slot % num_buckets];
+    if (bucket->slot != slot)
+    {
+        bucket->slot = slot;
+        bucket->airtime_ms = 0;
+    }
+    bucket->airtime_ms += airtime_ms;
+}
+
+// airtime_sum returns the airtime of the buckets within the observation period ending with the current slot.
+uint32_t airtime_sum(const airtime_bucket_t *buckets, size_t num_buckets, uint32_t slot)
+{
+    uint32_t sum = 0;
+    for (size_t i = 0; i < num_buckets; ++i)
+    {
+        if (buckets[i].slot <= slot && slot - buckets[i].slot < num_buckets)
+        {
+            sum += buckets[i].airtime_ms;
+        }
+    }
+    return sum;
+}
+
+void airtime_record_tx(uint32_t freq_hz, int datarate, size_t phy_payload_len)
+{
+    uint32_t airtime_ms = (airtime_get_toa_us(datarate, phy_payload_len) + 999) / 1000;
+    uint32_t now_sec = airtime_get_now_sec();
+    int sub_band = airtime_get_sub_band(freq_hz);
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (sub_band >= 0)
+    {
+        airtime_add(duty_cycle_buckets[sub_band], AIRTIME_DUTY_CYCLE_NUM_BUCKETS, now_sec / AIRTIME_DUTY_CYCLE_BUCKET_SEC, airtime_ms);
+    }
+    airtime_add(fair_use_buckets, AIRTIME_FAIR_USE_NUM_BUCKETS, now_sec / AIRTIME_FAIR_USE_BUCKET_SEC, airtime_ms);
+    total_airtime_ms += airtime_ms;
+    xSemaphoreGive(mutex);
+    ESP_LOGI(LOG_TAG, "transmitted %d bytes at DR%d on %uHz in %ums, %dms left in the sub-band and %dms left for the day",
+             phy_payload_len, datarate, freq_hz, airtime_ms, airtime_get_duty_cycle_remaining_ms(freq_hz), airtime_get_fair_use_remaining_ms());
+}
+
+int airtime_get_duty_cycle_remaining_ms(uint32_t freq_hz)
+{
+    int sub_band = airtime_get_sub_band(freq_hz);
+    if (sub_band < 0)
+    {
+        // The frequency is outside of EU868, there is nothing to account for.
+        return INT32_MAX;
+    }
+    uint32_t now_sec = airtime_get_now_sec();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint32_t used_ms = airtime_sum(duty_cycle_buckets[sub_band], AIRTIME_DUTY_CYCLE_NUM_BUCKETS, now_sec / AIRTIME_DUTY_CYCLE_BUCKET_SEC);
+    xSemaphoreGive(mutex);
+    return (int)(AIRTIME_DUTY_CYCLE_WINDOW_SEC * sub_bands[sub_band].duty_cycle_permille) - (int)used_ms;
+}
+
+int airtime_get_fair_use_remaining_ms()
+{
+    uint32_t now_sec = airtime_get_now_sec();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    uint32_t used_ms = airtime_sum(fair_use_buckets, AIRTIME_FAIR_USE_NUM_BUCKETS, now_sec / AIRTIME_FAIR_USE_BUCKET_SEC);
+    xSemaphoreGive(mutex);
+    return AIRTIME_FAIR_USE_MS - (int)used_ms;
+}
+
+int airtime_get_max_payload_len(int datarate, int budget_ms)
+{
+    if (budget_ms <= 0 || (int)airtime_get_uplink_toa_ms(datarate, 0) > budget_ms)
+    {
+        return -1;
+    }
+    // The airtime grows monotonically with the payload size, look for the largest size that fits.
+    int lo = 0, hi = 255;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if ((int)airtime_get_uplink_toa_ms(datarate, mid) <= budget_ms)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+unsigned long airtime_get_total_ms()
+{
+    return total_airtime_ms;
+}
@@ -0,0 +1,99 @@
+#include <Arduino.h>
+#include "battery.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// battery_curve_point_t is a point of the voltage curve.
+typedef struct
+{
+    int millivolt;
+    float soc_pct;
+} battery_curve_point_t;
+
+// The open circuit voltage of a typical Li-ion cell, from full to empty.
+static const battery_curve_point_t curve[] = {
+    {4200, 100}, {4110, 90}, {4020, 80}, {3950, 70}, {3870, 60}, {3840, 50},
+    {3800, 40}, {3770, 30}, {3730, 20}, {3690, 10}, {3610, 5}, {3300, 0}};
+static const int num_curve_points = sizeof(curve) / sizeof(curve[0]);
+
+// The model is only ever updated by the power task loop, other tasks read the plain values.
+RTC_DATA_ATTR static bool is_soc_valid, is_avg_draw_valid;
+RTC_DATA_ATTR static double soc_pct;
+RTC_DATA_ATTR static double avg_draw_milliamp;
+
+float battery_get_soc_from_voltage(int millivolt)
+{
+    if (millivolt >= curve[0].millivolt)
+    {
+        return curve[0].soc_pct;
+    }
+    for (int i = 1; i < num_curve_points; ++i)
+    {
+        if (millivolt >= curve[i].millivolt)
+        {
+            // Interpolate in between the two points.
+            float fraction = float(millivolt - curve[i].millivolt) / (curve[i - 1].millivolt - curve[i].millivolt);
+            return curve[i].soc_pct + fraction * (curve[i - 1].soc_pct - curve[i].soc_pct);
+        }
+    }
+    return 0;
+}
+
+void battery_update(int batt_millivolt, float batt_milliamp, double batt_milliamp_hours, double draw_milliamp_hours, unsigned long duration_ms)
+{
+    if (duration_ms == 0)
+    {
+        return;
+    }
+    double draw_milliamp = draw_milliamp_hours * 3600000.0 / duration_ms;
+    if (!is_avg_draw_valid)
+    {
+        avg_draw_milliamp = draw_milliamp;
+        is_avg_draw_valid = true;
+    }
+    double draw_weight = min(1.0, duration_ms / (BATTERY_DRAW_AVERAGE_SEC * 1000.0));
+    avg_draw_milliamp += draw_weight * (draw_milliamp - avg_draw_milliamp);
+    if (batt_millivolt < BATTERY_MIN_MILLIVOLT)
+    {
+        // There is no battery.
+        return;
+    }
+    if (!is_soc_valid)
+    {
+        soc_pct = battery_get_soc_from_voltage(batt_millivolt);
+        is_soc_valid = true;
+        ESP_LOGI(LOG_TAG, "initial state of charge %.1f%% at %dmV", soc_pct, batt_millivolt);
+        return;
+    }
+    soc_pct += batt_milliamp_hours * 100.0 / BATTERY_CAPACITY_MAH;
+    if (fabs(batt_milliamp) <= BATTERY_REST_MAX_MILLIAMP)
+    {
+        double correction = min(1.0, BATTERY_VOLTAGE_CORRECTION_PER_HOUR * duration_ms / 3600000.0);
+        soc_pct += correction * (battery_get_soc_from_voltage(batt_millivolt) - soc_pct);
+    }
+    soc_pct = constrain(soc_pct, 0.0, 100.0);
+}
+
+float battery_get_soc_pct()
+{
+    return is_soc_valid ? soc_pct : -1;
+}
+
+double battery_get_remaining_mah()
+{
+    return is_soc_valid ? soc_pct * BATTERY_CAPACITY_MAH / 100.0 : 0;
+}
+
+double battery_get_avg_draw_milliamp()
+{
+    return avg_draw_milliamp;
+}
+
+long battery_get_projected_runtime_sec()
+{
+    if (!is_soc_valid || avg_draw_milliamp <= 0)
+    {
+        return -1;
+    }
+    return (long)(battery_get_remaining_mah() / avg_draw_milliamp * 3600);
+}
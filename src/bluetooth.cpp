@@ -4,14 +4,14 @@
 
 #include "power_management.h"
 #include "bluetooth.h"
+#include "prep_window.h"
 #include "wifi.h"
-#include "oled.h"
 
 static const char LOG_TAG[] = __FILE__;
 
 static bool is_powered_on = false;
 
-static unsigned long round_num = 0;
+static unsigned long round_num = 0, rounds_since_on = 0;
 static BLEScan *scanner = NULL;
 static BLEAdvertisedDevice last_loudest_sender, loudest_sender;
 static int last_loudest_rssi = BLUETOOTH_RSSI_FLOOR, loudest_rssi = BLUETOOTH_RSSI_FLOOR;
@@ -40,6 +40,7 @@ void bluetooth_on()
     scanner->setActiveScan(true);
     scanner->setInterval(BLUETOOTH_SCAN_DURATION_SEC * 100);
     scanner->setWindow(BLUETOOTH_SCAN_DURATION_SEC * BLUETOOTH_SCAN_DUTY_CYCLE_PCT);
+    rounds_since_on = 0;
     is_powered_on = true;
     power_wifi_bt_unlock();
 }
@@ -59,6 +60,7 @@ void bluetooth_off()
     BLEDevice::deinit();
     is_powered_on = false;
     power_wifi_bt_unlock();
+    prep_window_end(PREP_WINDOW_BT_WIFI_GAP);
 }
 
 bool bluetooth_get_state()
@@ -95,8 +97,13 @@ void bluetooth_scan()
         num_devices++;
     }
     round_num++;
+    ++rounds_since_on;
     power_wifi_bt_unlock();
     ESP_LOGI(LOG_TAG, "found %d devices in a round of scan", bluetooth_get_total_num_devices());
+    if (rounds_since_on == PREP_WINDOW_SCAN_ROUNDS)
+    {
+        prep_window_end(PREP_WINDOW_BLUETOOTH);
+    }
 }
 
 void bluetooth_task_loop(void *_)
@@ -104,17 +111,18 @@ void bluetooth_task_loop(void *_)
     while (true)
     {
         esp_task_wdt_reset();
-        if ((power_get_todo() & POWER_TODO_TURN_ON_BLUETOOTH) || (oled_get_state() && oled_get_page_number() == OLED_PAGE_BT_INFO))
+        if (power_get_todo() & POWER_TODO_TURN_ON_BLUETOOTH)
         {
             bluetooth_on();
             bluetooth_scan();
+            // The scanner runs for BLUETOOTH_SCAN_DURATION_SEC and then rests for a short period of time.
+            vTaskDelay(pdMS_TO_TICKS(BLUETOOTH_TASK_LOOP_DELAY_MS));
         }
         else
         {
             bluetooth_off();
+            power_wait_todo(POWER_TODO_TURN_ON_BLUETOOTH, POWER_TODO_WAIT_TIMEOUT_MS);
         }
-        // The scanner runs for BLUETOOTH_SCAN_DURATION_SEC and then rests for a short period of time.
-        vTaskDelay(pdMS_TO_TICKS(BLUETOOTH_TASK_LOOP_DELAY_MS));
     }
 }
 
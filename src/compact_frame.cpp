@@ -0,0 +1,168 @@
+#include <Arduino.h>
+#include <math.h>
+#include "compact_frame.h"
+#include "data_packet.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// COMPACT_FRAME_SCHEMA_ENTRY expands a field of payload_schema.h into its schema table entry.
+#define COMPACT_FRAME_SCHEMA_ENTRY(id, field_name, field_encoding, field_bits, field_delta_bits, field_resolution, field_offset) \
+    {.name = field_name, .encoding = COMPACT_FIELD_##field_encoding, .bits = field_bits, .delta_bits = field_delta_bits,      \
+     .resolution = field_resolution, .offset = field_offset},
+
+static const compact_field_t status_schema[COMPACT_STATUS_NUM_FIELDS] = {PAYLOAD_SCHEMA_STATUS(COMPACT_FRAME_SCHEMA_ENTRY)};
+static const compact_field_t pos_schema[COMPACT_POS_NUM_FIELDS] = {PAYLOAD_SCHEMA_POS(COMPACT_FRAME_SCHEMA_ENTRY)};
+
+// The key frame writers are expanded from payload_schema.h into a straight sequence of writes of fixed widths, one per
+// field, so that encoding a key frame does not look up the schema at runtime.
+#define COMPACT_FRAME_WRITE_UNSIGNED(val, num_bits) pkt.writeBits((uint32_t)(val), num_bits);
+#define COMPACT_FRAME_WRITE_SIGNED(val, num_bits) pkt.writeSignedBits(val, num_bits);
+#define COMPACT_FRAME_WRITE_VARINT(val, num_bits) pkt.writeVarint((uint32_t)(val), num_bits);
+#define COMPACT_STATUS_WRITE_KEY(id, name, encoding, bits, ...) COMPACT_FRAME_WRITE_##encoding(quantised[COMPACT_STATUS_##id], bits)
+#define COMPACT_POS_WRITE_KEY(id, name, encoding, bits, ...) COMPACT_FRAME_WRITE_##encoding(quantised[COMPACT_POS_##id], bits)
+
+// compact_frame_snapshot_t is the quantised field values of a key frame.
+typedef struct
+{
+    int32_t quantised[COMPACT_FRAME_MAX_FIELDS];
+    uint8_t key_id;
+    bool valid;
+} compact_frame_snapshot_t;
+
+static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+// last_key is the last key frame encoded for each kind, it becomes the reference once acknowledged.
+static compact_frame_snapshot_t last_key[COMPACT_FRAME_KINDS], reference[COMPACT_FRAME_KINDS];
+static int deltas_since_key[COMPACT_FRAME_KINDS];
+static uint8_t next_key_id = 0;
+static unsigned long total_deltas = 0;
+
+const compact_field_t *compact_frame_get_schema(int kind, size_t *num_fields)
+{
+    if (kind == COMPACT_FRAME_POS)
+    {
+        *num_fields = COMPACT_POS_NUM_FIELDS;
+        return pos_schema;
+    }
+    *num_fields = COMPACT_STATUS_NUM_FIELDS;
+    return status_schema;
+}
+
+int32_t compact_frame_quantise(const compact_field_t *field, double val)
+{
+    double scaled = round((val - field->offset) / field->resolution);
+    double min = 0, max = 0;
+    switch (field->encoding)
+    {
+    case COMPACT_FIELD_UNSIGNED:
+        max = (double)((1UL << field->bits) - 1);
+        break;
+    case COMPACT_FIELD_SIGNED:
+        min = -(double)(1UL << (field->bits - 1));
+        max = (double)((1UL << (field->bits - 1)) - 1);
+        break;
+    default:
+        max = (double)INT32_MAX;
+        break;
+    }
+    if (scaled < min)
+    {
+        scaled = min;
+    }
+    else if (scaled > max)
+    {
+        scaled = max;
+    }
+    return (int32_t)scaled;
+}
+
+size_t compact_frame_encode(int kind, const double *values, uint8_t *buf, size_t buf_len)
+{
+    size_t num_fields;
+    const compact_field_t *schema = compact_frame_get_schema(kind, &num_fields);
+    int32_t quantised[COMPACT_FRAME_MAX_FIELDS];
+    for (size_t i = 0; i < num_fields; ++i)
+    {
+        quantised[i] = compact_frame_quantise(&schema[i], values[i]);
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    DataPacket pkt(buf, buf_len);
+    bool is_delta = reference[kind].valid && deltas_since_key[kind] < COMPACT_FRAME_MAX_DELTAS;
+    pkt.writeBits(COMPACT_FRAME_VERSION, 2);
+    if (is_delta)
+    {
+        pkt.writeBits(1, 1);
+        pkt.writeBits(reference[kind].key_id, 5);
+        for (size_t i = 0; i < num_fields; ++i)
+        {
+            pkt.writeBits(quantised[i] != reference[kind].quantised[i] ? 1 : 0, 1);
+        }
+        for (size_t i = 0; i < num_fields; ++i)
+        {
+            if (quantised[i] != reference[kind].quantised[i])
+            {
+                pkt.writeZigZagVarint(quantised[i] - reference[kind].quantised[i], schema[i].delta_bits);
+            }
+        }
+        // A discarded frame does not count, the decoder never sees it.
+        if (!pkt.overflow)
+        {
+            ++deltas_since_key[kind];
+            ++total_deltas;
+        }
+    }
+    else
+    {
+        uint8_t key_id = next_key_id;
+        pkt.writeBits(0, 1);
+        pkt.writeBits(key_id, 5);
+        if (kind == COMPACT_FRAME_POS)
+        {
+            PAYLOAD_SCHEMA_POS(COMPACT_POS_WRITE_KEY)
+        }
+        else
+        {
+            PAYLOAD_SCHEMA_STATUS(COMPACT_STATUS_WRITE_KEY)
+        }
+        if (!pkt.overflow)
+        {
+            next_key_id = (next_key_id + 1) % 32;
+            memcpy(last_key[kind].quantised, quantised, sizeof(quantised));
+            last_key[kind].key_id = key_id;
+            last_key[kind].valid = true;
+            deltas_since_key[kind] = 0;
+        }
+    }
+    xSemaphoreGive(mutex);
+
+    if (pkt.overflow)
+    {
+        ESP_LOGW(LOG_TAG, "compact frame of kind %d does not fit into %d bytes", kind, buf_len);
+        return 0;
+    }
+    ESP_LOGI(LOG_TAG, "encoded a %s frame of kind %d in %d bits", is_delta ? "delta" : "key", kind, pkt.bit_cursor);
+    return pkt.length();
+}
+
+void compact_frame_acknowledge(int kind, uint8_t header)
+{
+    if (kind < 0 || kind >= COMPACT_FRAME_KINDS)
+    {
+        return;
+    }
+    bool is_key = ((header >> 2) & 1) == 0;
+    uint8_t key_id = header >> 3;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    // Only the latest key frame can become the reference, an older one may have been acknowledged after it was encoded.
+    if (is_key && last_key[kind].valid && last_key[kind].key_id == key_id)
+    {
+        reference[kind] = last_key[kind];
+        ESP_LOGI(LOG_TAG, "key frame %d of kind %d is acknowledged", reference[kind].key_id, kind);
+    }
+    xSemaphoreGive(mutex);
+}
+
+unsigned long compact_frame_get_num_deltas()
+{
+    return total_deltas;
+}
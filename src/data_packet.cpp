@@ -1,66 +1,131 @@
 #include <Arduino.h>
 #include "data_packet.h"
 
-DataPacket::DataPacket(size_t size)
+DataPacket::DataPacket(uint8_t *buf, size_t size)
 {
-    content = (uint8_t *)calloc(1, size);
-    cursor = 0;
+    memset(buf, 0, size);
+    content = buf;
+    capacity = size;
+    bit_cursor = 0;
+    overflow = false;
 }
 
-DataPacket::~DataPacket()
+size_t DataPacket::length()
 {
-    free(content);
+    return (bit_cursor + 7) / 8;
 }
 
-void DataPacket::writeInteger(uint64_t val, size_t num_bytes)
+void DataPacket::writeBits(uint32_t val, size_t num_bits)
 {
-    // Write the value in little endian - the less significant number is written first.
-    for (size_t x = 0; x < num_bytes; x++)
+    if (num_bits > 32 || bit_cursor + num_bits > capacity * 8)
     {
-        uint8_t next = 0;
-        if (sizeof(val) > x)
+        overflow = true;
+        return;
+    }
+    // Take 6 written in 3 bits at bit cursor 7 for example:
+    // Bit 0 of the value (0) goes into bit 7 of byte 0.
+    // Bit 1 of the value (1) goes into bit 0 of byte 1.
+    // Bit 2 of the value (1) goes into bit 1 of byte 1.
+    for (size_t i = 0; i < num_bits; ++i)
+    {
+        if ((val >> i) & 1)
         {
-            // Take 256 (0, 1) for example:
-            // Round 0 - shift right (divide by) 0 bits, BitAnd 255 (extract 1 byte): equals to 0.
-            // Round 1 - shift right (divide by) 8b its, BitAnd 255 (extract 1 byte): equals to 1.
-            next = static_cast<uint8_t>((val >> (x * 8)) & 0xFF);
+            content[bit_cursor / 8] |= (uint8_t)(1 << (bit_cursor % 8));
         }
-        content[cursor] = next;
-        ++cursor;
+        ++bit_cursor;
     }
 }
 
-void DataPacket::write32BitDouble(double val)
+void DataPacket::writeSignedBits(int32_t val, size_t num_bits)
+{
+    // Two's complement truncated to the width, e.g. -3 in 4 bits is 0b1101.
+    writeBits((uint32_t)val & (num_bits >= 32 ? 0xFFFFFFFF : ((1UL << num_bits) - 1)), num_bits);
+}
+
+void DataPacket::writeVarint(uint32_t val, size_t group_bits)
+{
+    // Each group carries group_bits of the value followed by a continuation bit, the least significant group comes first.
+    // Take 100 written in groups of 3 bits for example: 100 = 0b1100100.
+    // Group 0 - value bits 100, continuation 1.
+    // Group 1 - value bits 100, continuation 1.
+    // Group 2 - value bits 001, continuation 0.
+    do
+    {
+        uint32_t group = val & ((1UL << group_bits) - 1);
+        val >>= group_bits;
+        writeBits(group, group_bits);
+        writeBits(val > 0 ? 1 : 0, 1);
+    } while (val > 0 && !overflow);
+}
+
+void DataPacket::writeZigZagVarint(int32_t val, size_t group_bits)
 {
-    // Represent a double value, ranging from -21474.83648 to 21474.83647 inclusive, in 4 bytes.
+    writeVarint(data_packet_zigzag(val), group_bits);
+}
+
+DataPacketReader::DataPacketReader(const uint8_t *buf, size_t size)
+{
+    content = buf;
+    len = size;
+    bit_cursor = 0;
+    overflow = false;
+}
+
+uint32_t DataPacketReader::readBits(size_t num_bits)
+{
+    if (num_bits > 32 || bit_cursor + num_bits > len * 8)
+    {
+        overflow = true;
+        return 0;
+    }
+    uint32_t ret = 0;
+    for (size_t i = 0; i < num_bits; ++i)
+    {
+        if ((content[bit_cursor / 8] >> (bit_cursor % 8)) & 1)
+        {
+            ret |= (1UL << i);
+        }
+        ++bit_cursor;
+    }
+    return ret;
+}
 
-    // Example 1 - converting 1234.5678 to bytes:
-    // Multiply by 100000: equals to 123456780.
-    // BitAnd 255 (extract the least significant 1 byte): equals to 12.
-    // Shift right (divide by) 8 bits then BitAnd 255 (extract 1 byte): equals to 205.
-    // Shift right (divide by) 16 bits then BitAnd 255 (extract 1 byte): equals to 91.
-    // Shift right (divide by) 24 bits then BitAnd 255 (extract 1 byte): equals to 7.
-    // 12 + 205 * 2^8 + 91 * 2^16 + 7 * 2^24 = 123456780
+int32_t DataPacketReader::readSignedBits(size_t num_bits)
+{
+    uint32_t val = readBits(num_bits);
+    if (num_bits < 32 && (val >> (num_bits - 1)) & 1)
+    {
+        // Extend the sign bit.
+        val |= ~((1UL << num_bits) - 1);
+    }
+    return (int32_t)val;
+}
 
-    // Example 2 - converting -1234.5678 to bytes:
-    // Multiply by 100000: equals to -123456780.
-    // Invert all bits and then plus 1: equals to -123456780
-    // BitAnd 255 (extract the least significant 1 byte): equals to 244.
-    // Shift right (divide by) 8 bits then BitAnd 255 (extract 1 byte): equals to 50.
-    // Shift right (divide by) 16 bits then BitAnd 255 (extract 1 byte): equals to 164.
-    // Shift right (divide by) 24 bits then BitAnd 255 (extract 1 byte): equals to 248.
-    // 244 + 50 * 2^8 + 164 * 2^16 + 248 * 2^24 = 4171510516
-    // 4171510516 is greater than 2147483647, therefore it represents a negative number.
-    // Minus 1 and, invert all bits, and then BitAnd 2147483647: equals to 123456780.
-    // Put the minus sign back in: equals to -123456780.
-    int32_t val_int = (int32_t)(val * 100000);
-    if (val < 0)
+uint32_t DataPacketReader::readVarint(size_t group_bits)
+{
+    uint32_t ret = 0;
+    size_t shift = 0;
+    bool more = true;
+    while (more && !overflow && shift < 32)
     {
-        val_int = ~-val_int;
-        val_int = val_int + 1;
+        ret |= readBits(group_bits) << shift;
+        shift += group_bits;
+        more = readBits(1) == 1;
     }
-    content[cursor++] = (uint8_t)val_int & 0xFF;
-    content[cursor++] = (uint8_t)((val_int >> 8) & 0xFF);
-    content[cursor++] = (uint8_t)((val_int >> 16) & 0xFF);
-    content[cursor++] = (uint8_t)((val_int >> 24) & 0xFF);
+    return ret;
+}
+
+int32_t DataPacketReader::readZigZagVarint(size_t group_bits)
+{
+    return data_packet_unzigzag(readVarint(group_bits));
+}
+
+uint32_t data_packet_zigzag(int32_t val)
+{
+    return ((uint32_t)val << 1) ^ (uint32_t)(val >> 31);
+}
+
+int32_t data_packet_unzigzag(uint32_t val)
+{
+    return (int32_t)(val >> 1) ^ -(int32_t)(val & 1);
 }
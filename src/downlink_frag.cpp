@@ -0,0 +1,136 @@
+#include <Arduino.h>
+#include "downlink_frag.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// downlink_frag_slot_t is a message being reassembled.
+typedef struct
+{
+    bool in_use;
+    uint8_t message_id, num_fragments;
+    // received is a bitmap of the fragments received so far.
+    uint8_t received;
+    size_t last_fragment_len;
+    unsigned long started_millis;
+    uint8_t buf[DOWNLINK_FRAG_MAX_FRAGMENTS * DOWNLINK_FRAG_PAYLOAD_LEN];
+} downlink_frag_slot_t;
+
+// The slots are only ever used by the LoRaWAN event task.
+static downlink_frag_slot_t slots[DOWNLINK_FRAG_NUM_SLOTS];
+// last_completed_id remembers the latest complete message, so that a late duplicate fragment does not start it over.
+static int last_completed_id = -1;
+static unsigned long last_completed_millis = 0;
+
+// downlink_frag_expire frees the slots of the incomplete messages that have timed out.
+void downlink_frag_expire()
+{
+    for (int i = 0; i < DOWNLINK_FRAG_NUM_SLOTS; ++i)
+    {
+        if (slots[i].in_use && millis() - slots[i].started_millis > DOWNLINK_FRAG_TIMEOUT_SEC * 1000)
+        {
+            ESP_LOGW(LOG_TAG, "discarding incomplete message %d, received fragments bitmap 0x%02x of %d fragments", slots[i].message_id, slots[i].received, slots[i].num_fragments);
+            slots[i].in_use = false;
+        }
+    }
+}
+
+// downlink_frag_get_slot returns the slot of the message, a newly claimed slot if the message is new.
+downlink_frag_slot_t *downlink_frag_get_slot(uint8_t message_id, uint8_t num_fragments)
+{
+    downlink_frag_slot_t *free_slot = NULL, *oldest = &slots[0];
+    for (int i = 0; i < DOWNLINK_FRAG_NUM_SLOTS; ++i)
+    {
+        if (slots[i].in_use && slots[i].message_id == message_id && slots[i].num_fragments == num_fragments)
+        {
+            return &slots[i];
+        }
+        if (!slots[i].in_use && free_slot == NULL)
+        {
+            free_slot = &slots[i];
+        }
+        if (slots[i].started_millis < oldest->started_millis)
+        {
+            oldest = &slots[i];
+        }
+    }
+    if (free_slot == NULL)
+    {
+        ESP_LOGW(LOG_TAG, "discarding incomplete message %d to make room for message %d", oldest->message_id, message_id);
+        free_slot = oldest;
+    }
+    memset(free_slot, 0, sizeof(downlink_frag_slot_t));
+    free_slot->in_use = true;
+    free_slot->message_id = message_id;
+    free_slot->num_fragments = num_fragments;
+    free_slot->started_millis = millis();
+    return free_slot;
+}
+
+int downlink_frag_receive(const uint8_t *frag, size_t len, uint8_t report[DOWNLINK_FRAG_REPORT_LEN], lorawan_message_buf_t *message)
+{
+    downlink_frag_expire();
+    if (len < DOWNLINK_FRAG_HEADER_LEN)
+    {
+        ESP_LOGW(LOG_TAG, "discarding a %d bytes fragment without a header", len);
+        return DOWNLINK_FRAG_MALFORMED;
+    }
+    uint8_t message_id = frag[0];
+    int index = frag[1] & 0xF, num_fragments = (frag[1] >> 4) + 1;
+    size_t payload_len = len - DOWNLINK_FRAG_HEADER_LEN;
+    bool is_last = index == num_fragments - 1;
+    if (index >= num_fragments || num_fragments > DOWNLINK_FRAG_MAX_FRAGMENTS ||
+        (!is_last && payload_len != DOWNLINK_FRAG_PAYLOAD_LEN) || (is_last && payload_len > DOWNLINK_FRAG_PAYLOAD_LEN) ||
+        (num_fragments - 1) * DOWNLINK_FRAG_PAYLOAD_LEN + (is_last ? payload_len : 0) > LORAWAN_MAX_MESSAGE_LEN)
+    {
+        ESP_LOGW(LOG_TAG, "discarding malformed fragment %d/%d of message %d, %d bytes long", index, num_fragments, message_id, len);
+        return DOWNLINK_FRAG_MALFORMED;
+    }
+    report[0] = message_id;
+    report[1] = num_fragments;
+    if (message_id == last_completed_id && millis() - last_completed_millis < DOWNLINK_FRAG_TIMEOUT_SEC * 1000)
+    {
+        // The sender has not seen the report of the complete message yet.
+        ESP_LOGI(LOG_TAG, "received a duplicated fragment %d/%d of the complete message %d", index, num_fragments, message_id);
+        report[2] = 0;
+        return DOWNLINK_FRAG_INCOMPLETE;
+    }
+
+    downlink_frag_slot_t *slot = downlink_frag_get_slot(message_id, num_fragments);
+    memcpy(&slot->buf[index * DOWNLINK_FRAG_PAYLOAD_LEN], &frag[DOWNLINK_FRAG_HEADER_LEN], payload_len);
+    slot->received |= 1 << index;
+    if (is_last)
+    {
+        slot->last_fragment_len = payload_len;
+    }
+    uint8_t all_fragments = (1 << num_fragments) - 1;
+    report[2] = all_fragments & ~slot->received;
+    ESP_LOGI(LOG_TAG, "received fragment %d/%d of message %d, missing fragments bitmap 0x%02x", index, num_fragments, message_id, report[2]);
+    if (slot->received != all_fragments)
+    {
+        return DOWNLINK_FRAG_INCOMPLETE;
+    }
+
+    message->len = (num_fragments - 1) * DOWNLINK_FRAG_PAYLOAD_LEN + slot->last_fragment_len;
+    memcpy(message->buf, slot->buf, message->len);
+    message->buf[message->len] = 0;
+    message->timestamp_millis = millis();
+    message->port = LORAWAN_PORT_FRAGMENT;
+    slot->in_use = false;
+    last_completed_id = message_id;
+    last_completed_millis = millis();
+    ESP_LOGI(LOG_TAG, "reassembled message %d of %d bytes from %d fragments", message_id, message->len, num_fragments);
+    return DOWNLINK_FRAG_COMPLETE;
+}
+
+int downlink_frag_get_num_pending()
+{
+    int ret = 0;
+    for (int i = 0; i < DOWNLINK_FRAG_NUM_SLOTS; ++i)
+    {
+        if (slots[i].in_use)
+        {
+            ++ret;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include "data_packet.h"
+#include "energy_ledger.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+static const char *state_names[ENERGY_LEDGER_NUM_STATES] = {"LoRa", "WiFi", "BT", "GPS", "OLED", "CPU80", "CPU10", "Sleep"};
+
+static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+RTC_DATA_ATTR static energy_ledger_entry_t total;
+RTC_DATA_ATTR static energy_ledger_entry_t states_booked[ENERGY_LEDGER_NUM_STATES];
+RTC_DATA_ATTR static bool last_from_coulomb_counter;
+// The uptime is short in between two deep sleeps, the report interval counts the duration booked to the ledger instead.
+RTC_DATA_ATTR static unsigned long long last_report_duration_ms;
+
+void energy_ledger_record(int states, double milliamp_hours, unsigned long duration_ms, bool from_coulomb_counter)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    total.duration_ms += duration_ms;
+    total.milliamp_hours += milliamp_hours;
+    for (int i = 0; i < ENERGY_LEDGER_NUM_STATES; ++i)
+    {
+        if (states & (1 << i))
+        {
+            states_booked[i].duration_ms += duration_ms;
+            states_booked[i].milliamp_hours += milliamp_hours;
+        }
+    }
+    last_from_coulomb_counter = from_coulomb_counter;
+    xSemaphoreGive(mutex);
+}
+
+energy_ledger_entry_t energy_ledger_get_total()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    energy_ledger_entry_t ret = total;
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+energy_ledger_entry_t energy_ledger_get_state(int state)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    energy_ledger_entry_t ret = states_booked[state];
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+double energy_ledger_get_attributed_mah(int state)
+{
+    energy_ledger_entry_t all = energy_ledger_get_total();
+    energy_ledger_entry_t on = energy_ledger_get_state(state);
+    energy_ledger_entry_t sleep = energy_ledger_get_state(ENERGY_LEDGER_DEEP_SLEEP);
+    // A peripheral is compared with the time it was off while the CPUs were awake.
+    unsigned long long off_ms = all.duration_ms - sleep.duration_ms - on.duration_ms;
+    if (state == ENERGY_LEDGER_CPU_FULL || state == ENERGY_LEDGER_CPU_REDUCED || state == ENERGY_LEDGER_DEEP_SLEEP || on.duration_ms == 0 || off_ms == 0)
+    {
+        return on.milliamp_hours;
+    }
+    double on_milliamp = on.milliamp_hours * 3600000.0 / on.duration_ms;
+    double off_milliamp = (all.milliamp_hours - sleep.milliamp_hours - on.milliamp_hours) * 3600000.0 / off_ms;
+    if (on_milliamp <= off_milliamp)
+    {
+        return 0;
+    }
+    return (on_milliamp - off_milliamp) * on.duration_ms / 3600000.0;
+}
+
+const char *energy_ledger_get_state_name(int state)
+{
+    return state_names[state];
+}
+
+void energy_ledger_log()
+{
+    energy_ledger_entry_t all = energy_ledger_get_total();
+    ESP_LOGI(LOG_TAG, "consumed %.2f mAh in %.2f hours, coulomb counter? %d", all.milliamp_hours, all.duration_ms / 3600000.0, last_from_coulomb_counter);
+    for (int i = 0; i < ENERGY_LEDGER_NUM_STATES; ++i)
+    {
+        energy_ledger_entry_t on = energy_ledger_get_state(i);
+        ESP_LOGI(LOG_TAG, "%s: active for %.2f hours, consumed %.2f mAh while active, %.2f mAh attributed", state_names[i], on.duration_ms / 3600000.0, on.milliamp_hours, energy_ledger_get_attributed_mah(i));
+    }
+}
+
+bool energy_ledger_is_report_due()
+{
+    return energy_ledger_get_total().duration_ms - last_report_duration_ms >= ENERGY_LEDGER_REPORT_INTERVAL_SEC * 1000ULL;
+}
+
+// energy_ledger_write_entry writes the duration and charge of the entry into the packet.
+void energy_ledger_write_entry(DataPacket &pkt, const energy_ledger_entry_t *entry)
+{
+    pkt.writeVarint(entry->duration_ms / 1000, 7);
+    pkt.writeVarint(max(entry->milliamp_hours, 0.0) * 1000 / ENERGY_LEDGER_REPORT_UNIT_UAH, 7);
+}
+
+size_t energy_ledger_encode_report(uint8_t *buf, size_t max_len)
+{
+    energy_ledger_log();
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    DataPacket pkt(buf, max_len);
+    pkt.writeBits(ENERGY_LEDGER_REPORT_VERSION, 2);
+    pkt.writeBits(last_from_coulomb_counter, 1);
+    energy_ledger_write_entry(pkt, &total);
+    for (int i = 0; i < ENERGY_LEDGER_NUM_STATES; ++i)
+    {
+        energy_ledger_write_entry(pkt, &states_booked[i]);
+    }
+    size_t len = pkt.overflow ? 0 : pkt.length();
+    if (len > 0)
+    {
+        last_report_duration_ms = total.duration_ms;
+    }
+    xSemaphoreGive(mutex);
+    return len;
+}
@@ -1,63 +1,206 @@
 #include <Adafruit_BME280.h>
 #include <Adafruit_Sensor.h>
 #include <esp_task_wdt.h>
+#include "data_packet.h"
 #include "env_sensor.h"
 #include "hardware_facts.h"
+#include "i2c_bus.h"
 #include "power_management.h"
-#include "oled.h"
+#include "prep_window.h"
+#include "snapshot.h"
+#include "ulp_wake.h"
 
 static const char LOG_TAG[] = __FILE__;
 
 static Adafruit_BME280 bme;
-static struct env_data latest;
+static bool is_sensor_initialised = false;
+// readings is the working copy of the sensor task loop, other tasks read the copy published to latest.
+static struct env_data readings;
+static Snapshot<struct env_data> latest;
 static double sum_temp_readings = 0.0;
 
-void env_sensor_setup()
+static SemaphoreHandle_t series_mutex = xSemaphoreCreateMutex();
+// series is a ring buffer of the samples waiting to be transmitted, series_head is the index of the oldest sample.
+static env_sample_t series[ENV_SENSOR_SERIES_CAPACITY];
+static size_t series_head = 0, series_len = 0;
+// next_sample_seq is the sequence number of the next sample, encoded_end_seq is the sequence number following the newest
+// sample of the latest encoded series.
+static uint32_t next_sample_seq = 0, encoded_end_seq = 0;
+static unsigned long last_sample_millis = 0;
+
+// env_sensor_begin resets the BME280 sensor and reads its calibration, the caller must hold the I2C bus.
+void env_sensor_begin()
 {
-    ESP_LOGI(LOG_TAG, "setting up sensors");
-    memset(&latest, 0, sizeof(latest));
-    power_i2c_lock();
     if (!bme.begin(BME280_I2C_ADDR))
     {
         ESP_LOGW(LOG_TAG, "failed to initialise BME280 sensor");
     }
-    power_i2c_unlock();
+    is_sensor_initialised = true;
+}
+
+void env_sensor_setup()
+{
+    ESP_LOGI(LOG_TAG, "setting up sensors");
+    memset(&readings, 0, sizeof(readings));
+    if (ulp_wake_is_fast_boot())
+    {
+        // The calibration is lost in deep sleep along with the rest of the memory, reading it takes over 100ms.
+        // Hold the first sample of the series back by an interval, so that the sensor task does not read it during boot
+        // unless a transmission asks for a reading first.
+        last_sample_millis = millis();
+        ESP_LOGI(LOG_TAG, "sensors will be set up when they are first read");
+        return;
+    }
+    i2c_bus_lock(I2C_BUS_DEVICE_ENV_SENSOR);
+    env_sensor_begin();
+    i2c_bus_unlock(I2C_BUS_DEVICE_ENV_SENSOR);
 
     ESP_LOGI(LOG_TAG, "sensors are ready");
 }
 
 void env_sensor_read_decode()
 {
-    power_i2c_lock();
-    latest.altitude_metre = bme.readAltitude(1013.25);
-    latest.humidity_pct = bme.readHumidity();
-    latest.pressure_hpa = bme.readPressure() / 100;
-    latest.temp_celcius = bme.readTemperature();
-    power_i2c_unlock();
-    if (latest.humidity_pct == 0 && latest.pressure_hpa == 0 && latest.temp_celcius == 0)
+    i2c_bus_lock(I2C_BUS_DEVICE_ENV_SENSOR);
+    if (!is_sensor_initialised)
+    {
+        env_sensor_begin();
+    }
+    readings.altitude_metre = bme.readAltitude(1013.25);
+    readings.humidity_pct = bme.readHumidity();
+    readings.pressure_hpa = bme.readPressure() / 100;
+    readings.temp_celcius = bme.readTemperature();
+    i2c_bus_unlock(I2C_BUS_DEVICE_ENV_SENSOR);
+    if (readings.humidity_pct == 0 && readings.pressure_hpa == 0 && readings.temp_celcius == 0)
     {
         // Otherwise it will read 44330m.
-        latest.altitude_metre = 0;
+        readings.altitude_metre = 0;
     }
     else
     {
         struct power_status power = power_get_status();
         if (power.is_usb_power_available)
         {
-            latest.temp_celcius += TEMP_OFFSET_CELCIUS_USB;
+            readings.temp_celcius += TEMP_OFFSET_CELCIUS_USB;
         }
         else
         {
-            latest.temp_celcius += TEMP_OFFSET_CELCIUS_BATT;
+            readings.temp_celcius += TEMP_OFFSET_CELCIUS_BATT;
         }
     }
-    sum_temp_readings += latest.temp_celcius;
+    sum_temp_readings += readings.temp_celcius;
+    latest.publish(readings);
+    prep_window_end(PREP_WINDOW_ENV_SENSOR);
     ESP_LOGI(LOG_TAG, "just took a round of readings");
 }
 
 struct env_data env_sensor_get_data()
 {
-    return latest;
+    return latest.read();
+}
+
+// env_sensor_take_sample adds the latest readings to the sensor series.
+void env_sensor_take_sample()
+{
+    env_sensor_read_decode();
+    env_sample_t sample;
+    sample.temp_centi_celcius = (int16_t)constrain(round(readings.temp_celcius * 100), -8192, 8191);
+    sample.humidity_pct = (uint8_t)constrain(round(readings.humidity_pct), 0, 127);
+    sample.pressure_deci_hpa = (uint16_t)constrain(round(readings.pressure_hpa * 10), 0, 16383);
+    sample.batt_millivolt = (uint16_t)constrain(power_get_status().batt_millivolt, 0, 8191);
+    xSemaphoreTake(series_mutex, portMAX_DELAY);
+    series[(series_head + series_len) % ENV_SENSOR_SERIES_CAPACITY] = sample;
+    if (series_len < ENV_SENSOR_SERIES_CAPACITY)
+    {
+        ++series_len;
+    }
+    else
+    {
+        series_head = (series_head + 1) % ENV_SENSOR_SERIES_CAPACITY;
+    }
+    ++next_sample_seq;
+    last_sample_millis = millis();
+    xSemaphoreGive(series_mutex);
+}
+
+size_t env_sensor_get_num_samples()
+{
+    return series_len;
+}
+
+// env_sensor_write_series writes the newest num_samples samples into the packet.
+void env_sensor_write_series(DataPacket &pkt, size_t num_samples)
+{
+    pkt.writeBits(ENV_SENSOR_SERIES_VERSION, 2);
+    pkt.writeBits(num_samples, 6);
+    pkt.writeVarint(ENV_SENSOR_SERIES_INTERVAL_SEC, 7);
+    pkt.writeVarint((millis() - last_sample_millis) / 1000, 7);
+    const env_sample_t *prev = NULL;
+    for (size_t i = series_len - num_samples; i < series_len; ++i)
+    {
+        const env_sample_t *sample = &series[(series_head + i) % ENV_SENSOR_SERIES_CAPACITY];
+        if (prev == NULL)
+        {
+            pkt.writeSignedBits(sample->temp_centi_celcius, 14);
+            pkt.writeBits(sample->humidity_pct, 7);
+            pkt.writeBits(sample->pressure_deci_hpa, 14);
+            pkt.writeBits(sample->batt_millivolt, 13);
+        }
+        else
+        {
+            pkt.writeZigZagVarint(sample->temp_centi_celcius - prev->temp_centi_celcius, 4);
+            pkt.writeZigZagVarint(sample->humidity_pct - prev->humidity_pct, 2);
+            pkt.writeZigZagVarint(sample->pressure_deci_hpa - prev->pressure_deci_hpa, 3);
+            pkt.writeZigZagVarint(sample->batt_millivolt - prev->batt_millivolt, 3);
+        }
+        prev = sample;
+    }
+}
+
+size_t env_sensor_encode_series(uint8_t *buf, size_t max_len)
+{
+    xSemaphoreTake(series_mutex, portMAX_DELAY);
+    size_t num_samples = series_len, len = 0;
+    // Drop the oldest samples until the series fits.
+    for (; num_samples > 0; --num_samples)
+    {
+        DataPacket pkt(buf, max_len);
+        env_sensor_write_series(pkt, num_samples);
+        if (!pkt.overflow)
+        {
+            len = pkt.length();
+            break;
+        }
+    }
+    if (num_samples < series_len)
+    {
+        ESP_LOGW(LOG_TAG, "dropped the oldest %d samples that do not fit into %d bytes", series_len - num_samples, max_len);
+    }
+    if (len > 0)
+    {
+        encoded_end_seq = next_sample_seq;
+    }
+    xSemaphoreGive(series_mutex);
+    if (len > 0)
+    {
+        ESP_LOGI(LOG_TAG, "encoded %d samples into a %d bytes series", num_samples, len);
+    }
+    return len;
+}
+
+void env_sensor_release_series()
+{
+    xSemaphoreTake(series_mutex, portMAX_DELAY);
+    // The oldest samples may have been overwritten since the series was encoded.
+    uint32_t oldest_seq = next_sample_seq - series_len;
+    size_t num_released = 0;
+    if ((int32_t)(encoded_end_seq - oldest_seq) > 0)
+    {
+        num_released = min((size_t)(encoded_end_seq - oldest_seq), series_len);
+    }
+    series_head = (series_head + num_released) % ENV_SENSOR_SERIES_CAPACITY;
+    series_len -= num_released;
+    xSemaphoreGive(series_mutex);
+    ESP_LOGI(LOG_TAG, "released %d transmitted samples, %d samples remain", num_released, series_len);
 }
 
 double env_sensor_get_sum_temp_readings()
@@ -70,10 +213,22 @@ void env_sensor_task_loop(void *_)
     while (true)
     {
         esp_task_wdt_reset();
-        if ((power_get_todo() & POWER_TODO_READ_ENV_SENSOR) || (oled_get_state() && oled_get_page_number() == OLED_PAGE_ENV_SENSOR_INFO))
+        unsigned long ms_since_sample = millis() - last_sample_millis;
+        if (last_sample_millis == 0 || ms_since_sample >= ENV_SENSOR_SERIES_INTERVAL_SEC * 1000)
+        {
+            env_sensor_take_sample();
+        }
+        else if (power_get_todo() & POWER_TODO_READ_ENV_SENSOR)
         {
             env_sensor_read_decode();
         }
+        else
+        {
+            // Sleep until the next sample of the series is due, unless a reading is wanted sooner.
+            unsigned long ms_until_sample = ENV_SENSOR_SERIES_INTERVAL_SEC * 1000 - ms_since_sample;
+            power_wait_todo(POWER_TODO_READ_ENV_SENSOR, min(ms_until_sample, (unsigned long)POWER_TODO_WAIT_TIMEOUT_MS));
+            continue;
+        }
         vTaskDelay(pdMS_TO_TICKS(ENV_SENSOR_TASK_LOOP_DELAY_MS));
     }
 }
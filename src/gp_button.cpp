@@ -4,6 +4,7 @@
 #include "oled.h"
 #include "hardware_facts.h"
 #include "power_management.h"
+#include "text_codec.h"
 
 static const char LOG_TAG[] = __FILE__;
 
@@ -14,6 +15,8 @@ static unsigned long last_click_timestamp = 0;
 static String morse_signals_buf = "";
 static String morse_message_buf = "";
 static String morse_edit_hint = "";
+static String last_enqueued_message = "";
+static unsigned long last_enqueue_failure_timestamp = 0;
 static bool morse_space_inserted_after_word = false;
 static int morse_table_page_clicks = 0;
 
@@ -243,8 +246,8 @@ void gp_button_read()
         // Interpret the press as a click on the LoRaWAN page, which switches between the two power modes.
         if (duration > GP_BUTTON_CLICK_DURATION)
         {
-          power_config_t conf = power_get_config();
-          // regular (default) -> boost -> saver
+          const power_config_t &conf = power_get_config();
+          // regular (default) -> boost -> saver -> adaptive with each of the target runtimes
           if (conf.mode_id == POWER_REGULAR)
           {
             power_set_config(POWER_BOOST);
@@ -253,6 +256,19 @@ void gp_button_read()
           {
             power_set_config(POWER_SAVER);
           }
+          else if (conf.mode_id == POWER_SAVER)
+          {
+            power_set_adaptive_target_hours(power_adaptive_target_hours[0]);
+          }
+          else if (conf.mode_id == POWER_ADAPTIVE && power_get_adaptive_target_hours() != power_adaptive_target_hours[POWER_ADAPTIVE_NUM_TARGETS - 1])
+          {
+            int next = 0;
+            while (next < POWER_ADAPTIVE_NUM_TARGETS - 1 && power_adaptive_target_hours[next] <= power_get_adaptive_target_hours())
+            {
+              next++;
+            }
+            power_set_adaptive_target_hours(power_adaptive_target_hours[next]);
+          }
           else
           {
             power_set_config(POWER_REGULAR);
@@ -289,12 +305,77 @@ void gp_button_read()
   xSemaphoreGive(mutex);
 }
 
+void gp_button_enqueue_finished_message()
+{
+  // The user has finished typing once they navigate away from the morse input pages.
+  if (oled_get_page_number() == OLED_PAGE_TX_MESSAGE || oled_get_page_number() == OLED_PAGE_TX_COMMAND)
+  {
+    return;
+  }
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  if (morse_message_buf == last_enqueued_message)
+  {
+    xSemaphoreGive(mutex);
+    return;
+  }
+  String message = morse_message_buf;
+  if (message.length() == 0)
+  {
+    // An empty buffer is remembered too, so that the user may send the same message again after clearing it.
+    last_enqueued_message = message;
+    xSemaphoreGive(mutex);
+    return;
+  }
+  xSemaphoreGive(mutex);
+  if (last_enqueue_failure_timestamp != 0 && millis() - last_enqueue_failure_timestamp < GP_BUTTON_ENQUEUE_RETRY_MS)
+  {
+    return;
+  }
+  // Determine the type of the message according to which OLED page the input came from.
+  int port = LORAWAN_PORT_MESSAGE;
+  if (oled_get_last_morse_input_page_num() == OLED_PAGE_TX_COMMAND)
+  {
+    port = LORAWAN_PORT_COMMAND;
+  }
+  ESP_LOGI(LOG_TAG, "going to transmit message/command \"%s\"", message.c_str());
+  bool is_enqueued = false;
+  // A compressed message is roughly half as long, which makes slower data rates feasible.
+  // Fall back to plain text if the message cannot be compressed into fewer bytes.
+  uint8_t compressed[LORAWAN_MAX_MESSAGE_LEN];
+  size_t len = 0;
+  if (port == LORAWAN_PORT_MESSAGE)
+  {
+    len = text_codec_encode(message.c_str(), compressed, min((size_t)message.length() - 1, sizeof(compressed)));
+  }
+  if (len > 0)
+  {
+    ESP_LOGI(LOG_TAG, "compressed the message from %d to %d bytes", message.length(), len);
+    is_enqueued = lorawan_enqueue_uplink(compressed, len, LORAWAN_PORT_MESSAGE_COMPACT, LORAWAN_PRIORITY_USER_MESSAGE, LORAWAN_USER_MESSAGE_TTL_SEC, LORAWAN_USER_MESSAGE_REPEATS);
+  }
+  else
+  {
+    is_enqueued = lorawan_enqueue_uplink((const uint8_t *)message.c_str(), message.length(), port, LORAWAN_PRIORITY_USER_MESSAGE, LORAWAN_USER_MESSAGE_TTL_SEC, LORAWAN_USER_MESSAGE_REPEATS);
+  }
+  if (!is_enqueued)
+  {
+    // Keep the message unsent, it is enqueued again once the queue has room.
+    last_enqueue_failure_timestamp = millis();
+    ESP_LOGW(LOG_TAG, "the transmission queue has no room for the message, retrying in %dms", GP_BUTTON_ENQUEUE_RETRY_MS);
+    return;
+  }
+  last_enqueue_failure_timestamp = 0;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  last_enqueued_message = message;
+  xSemaphoreGive(mutex);
+}
+
 void gp_button_task_loop(void *_)
 {
   while (true)
   {
     esp_task_wdt_reset();
     gp_button_read();
+    gp_button_enqueue_finished_message();
     vTaskDelay(pdMS_TO_TICKS(GP_BUTTON_TASK_LOOP_DELAY_MS));
   }
 }
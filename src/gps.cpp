@@ -4,14 +4,17 @@
 #include <esp_task_wdt.h>
 #include <SparkFun_u-blox_GNSS_Arduino_Library.h>
 #include "gps.h"
-#include "oled.h"
 #include "hardware_facts.h"
 #include "power_management.h"
+#include "snapshot.h"
 
 static const char LOG_TAG[] = __FILE__;
 
 static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
 static bool is_powered_on = false, is_initialised = false;
+// The GPS chip keeps the saved configuration in its battery backed memory, which is powered through deep sleep.
+// RTC memory survives software, panic, and watchdog resets as well, the flag is only trusted after deep sleep.
+RTC_DATA_ATTR static bool is_configuration_saved = false;
 static unsigned long num_decoded_bytes = 0;
 static HardwareSerial gps_serial(1);
 // gps interprets NMEA output.
@@ -25,6 +28,16 @@ static TinyGPSCustom gps_day_field(gps, "GPZDA", 2);
 static TinyGPSCustom gps_month_field(gps, "GPZDA", 3);
 static TinyGPSCustom gps_year_field(gps, "GPZDA", 4);
 
+// gps_record_t is the latest reading of the GPS task, taken at published_millis.
+typedef struct
+{
+    struct gps_data data;
+    unsigned long published_millis;
+} gps_record_t;
+
+// latest is written by the GPS task loop, other tasks read it from the snapshot while the task is decoding NMEA sentences.
+static Snapshot<gps_record_t> latest;
+
 void gps_on()
 {
     xSemaphoreTake(mutex, portMAX_DELAY);
@@ -36,7 +49,18 @@ void gps_on()
     if (!is_initialised)
     {
         gps_serial.begin(9600, SERIAL_8N1, GPS_SERIAL_TX, GPS_SERIAL_RX);
-        for (int i = 0; i < 30; i++)
+        if (esp_reset_reason() != ESP_RST_DEEPSLEEP)
+        {
+            // The reset may have interrupted the configuration, or come along with a power cut of the GPS.
+            is_configuration_saved = false;
+        }
+        if (is_configuration_saved)
+        {
+            // The query of begin goes unanswered while the GPS is still waking up from backup mode, do not wait for it.
+            ublox.begin(gps_serial, defaultMaxWait, true);
+            ESP_LOGI(LOG_TAG, "GPS retains the configuration saved before deep sleep");
+        }
+        for (int i = 0; i < 30 && !is_configuration_saved; i++)
         {
             if (ublox.begin(gps_serial))
             {
@@ -63,6 +87,7 @@ void gps_on()
                     ESP_LOGI(LOG_TAG, "save config: %d", save);
                     if (success)
                     {
+                        is_configuration_saved = true;
                         break;
                     }
                 }
@@ -97,17 +122,8 @@ void gps_off()
     xSemaphoreGive(mutex);
 }
 
-void gps_read_decode()
-{
-    while (gps_serial.available())
-    {
-        int b = gps_serial.read();
-        gps.encode(b);
-        ++num_decoded_bytes;
-    }
-}
-
-struct gps_data gps_get_data()
+// gps_read_data interprets the NMEA sentences decoded so far.
+struct gps_data gps_read_data()
 {
     struct gps_data ret;
     memset(&ret, 0, sizeof(ret));
@@ -147,6 +163,36 @@ struct gps_data gps_get_data()
         ret.heading_deg = gps.course.deg();
         ret.speed_kmh = gps.speed.kmph();
     }
+    return ret;
+}
+
+void gps_read_decode()
+{
+    while (gps_serial.available())
+    {
+        int b = gps_serial.read();
+        gps.encode(b);
+        ++num_decoded_bytes;
+    }
+    gps_record_t record;
+    record.data = gps_read_data();
+    record.published_millis = millis();
+    latest.publish(record);
+}
+
+struct gps_data gps_get_data()
+{
+    gps_record_t record = latest.read();
+    struct gps_data ret = record.data;
+    if (ret.valid_pos)
+    {
+        // The position keeps ageing while the GPS is turned off.
+        ret.pos_age_sec += (millis() - record.published_millis) / 1000;
+        if (ret.pos_age_sec > 600)
+        {
+            ret.pos_age_sec = 600;
+        }
+    }
     ESP_LOGI(LOG_TAG, "valid time? %d, valid position? %d, hdop %f", ret.valid_time, ret.valid_pos, ret.hdop);
     return ret;
 }
@@ -156,16 +202,23 @@ void gps_task_loop(void *_)
     while (true)
     {
         esp_task_wdt_reset();
-        if ((power_get_todo() & POWER_TODO_TURN_ON_GPS) || (oled_get_state() && oled_get_page_number() == OLED_PAGE_GPS_INFO))
+        if (power_get_todo() & POWER_TODO_TURN_ON_GPS)
         {
+            power_pm_lock(POWER_PM_LOCK_GPS_UART);
             gps_on();
+            vTaskDelay(pdMS_TO_TICKS(GPS_RECEPTION_WINDOW_MS));
             gps_read_decode();
+            power_pm_unlock(POWER_PM_LOCK_GPS_UART);
+            // The receiver keeps tracking the satellites on its own, the position only needs refreshing now and then.
+            vTaskDelay(pdMS_TO_TICKS(latest.read().data.valid_pos ? GPS_FIXED_TASK_LOOP_DELAY_MS : GPS_TASK_LOOP_DELAY_MS));
         }
         else
         {
+            power_pm_lock(POWER_PM_LOCK_GPS_UART);
             gps_off();
+            power_pm_unlock(POWER_PM_LOCK_GPS_UART);
+            power_wait_todo(POWER_TODO_TURN_ON_GPS, POWER_TODO_WAIT_TIMEOUT_MS);
         }
-        vTaskDelay(pdMS_TO_TICKS(GPS_TASK_LOOP_DELAY_MS));
     }
 }
 
@@ -0,0 +1,140 @@
+#include <Arduino.h>
+#include "i2c_bus.h"
+#include "power_management.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+static const char *device_names[I2C_BUS_NUM_DEVICES] = {"PMU", "env_sensor", "OLED"};
+
+// state_mutex protects the ownership of the bus, the waiting devices, and the statistics.
+static SemaphoreHandle_t state_mutex = xSemaphoreCreateMutex();
+// A device waits on its grant semaphore, which the device releasing the bus gives to hand the bus over.
+static SemaphoreHandle_t grants[I2C_BUS_NUM_DEVICES] = {xSemaphoreCreateCounting(UINT16_MAX, 0), xSemaphoreCreateCounting(UINT16_MAX, 0), xSemaphoreCreateCounting(UINT16_MAX, 0)};
+static bool is_busy = false;
+static int num_waiting[I2C_BUS_NUM_DEVICES];
+// waiting_priority is the highest priority among the tasks waiting for each device.
+static UBaseType_t waiting_priority[I2C_BUS_NUM_DEVICES];
+// The task holding the bus and its own priority, which it returns to when it releases the bus if it has been raised.
+// owner_task is NULL while the bus is being handed over.
+static TaskHandle_t owner_task = NULL;
+static UBaseType_t owner_base_priority = 0;
+static bool is_owner_raised = false;
+// The wait and the start of the hold of the device holding the bus.
+static uint32_t owner_wait_us = 0;
+static int64_t owner_hold_begin_us = 0;
+static i2c_bus_stats_t stats[I2C_BUS_NUM_DEVICES];
+
+// i2c_bus_become_owner records the calling task as the owner of the bus, and raises its priority to that of the highest
+// priority task still waiting. The caller must hold state_mutex.
+void i2c_bus_become_owner()
+{
+    owner_task = xTaskGetCurrentTaskHandle();
+    owner_base_priority = uxTaskPriorityGet(NULL);
+    is_owner_raised = false;
+    UBaseType_t priority = owner_base_priority;
+    for (int i = 0; i < I2C_BUS_NUM_DEVICES; ++i)
+    {
+        if (num_waiting[i] > 0 && waiting_priority[i] > priority)
+        {
+            priority = waiting_priority[i];
+        }
+    }
+    if (priority > owner_base_priority)
+    {
+        vTaskPrioritySet(NULL, priority);
+        is_owner_raised = true;
+    }
+}
+
+void i2c_bus_lock(int device)
+{
+    int64_t wait_begin_us = esp_timer_get_time();
+    xSemaphoreTake(state_mutex, portMAX_DELAY);
+    if (!is_busy)
+    {
+        is_busy = true;
+        i2c_bus_become_owner();
+        xSemaphoreGive(state_mutex);
+    }
+    else
+    {
+        ++num_waiting[device];
+        UBaseType_t priority = uxTaskPriorityGet(NULL);
+        if (priority > waiting_priority[device])
+        {
+            waiting_priority[device] = priority;
+        }
+        // Lend the priority to the owner. During a hand-over, the next owner picks it up in i2c_bus_become_owner.
+        if (owner_task != NULL && uxTaskPriorityGet(owner_task) < priority)
+        {
+            vTaskPrioritySet(owner_task, priority);
+            is_owner_raised = true;
+        }
+        xSemaphoreGive(state_mutex);
+        if (xSemaphoreTake(grants[device], pdMS_TO_TICKS(MUTEX_LOCK_TIMEOUT_MS)) == pdFALSE)
+        {
+            ESP_LOGE(LOG_TAG, "failed to obtain the I2C bus for %s", device_names[device]);
+            assert(false);
+        }
+        xSemaphoreTake(state_mutex, portMAX_DELAY);
+        i2c_bus_become_owner();
+        xSemaphoreGive(state_mutex);
+    }
+    power_pm_lock(POWER_PM_LOCK_I2C);
+    owner_hold_begin_us = esp_timer_get_time();
+    owner_wait_us = owner_hold_begin_us - wait_begin_us;
+}
+
+void i2c_bus_unlock(int device)
+{
+    uint32_t hold_us = esp_timer_get_time() - owner_hold_begin_us;
+    power_pm_unlock(POWER_PM_LOCK_I2C);
+    xSemaphoreTake(state_mutex, portMAX_DELAY);
+    i2c_bus_stats_t *s = &stats[device];
+    ++s->num_locks;
+    s->total_wait_us += owner_wait_us;
+    s->total_hold_us += hold_us;
+    s->max_wait_us = max(s->max_wait_us, owner_wait_us);
+    s->max_hold_us = max(s->max_hold_us, hold_us);
+    if (is_owner_raised)
+    {
+        vTaskPrioritySet(NULL, owner_base_priority);
+        is_owner_raised = false;
+    }
+    owner_task = NULL;
+    for (int next = 0; next < I2C_BUS_NUM_DEVICES; ++next)
+    {
+        if (num_waiting[next] > 0)
+        {
+            // The bus stays busy, it now belongs to the next device.
+            if (--num_waiting[next] == 0)
+            {
+                waiting_priority[next] = 0;
+            }
+            xSemaphoreGive(grants[next]);
+            xSemaphoreGive(state_mutex);
+            return;
+        }
+    }
+    is_busy = false;
+    xSemaphoreGive(state_mutex);
+}
+
+i2c_bus_stats_t i2c_bus_get_stats(int device)
+{
+    xSemaphoreTake(state_mutex, portMAX_DELAY);
+    i2c_bus_stats_t ret = stats[device];
+    xSemaphoreGive(state_mutex);
+    return ret;
+}
+
+void i2c_bus_log_stats()
+{
+    for (int i = 0; i < I2C_BUS_NUM_DEVICES; ++i)
+    {
+        i2c_bus_stats_t s = i2c_bus_get_stats(i);
+        unsigned long n = max(s.num_locks, 1UL);
+        ESP_LOGI(LOG_TAG, "%s: %lu locks, wait %lluus on average and %uus at most, hold %lluus on average and %uus at most",
+                 device_names[i], s.num_locks, s.total_wait_us / n, s.max_wait_us, s.total_hold_us / n, s.max_hold_us);
+    }
+}
@@ -0,0 +1,249 @@
+#include <Arduino.h>
+#include <time.h>
+#include <lmic.h>
+#include "link_adapt.h"
+#include "power_management.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// The settings and history are retained across soft resets and deep sleep, it takes hours to collect the samples.
+RTC_DATA_ATTR static int mode_id = 0;
+RTC_DATA_ATTR static int curr_dr = -1, curr_power_dbm = -1;
+// The RTC time keeps running during deep sleep and across soft resets.
+RTC_DATA_ATTR static bool has_probed = false;
+RTC_DATA_ATTR static uint32_t last_probe_sec = 0, probe_interval_sec = 0;
+RTC_DATA_ATTR static int consecutive_misses = 0;
+RTC_DATA_ATTR static float margins[LINK_ADAPT_MAX_DR + 1][LINK_ADAPT_HISTORY_LEN];
+RTC_DATA_ATTR static int num_margins[LINK_ADAPT_MAX_DR + 1];
+RTC_DATA_ATTR static int num_probes[LINK_ADAPT_MAX_DR + 1], num_responses[LINK_ADAPT_MAX_DR + 1];
+// samples_since_change counts the margin samples taken since the latest change of settings.
+RTC_DATA_ATTR static int samples_since_change = 0;
+static int last_rssi_dbm = 0;
+static float last_snr_db = 0, last_margin_db = 0;
+static const char *last_decision = "hold";
+
+int link_adapt_get_spreading_factor(int datarate)
+{
+    // In EU868, DR0 is SF12 and DR5 is SF7, all with 125kHz bandwidth.
+    if (datarate < 0 || datarate > LINK_ADAPT_MAX_DR)
+    {
+        return 7;
+    }
+    return 12 - datarate;
+}
+
+void link_adapt_reset()
+{
+    const power_config_t &config = power_get_config();
+    mode_id = config.mode_id;
+    curr_dr = config.spreading_factor;
+    curr_power_dbm = config.power_dbm;
+    consecutive_misses = 0;
+    samples_since_change = 0;
+    probe_interval_sec = LINK_ADAPT_MIN_PROBE_INTERVAL_SEC;
+    memset(num_margins, 0, sizeof(num_margins));
+    ESP_LOGI(LOG_TAG, "reset to power mode %d settings: DR%d %ddBm", mode_id, curr_dr, curr_power_dbm);
+}
+
+// link_adapt_check_mode resets the settings when the user has switched to another power mode.
+void link_adapt_check_mode()
+{
+    if (curr_dr < 0 || power_get_config().mode_id != mode_id)
+    {
+        link_adapt_reset();
+    }
+}
+
+int link_adapt_get_datarate()
+{
+    link_adapt_check_mode();
+    return curr_dr;
+}
+
+int link_adapt_get_power_dbm()
+{
+    link_adapt_check_mode();
+    return curr_power_dbm;
+}
+
+bool link_adapt_should_probe(bool is_confirmed)
+{
+    if (is_confirmed)
+    {
+        // The acknowledgement is the response, link_adapt_record_uplink books it as a probe.
+        return false;
+    }
+    uint32_t now_sec = (uint32_t)time(NULL);
+    if (has_probed && now_sec - last_probe_sec < probe_interval_sec)
+    {
+        return false;
+    }
+    has_probed = true;
+    last_probe_sec = now_sec;
+    probe_interval_sec = LINK_ADAPT_PROBE_INTERVAL_SEC;
+    return true;
+}
+
+// link_adapt_step_back moves one step towards the power mode's settings. Power goes up first, then data rate goes down.
+void link_adapt_step_back()
+{
+    const power_config_t &config = power_get_config();
+    if (curr_power_dbm < config.power_dbm)
+    {
+        curr_power_dbm += LINK_ADAPT_POWER_STEP_DB;
+        if (curr_power_dbm > config.power_dbm)
+        {
+            curr_power_dbm = config.power_dbm;
+        }
+        last_decision = "more power";
+    }
+    else if (curr_dr > config.spreading_factor)
+    {
+        curr_dr--;
+        last_decision = "slower DR";
+    }
+    else
+    {
+        last_decision = "hold";
+        return;
+    }
+    samples_since_change = 0;
+    probe_interval_sec = LINK_ADAPT_MIN_PROBE_INTERVAL_SEC;
+}
+
+void link_adapt_record_uplink(int datarate, bool expect_response, bool responded, int lmic_rssi, int lmic_snr, int gw_margin_db)
+{
+    link_adapt_check_mode();
+    if (datarate < 0 || datarate > LINK_ADAPT_MAX_DR)
+    {
+        return;
+    }
+    if (expect_response)
+    {
+        num_probes[datarate]++;
+        // An acknowledged confirmed uplink uses up the downlink budget just like a link check.
+        has_probed = true;
+        last_probe_sec = (uint32_t)time(NULL);
+    }
+    if (!responded)
+    {
+        if (!expect_response)
+        {
+            // Nothing was asked of the network, nothing is learnt.
+            return;
+        }
+        consecutive_misses++;
+        if (consecutive_misses >= LINK_ADAPT_MAX_MISSES)
+        {
+            ESP_LOGW(LOG_TAG, "%d consecutive uplinks went unanswered, returning to the power mode's settings", consecutive_misses);
+            link_adapt_reset();
+            last_decision = "back off";
+        }
+        else
+        {
+            link_adapt_step_back();
+            // Confirm the link as soon as the budget permits.
+            probe_interval_sec = LINK_ADAPT_MIN_PROBE_INTERVAL_SEC;
+            ESP_LOGW(LOG_TAG, "an uplink went unanswered, stepping back to DR%d %ddBm", curr_dr, curr_power_dbm);
+        }
+        return;
+    }
+
+    num_responses[datarate]++;
+    consecutive_misses = 0;
+    last_rssi_dbm = lmic_rssi - LINK_ADAPT_LMIC_RSSI_OFFSET;
+    // LMIC reads the SNR in steps of 0.25dB.
+    last_snr_db = lmic_snr / 4.0;
+    if (gw_margin_db < 0)
+    {
+        // An acknowledgement or an application downlink proves the link alive, but does not tell how well the gateway hears it.
+        return;
+    }
+    last_margin_db = gw_margin_db;
+    int slot = num_margins[datarate] % LINK_ADAPT_HISTORY_LEN;
+    margins[datarate][slot] = last_margin_db;
+    num_margins[datarate]++;
+    if (datarate != curr_dr)
+    {
+        // The uplink was transmitted with the settings in effect before the latest change.
+        return;
+    }
+    samples_since_change++;
+    ESP_LOGI(LOG_TAG, "downlink RSSI %ddBm SNR %.2fdB, gateway demodulation margin at DR%d %ddBm is %.0fdB", last_rssi_dbm, last_snr_db, datarate, curr_power_dbm, last_margin_db);
+
+    // Adapt according to the worst margin among the samples taken since the latest change.
+    int num_samples = min(samples_since_change, LINK_ADAPT_HISTORY_LEN);
+    if (num_samples < LINK_ADAPT_MIN_SAMPLES && last_margin_db >= LINK_ADAPT_TARGET_MARGIN_DB)
+    {
+        last_decision = "hold";
+        return;
+    }
+    float worst_margin = last_margin_db;
+    for (int i = 0; i < num_samples; ++i)
+    {
+        worst_margin = min(worst_margin, margins[datarate][(num_margins[datarate] - 1 - i) % LINK_ADAPT_HISTORY_LEN]);
+    }
+    float excess_db = worst_margin - LINK_ADAPT_TARGET_MARGIN_DB;
+    if (excess_db < 0)
+    {
+        link_adapt_step_back();
+    }
+    else if (curr_dr < LINK_ADAPT_MAX_DR && excess_db >= 2.5)
+    {
+        // Each step up in data rate lowers the demodulation margin by 2.5dB.
+        curr_dr++;
+        samples_since_change = 0;
+        probe_interval_sec = LINK_ADAPT_VERIFY_PROBE_INTERVAL_SEC;
+        last_decision = "faster DR";
+    }
+    else if (curr_power_dbm - LINK_ADAPT_POWER_STEP_DB >= LINK_ADAPT_MIN_POWER_DBM && excess_db >= LINK_ADAPT_POWER_STEP_DB)
+    {
+        curr_power_dbm -= LINK_ADAPT_POWER_STEP_DB;
+        samples_since_change = 0;
+        probe_interval_sec = LINK_ADAPT_VERIFY_PROBE_INTERVAL_SEC;
+        last_decision = "less power";
+    }
+    else
+    {
+        last_decision = "hold";
+    }
+    ESP_LOGI(LOG_TAG, "link adaptation decision: %s, next uplink uses DR%d %ddBm", last_decision, curr_dr, curr_power_dbm);
+}
+
+float link_adapt_get_margin_db()
+{
+    return last_margin_db;
+}
+
+int link_adapt_get_rssi_dbm()
+{
+    return last_rssi_dbm;
+}
+
+float link_adapt_get_snr_db()
+{
+    return last_snr_db;
+}
+
+const char *link_adapt_get_last_decision()
+{
+    return last_decision;
+}
+
+int link_adapt_get_num_responses(int datarate)
+{
+    if (datarate < 0 || datarate > LINK_ADAPT_MAX_DR)
+    {
+        return 0;
+    }
+    return num_responses[datarate];
+}
+
+int link_adapt_get_num_probes(int datarate)
+{
+    if (datarate < 0 || datarate > LINK_ADAPT_MAX_DR)
+    {
+        return 0;
+    }
+    return num_probes[datarate];
+}
@@ -4,17 +4,27 @@
 #include <rom/rtc.h>
 #include <lmic.h>
 #include <hal/hal.h>
-#include "data_packet.h"
+#include "airtime.h"
+#include "compact_frame.h"
+#include "downlink_frag.h"
+#include "energy_ledger.h"
 #include "env_sensor.h"
 #include "gp_button.h"
 #include "gps.h"
 #include "hardware_facts.h"
+#include "link_adapt.h"
 #include "lorawan.h"
 #include "wifi.h"
 #include "bluetooth.h"
 #include "lorawan_creds.h"
 #include "oled.h"
 #include "power_management.h"
+#include "rx_timing.h"
+#include "send_on_delta.h"
+#include "session_store.h"
+#include "snapshot.h"
+#include "spsc_queue.h"
+#include "ulp_wake.h"
 
 static const char LOG_TAG[] = __FILE__;
 
@@ -28,7 +38,60 @@ const lmic_pinmap lmic_pins = {
 
 static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
 static size_t total_tx_bytes = 0, total_rx_bytes = 0;
-static lorawan_message_buf_t next_tx_message, last_rx_message;
+static TaskHandle_t task_handle = NULL, event_task_handle = NULL;
+static unsigned long wakeups_since_last_uplink = 0, wakeups_last_uplink = 0, total_wakeups = 0;
+// last_rx_message is the working copy of the event task and next_tx_message is the working copy of the LoRaWAN task,
+// other tasks read the copies published to last_reception and transmission.
+static lorawan_message_buf_t last_rx_message;
+static lorawan_transmission_t next_tx_message;
+static Snapshot<lorawan_message_buf_t> last_reception;
+static Snapshot<lorawan_transmission_t> transmission;
+// link_check_requested is true if the uplink in flight carries a link check request.
+static bool link_check_requested = false;
+// next_tx_confirmed is true if the uplink in flight is a confirmed uplink, next_tx_delivery_id identifies its queue entry.
+static bool next_tx_confirmed = false;
+static unsigned long next_tx_delivery_id = 0, last_delivery_id = 0;
+// next_tx_header is the first byte of the payload of the uplink in flight.
+static uint8_t next_tx_header = 0;
+static lorawan_delivery_t last_delivery;
+// is_radio_awake is true while the radio power management lock is held for a transmission and its receive windows.
+static bool is_radio_awake = false;
+// boot_to_first_tx_ms holds the time from boot to the first transmission of the latest full boot (0) and fast boot (1).
+RTC_DATA_ATTR static unsigned long boot_to_first_tx_ms[2];
+static bool has_transmitted_since_boot = false;
+// lorawan_event_t is an LMIC event recorded by the LMIC callback, along with the LMIC states of the moment that the event
+// task needs to act upon it.
+typedef struct
+{
+  int event;
+  unsigned long timestamp_millis;
+  uint8_t txrx_flags;
+  int datarate, rssi, snr;
+  uint32_t freq;
+  // data_len is the size of the entire frame at EV_TXSTART, and the size of the downlink payload at EV_TXCOMPLETE.
+  size_t data_len;
+  // downlink_phy_len is the size of the entire downlink frame received in either RX window at EV_TXCOMPLETE, 0 if there was none.
+  size_t downlink_phy_len;
+  // has_downlink is true if the downlink payload was saved to the downlink queue.
+  bool has_downlink;
+  bool link_check_requested, confirmed;
+  // gw_margin_db is the demodulation margin at the gateway reported by the link check answer, or -1 if there was none.
+  int gw_margin_db;
+  unsigned long delivery_id;
+  int tx_port;
+  size_t tx_len;
+  // tx_header is the first byte of the uplink payload, e.g. the header of a compact frame.
+  uint8_t tx_header;
+} lorawan_event_t;
+
+// onEvent always runs with the mutex held, hence it is the only producer of both queues at any time.
+// The event task is their only consumer.
+static SpscQueue<lorawan_event_t, LORAWAN_EVENT_QUEUE_CAPACITY> events;
+static SpscQueue<lorawan_message_buf_t, LORAWAN_DOWNLINK_QUEUE_CAPACITY> downlinks;
+static lorawan_callback_stats_t callback_stats;
+// queue is a ring buffer of uplink messages in the order they were enqueued, the oldest message is at queue_head.
+static lorawan_queue_entry_t queue[LORAWAN_QUEUE_CAPACITY];
+static size_t queue_head = 0, queue_len = 0;
 
 // os_getArtEui is referenced by "engineUpdate" symbol defined by the "MCCI LoRaWAN LMIC" library.
 void os_getArtEui(u1_t *buf) {}
@@ -67,64 +130,291 @@ void lorawan_handle_message(uint8_t message)
     ESP_LOGI(LOG_TAG, "idling before upcoming TX/RX");
     break;
   case LORAWAN_EV_QUEUED_FOR_TX:
-    ESP_LOGI(LOG_TAG, "queued a %d bytes message for transmission", next_tx_message.len);
+    ESP_LOGI(LOG_TAG, "queued a %d bytes message for transmission", transmission.read().len);
     break;
   case EV_TXCOMPLETE:
-    ESP_LOGI(LOG_TAG, "transmitted a %d bytes message", next_tx_message.len);
+    ESP_LOGI(LOG_TAG, "transmitted a %d bytes message", transmission.read().len);
     break;
   case EV_RXCOMPLETE:
     ESP_LOGI(LOG_TAG, "received a message");
     break;
-  case LORAWAN_EV_RESPONSE:
-    // I've managed to receive a downlink message 41 bytes long maximum.
-    ESP_LOGI(LOG_TAG, "received a %d bytes downlink message", LMIC.dataLen);
-    total_rx_bytes += LMIC.dataLen;
-    size_t data_len = LMIC.dataLen;
-    if (data_len > 0)
-    {
-      if (data_len > LORAWAN_MAX_MESSAGE_LEN)
-      {
-        data_len = LORAWAN_MAX_MESSAGE_LEN;
-      }
-      for (uint8_t i = 0; i < data_len; i++)
-      {
-        last_rx_message.buf[i] = LMIC.frame[LMIC.dataBeg + i];
-      }
-      last_rx_message.len = data_len;
-      last_rx_message.buf[last_rx_message.len] = 0;
-      last_rx_message.timestamp_millis = millis();
-    }
-    break;
   }
 }
 
+// lorawan_settle_confirmed_uplink removes the confirmed uplink in flight from the queue once it is acknowledged or out of
+// retransmissions, or else holds it back before the next attempt. The caller must hold the mutex.
+void lorawan_settle_confirmed_uplink(unsigned long delivery_id, bool acknowledged, int datarate);
+
+// lorawan_save_downlink copies the downlink payload out of LMIC's frame buffer before the next uplink reuses it.
+// It returns false if the downlink queue is full.
+bool lorawan_save_downlink()
+{
+  lorawan_message_buf_t downlink;
+  downlink.len = min((size_t)LMIC.dataLen, LORAWAN_MAX_MESSAGE_LEN);
+  memcpy(downlink.buf, &LMIC.frame[LMIC.dataBeg], downlink.len);
+  downlink.buf[downlink.len] = 0;
+  downlink.timestamp_millis = millis();
+  downlink.port = (LMIC.txrxFlags & TXRX_PORT) ? LMIC.frame[LMIC.dataBeg - 1] : 0;
+  return downlinks.push(downlink);
+}
+
+// lorawan_keep_radio_awake takes or releases the radio power management lock. The chip must not enter light sleep in
+// between the start of a transmission and the end of its receive windows, or it would miss the DIO interrupts and the
+// SPI clock would slow down.
+void lorawan_keep_radio_awake(bool awake)
+{
+  if (awake == is_radio_awake)
+  {
+    return;
+  }
+  if (awake)
+  {
+    power_pm_lock(POWER_PM_LOCK_RADIO);
+  }
+  else
+  {
+    power_pm_unlock(POWER_PM_LOCK_RADIO);
+  }
+  is_radio_awake = awake;
+}
+
 // onEvent is referenced by MCCI LMIC library.
+// It runs in the middle of the LMIC run loop, where a slow callback delays the jobs that open the RX windows. Hence it only
+// does the bookkeeping that cannot wait, and leaves everything else (logging included) to the event task.
 void onEvent(ev_t event)
 {
+  int64_t start_us = esp_timer_get_time();
+  lorawan_event_t record;
+  memset(&record, 0, sizeof(record));
+  record.event = event;
+  record.timestamp_millis = millis();
+  record.txrx_flags = LMIC.txrxFlags;
+  record.datarate = LMIC.datarate;
+  record.rssi = LMIC.rssi;
+  record.snr = LMIC.snr;
+  record.freq = LMIC.freq;
+  record.data_len = LMIC.dataLen;
+  record.confirmed = next_tx_confirmed;
+  record.delivery_id = next_tx_delivery_id;
+  record.tx_port = next_tx_message.port;
+  record.tx_len = next_tx_message.len;
+  record.tx_header = next_tx_header;
   switch (event)
   {
   case EV_TXCOMPLETE:
-    next_tx_message.timestamp_millis = millis();
-    ESP_LOGI(LOG_TAG, "finished transmitting message %d bytes long, tx counter is now %d", next_tx_message.len, power_get_lorawan_tx_counter());
-    if (LMIC.txrxFlags & TXRX_ACK)
+    lorawan_keep_radio_awake(false);
+    next_tx_message.timestamp_millis = record.timestamp_millis;
+    transmission.publish(next_tx_message);
+    record.link_check_requested = link_check_requested;
+    record.gw_margin_db = link_check_requested && LMIC.gwCnt > 0 ? LMIC.gwMargin : -1;
+    link_check_requested = false;
+    if (LMIC.txrxFlags & (TXRX_DNW1 | TXRX_DNW2))
+    {
+      // The payload follows the MAC header, frame header, and port, the 4 bytes of MIC follow the payload.
+      record.downlink_phy_len = LMIC.dataBeg + LMIC.dataLen + 4;
+    }
+    if (LMIC.dataLen > 0)
+    {
+      record.has_downlink = lorawan_save_downlink();
+    }
+    break;
+  case EV_TXSTART:
+    lorawan_keep_radio_awake(true);
+    rx_timing_begin_uplink();
+    if (next_tx_confirmed)
+    {
+      // Left alone, LMIC retransmits an unacknowledged confirmed uplink up to TXCONF_ATTEMPTS times in quick succession
+      // while lowering the data rate. Claim the attempts used up so that the queue decides when to retransmit instead.
+      LMIC.txCnt = TXCONF_ATTEMPTS;
+    }
+    break;
+  case EV_TXCANCELED:
+    lorawan_keep_radio_awake(false);
+    break;
+  default:
+    break;
+  }
+  if (!events.push(record))
+  {
+    ++callback_stats.num_dropped;
+  }
+  if (event_task_handle != NULL)
+  {
+    xTaskNotifyGive(event_task_handle);
+  }
+  unsigned long elapsed_us = esp_timer_get_time() - start_us;
+  ++callback_stats.num_events;
+  callback_stats.last_us = elapsed_us;
+  callback_stats.total_us += elapsed_us;
+  if (elapsed_us > callback_stats.max_us)
+  {
+    callback_stats.max_us = elapsed_us;
+  }
+}
+
+// lorawan_receive_downlink takes the downlink payload saved by the LMIC callback and makes it the last reception, or
+// hands it to the reassembly of a fragmented message.
+void lorawan_receive_downlink()
+{
+  lorawan_message_buf_t downlink;
+  if (!downlinks.pop(&downlink))
+  {
+    return;
+  }
+  // I've managed to receive a downlink message 41 bytes long maximum.
+  ESP_LOGI(LOG_TAG, "received a %d bytes downlink message on port %d", downlink.len, downlink.port);
+  total_rx_bytes += downlink.len;
+  if (downlink.port == LORAWAN_PORT_FRAGMENT)
+  {
+    uint8_t frag_report[DOWNLINK_FRAG_REPORT_LEN];
+    int frag_status = downlink_frag_receive(downlink.buf, downlink.len, frag_report, &last_rx_message);
+    if (frag_status != DOWNLINK_FRAG_MALFORMED)
+    {
+      // Tell the sender which fragments are still missing in the next uplink.
+      lorawan_enqueue_uplink(frag_report, sizeof(frag_report), LORAWAN_PORT_FRAGMENT_REPORT, LORAWAN_PRIORITY_CONTROL, DOWNLINK_FRAG_TIMEOUT_SEC, 0);
+    }
+    if (frag_status == DOWNLINK_FRAG_COMPLETE)
+    {
+      last_reception.publish(last_rx_message);
+    }
+    return;
+  }
+  last_rx_message = downlink;
+  last_reception.publish(last_rx_message);
+}
+
+// lorawan_process_event acts upon an LMIC event recorded by the LMIC callback.
+void lorawan_process_event(const lorawan_event_t *record)
+{
+  bool acknowledged = record->txrx_flags & TXRX_ACK;
+  switch (record->event)
+  {
+  case EV_TXCOMPLETE:
+    ESP_LOGI(LOG_TAG, "finished transmitting message %d bytes long, tx counter is now %d", record->tx_len, power_get_lorawan_tx_counter());
+    if (acknowledged)
     {
       ESP_LOGI(LOG_TAG, "received an acknowledgement of my transmitted message");
       lorawan_handle_message(LORAWAN_EV_ACK);
     }
-    if (LMIC.dataLen > 0)
+    if (record->data_len > 0)
     {
       ESP_LOGI(LOG_TAG, "received a downlink message");
-      lorawan_handle_message(LORAWAN_EV_RESPONSE);
+      if (record->has_downlink)
+      {
+        lorawan_receive_downlink();
+      }
+      else
+      {
+        ESP_LOGW(LOG_TAG, "discarded the downlink message, the downlink queue is full");
+      }
+    }
+    if (acknowledged || (record->txrx_flags & (TXRX_DNW1 | TXRX_DNW2)))
+    {
+      // A downlink in either RX window, be it an acknowledgement, an application message, or the answer to the link check
+      // carried by the uplink, proves that the network has received the uplink. Compact frames may now be encoded
+      // relative to it.
+      if (record->tx_port == LORAWAN_PORT_STATUS_SENSOR_COMPACT)
+      {
+        compact_frame_acknowledge(COMPACT_FRAME_STATUS, record->tx_header);
+      }
+      else if (record->tx_port == LORAWAN_PORT_GPS_WIFI_COMPACT)
+      {
+        compact_frame_acknowledge(COMPACT_FRAME_POS, record->tx_header);
+      }
     }
+    // The queue, link adaptation, and LMIC session are shared with the LoRaWAN task.
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (record->confirmed)
+    {
+      lorawan_settle_confirmed_uplink(record->delivery_id, acknowledged, record->datarate);
+    }
+    link_adapt_record_uplink(record->datarate, record->link_check_requested, record->txrx_flags & (TXRX_DNW1 | TXRX_DNW2), record->rssi, record->snr, record->gw_margin_db);
+    session_store_checkpoint();
+    xSemaphoreGive(mutex);
+    rx_timing_end_uplink(record->confirmed || record->link_check_requested, record->downlink_phy_len);
+    ESP_LOGI(LOG_TAG, "LMIC callback took %luus, %luus at most and %lluus on average over %lu events, %lu events dropped",
+             callback_stats.last_us, callback_stats.max_us, callback_stats.total_us / max(callback_stats.num_events, 1UL), callback_stats.num_events, callback_stats.num_dropped);
     break;
   case EV_TXSTART:
-    ESP_LOGI(LOG_TAG, "start transmitting a %d bytes message", next_tx_message.len);
+    ESP_LOGI(LOG_TAG, "start transmitting a %d bytes message", record->tx_len);
+    if (!has_transmitted_since_boot)
+    {
+      has_transmitted_since_boot = true;
+      bool is_fast_boot = ulp_wake_is_fast_boot();
+      boot_to_first_tx_ms[is_fast_boot] = record->timestamp_millis;
+      ESP_LOGI(LOG_TAG, "boot to first transmission took %lums after wake-up by %s, latest full boot took %lums and fast boot %lums",
+               record->timestamp_millis, ulp_wake_get_reason_name(ulp_wake_get_reason()), boot_to_first_tx_ms[0], boot_to_first_tx_ms[1]);
+    }
+    // LMIC.dataLen is the size of the entire frame under transmission.
+    airtime_record_tx(record->freq, record->datarate, record->data_len);
+    break;
+  case EV_JOINING:
+  case EV_JOINED:
+  case EV_JOIN_FAILED:
+  case EV_REJOIN_FAILED:
+  case EV_JOIN_TXCOMPLETE:
+  case EV_RESET:
+  case EV_LINK_DEAD:
+  case EV_LINK_ALIVE:
+  case EV_RXSTART:
+  case EV_RXCOMPLETE:
+  case EV_TXCANCELED:
+  case EV_SCAN_TIMEOUT:
+  case EV_SCAN_FOUND:
+  case EV_BEACON_FOUND:
+  case EV_BEACON_MISSED:
+  case EV_BEACON_TRACKED:
+  case EV_LOST_TSYNC:
+    // These events need nothing more than the log message of lorawan_handle_message, if any.
     break;
   default:
-    ESP_LOGI(LOG_TAG, "ignored unrecognised event %d", event);
+    ESP_LOGD(LOG_TAG, "no action for event %d", record->event);
     break;
   }
-  lorawan_handle_message(event);
+  lorawan_handle_message(record->event);
+}
+
+void lorawan_event_task_loop(void *_)
+{
+  event_task_handle = xTaskGetCurrentTaskHandle();
+  while (true)
+  {
+    esp_task_wdt_reset();
+    lorawan_event_t record;
+    while (events.pop(&record))
+    {
+      lorawan_process_event(&record);
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(LORAWAN_EVENT_TASK_LOOP_DELAY_MS));
+  }
+}
+
+// lorawan_wake_from_isr wakes up the task loop as soon as the radio signals TX done, RX done, or RX timeout.
+void IRAM_ATTR lorawan_wake_from_isr()
+{
+  if (task_handle != NULL)
+  {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    vTaskNotifyGiveFromISR(task_handle, &higher_priority_task_woken);
+    if (higher_priority_task_woken)
+    {
+      portYIELD_FROM_ISR();
+    }
+  }
+}
+
+// lorawan_dio0_isr handles TX done and RX done.
+void IRAM_ATTR lorawan_dio0_isr()
+{
+  rx_timing_record_dio(0);
+  lorawan_wake_from_isr();
+}
+
+// lorawan_dio1_isr handles RX timeout.
+void IRAM_ATTR lorawan_dio1_isr()
+{
+  rx_timing_record_dio(1);
+  lorawan_wake_from_isr();
 }
 
 void lorawan_setup()
@@ -135,6 +425,9 @@ void lorawan_setup()
   // Initialise the library's internal states.
   os_init();
   lorawan_reset();
+  // The library polls the DIO pins in its run loop, these interrupts merely wake the task loop up to run it.
+  attachInterrupt(LORA_DIO0_GPIO, lorawan_dio0_isr, RISING);
+  attachInterrupt(LORA_DIO1_GPIO, lorawan_dio1_isr, RISING);
   ESP_LOGI(LOG_TAG, "lorawan is ready");
 }
 
@@ -144,6 +437,8 @@ void lorawan_reset()
   LMIC_shutdown();
   LMIC_clrTxData();
   LMIC_reset();
+  // The transmission in flight, if any, is abandoned.
+  lorawan_keep_radio_awake(false);
 
   // Prepare network keys for the library to use. They are defined in #include "lorawan_creds.h":
   // static const u1_t PROGMEM NWKSKEY[16] = {0x00, 0x00, ...};
@@ -172,10 +467,14 @@ void lorawan_reset()
 
   // Do not ask gateways for a downlink message to check the connectivity.
   LMIC_setLinkCheckMode(0);
-  // Do not lower transmission power automatically. According to The Things Network this feature is tricky to use.
+  // Do not let the network adjust data rate and transmission power. According to The Things Network this feature is tricky
+  // to use, link_adapt.cpp adapts them locally instead.
   LMIC_setAdrMode(0);
   // Open up the RX window earlier ("clock error to compensate for").
-  LMIC_setClockError(MAX_CLOCK_ERROR * 12 / 100);
+  LMIC_setClockError(MAX_CLOCK_ERROR * LORAWAN_CLOCK_ERROR_PCT / 100);
+
+  // Continue with the frame counters and channels of the session before restart, the network rejects a reused frame counter.
+  session_store_restore(DEVADDR);
 
   // The transmitter is activated by personalisation (i.e. static keys), so it has already "joined" the network.
   lorawan_handle_message(EV_JOINED);
@@ -184,27 +483,323 @@ void lorawan_reset()
   ESP_LOGI(LOG_TAG, "finished resetting LoRaWAN");
 }
 
-void lorawan_set_next_transmission(uint8_t *buf, size_t len, int port)
+lorawan_queue_entry_t *lorawan_queue_at(size_t i)
+{
+  return &queue[(queue_head + i) % LORAWAN_QUEUE_CAPACITY];
+}
+
+// lorawan_queue_remove removes the i-th oldest message from the queue. The caller must hold the mutex.
+void lorawan_queue_remove(size_t i)
+{
+  for (size_t j = i; j + 1 < queue_len; ++j)
+  {
+    *lorawan_queue_at(j) = *lorawan_queue_at(j + 1);
+  }
+  --queue_len;
+}
+
+// lorawan_queue_find returns the position of the message in the queue, or -1 if it is no longer there. The caller must hold the mutex.
+int lorawan_queue_find(unsigned long delivery_id)
+{
+  for (size_t i = 0; i < queue_len; ++i)
+  {
+    if (lorawan_queue_at(i)->delivery_id == delivery_id)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+// lorawan_update_delivery records the delivery status of a user message. The caller must hold the mutex.
+void lorawan_update_delivery(const lorawan_queue_entry_t *entry, int status)
+{
+  if (!entry->confirmed || entry->delivery_id != last_delivery.delivery_id)
+  {
+    // Only the latest user message is on display.
+    return;
+  }
+  last_delivery.status = status;
+  last_delivery.attempts = entry->attempts;
+  last_delivery.status_millis = millis();
+}
+
+// lorawan_queue_drop removes the i-th oldest message from the queue without having it delivered. The caller must hold the mutex.
+void lorawan_queue_drop(size_t i)
+{
+  lorawan_queue_entry_t *entry = lorawan_queue_at(i);
+  if (entry->confirmed)
+  {
+    ESP_LOGW(LOG_TAG, "failed to deliver message %lu for port %d after %d attempts", entry->delivery_id, entry->message.port, entry->attempts);
+    lorawan_update_delivery(entry, LORAWAN_DELIVERY_FAILED);
+  }
+  lorawan_queue_remove(i);
+}
+
+void lorawan_settle_confirmed_uplink(unsigned long delivery_id, bool acknowledged, int datarate)
+{
+  int i = lorawan_queue_find(delivery_id);
+  if (i == -1)
+  {
+    return;
+  }
+  lorawan_queue_entry_t *entry = lorawan_queue_at(i);
+  if (acknowledged)
+  {
+    ESP_LOGI(LOG_TAG, "delivered message %lu for port %d after %d attempts", entry->delivery_id, entry->message.port, entry->attempts);
+    lorawan_update_delivery(entry, LORAWAN_DELIVERY_DELIVERED);
+    lorawan_queue_remove(i);
+    return;
+  }
+  if (entry->retries_left == 0)
+  {
+    lorawan_queue_drop(i);
+    return;
+  }
+  --entry->retries_left;
+  unsigned long backoff_ms = min(LORAWAN_CONFIRMED_BACKOFF_SEC << min(entry->attempts - 1, 8), LORAWAN_CONFIRMED_MAX_BACKOFF_SEC) * 1000UL;
+  // Observe the 1% duty cycle of the sub-band, which requires the transmitter to stay silent for 99 times the airtime.
+  backoff_ms = max(backoff_ms, airtime_get_uplink_toa_ms(datarate, entry->message.len) * 99UL);
+  entry->not_before_millis = millis() + backoff_ms;
+  lorawan_update_delivery(entry, LORAWAN_DELIVERY_PENDING);
+  ESP_LOGW(LOG_TAG, "message %lu for port %d is unacknowledged after %d attempts, retransmitting in %lums", entry->delivery_id, entry->message.port, entry->attempts, backoff_ms);
+}
+
+uint8_t *lorawan_begin_uplink(int port, int priority, int ttl_sec, int retries)
 {
   xSemaphoreTake(mutex, portMAX_DELAY);
+  if (priority == LORAWAN_PRIORITY_TELEMETRY || priority == LORAWAN_PRIORITY_CONTROL)
+  {
+    // The latest telemetry readings and control messages supersede the ones that have not been transmitted yet.
+    for (size_t i = 0; i < queue_len; ++i)
+    {
+      if (lorawan_queue_at(i)->priority == priority && lorawan_queue_at(i)->message.port == port)
+      {
+        lorawan_queue_drop(i);
+        break;
+      }
+    }
+  }
+  if (queue_len == LORAWAN_QUEUE_CAPACITY)
+  {
+    // Make room by discarding the oldest message of the lowest priority, as long as it is not more important than the new one.
+    size_t victim = 0;
+    for (size_t i = 1; i < queue_len; ++i)
+    {
+      if (lorawan_queue_at(i)->priority < lorawan_queue_at(victim)->priority)
+      {
+        victim = i;
+      }
+    }
+    if (lorawan_queue_at(victim)->priority > priority)
+    {
+      xSemaphoreGive(mutex);
+      ESP_LOGW(LOG_TAG, "the transmission queue is full, discarding a message for port %d", port);
+      return NULL;
+    }
+    ESP_LOGW(LOG_TAG, "the transmission queue is full, discarding a queued message for port %d", lorawan_queue_at(victim)->message.port);
+    lorawan_queue_drop(victim);
+  }
+  // The slot past the end of the queue is claimed, it joins the queue once committed.
+  lorawan_queue_entry_t *entry = lorawan_queue_at(queue_len);
+  entry->message.port = port;
+  entry->priority = priority;
+  entry->expiry_millis = millis() + ttl_sec * 1000;
+  entry->retries_left = retries;
+  entry->confirmed = priority == LORAWAN_PRIORITY_USER_MESSAGE;
+  entry->attempts = 0;
+  return entry->message.buf;
+}
+
+void lorawan_commit_uplink(size_t len)
+{
   if (len > LORAWAN_MAX_MESSAGE_LEN)
   {
     len = LORAWAN_MAX_MESSAGE_LEN;
   }
-  memcpy(next_tx_message.buf, buf, len);
-  next_tx_message.len = len;
-  next_tx_message.port = port;
+  lorawan_queue_entry_t *entry = lorawan_queue_at(queue_len);
+  entry->message.buf[len] = 0;
+  entry->message.len = len;
+  entry->message.timestamp_millis = millis();
+  entry->not_before_millis = millis();
+  entry->delivery_id = ++last_delivery_id;
+  if (entry->confirmed)
+  {
+    last_delivery.delivery_id = entry->delivery_id;
+    last_delivery.port = entry->message.port;
+    last_delivery.len = len;
+    lorawan_update_delivery(entry, LORAWAN_DELIVERY_PENDING);
+  }
+  ++queue_len;
+  xSemaphoreGive(mutex);
+  ESP_LOGI(LOG_TAG, "enqueued a %d bytes message for port %d with priority %d, queue length is now %d", len, entry->message.port, entry->priority, queue_len);
+  if (task_handle != NULL)
+  {
+    xTaskNotifyGive(task_handle);
+  }
+}
+
+void lorawan_abort_uplink()
+{
+  xSemaphoreGive(mutex);
+}
+
+bool lorawan_enqueue_uplink(const uint8_t *buf, size_t len, int port, int priority, int ttl_sec, int retries)
+{
+  uint8_t *frame = lorawan_begin_uplink(port, priority, ttl_sec, retries);
+  if (frame == NULL)
+  {
+    return false;
+  }
+  if (len > LORAWAN_MAX_MESSAGE_LEN)
+  {
+    len = LORAWAN_MAX_MESSAGE_LEN;
+  }
+  if (len > 0)
+  {
+    memcpy(frame, buf, len);
+  }
+  lorawan_commit_uplink(len);
+  return true;
+}
+
+// lorawan_dequeue_uplink hands the next message to be transmitted straight from the queue over to LMIC, which copies it
+// into its own frame buffer, and stores the result of LMIC_setTxData2_strict in err.
+// It returns false if there is no message that fits into the current data rate and the remaining airtime budget.
+// The messages that do not fit, and the unacknowledged messages waiting to be transmitted again, remain in the queue until they expire.
+// An attempt only counts once LMIC has accepted the message, a message refused by LMIC remains in the queue untouched.
+bool lorawan_dequeue_uplink(lmic_tx_error_t *err)
+{
+  int max_len = min((int)lorawan_get_max_payload_len(), airtime_get_max_payload_len(LMIC.datarate, lorawan_get_airtime_budget_ms()));
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  // Discard the expired messages first.
+  for (size_t i = 0; i < queue_len;)
+  {
+    if ((long)(millis() - lorawan_queue_at(i)->expiry_millis) >= 0)
+    {
+      ESP_LOGI(LOG_TAG, "discarding an expired message for port %d", lorawan_queue_at(i)->message.port);
+      lorawan_queue_drop(i);
+      continue;
+    }
+    ++i;
+  }
+  int chosen = -1;
+  for (size_t i = 0; i < queue_len; ++i)
+  {
+    lorawan_queue_entry_t *entry = lorawan_queue_at(i);
+    bool is_held_back = (long)(millis() - entry->not_before_millis) < 0;
+    if (!is_held_back && (int)entry->message.len <= max_len && (chosen == -1 || entry->priority > lorawan_queue_at(chosen)->priority))
+    {
+      chosen = i;
+    }
+  }
+  if (chosen == -1)
+  {
+    xSemaphoreGive(mutex);
+    return false;
+  }
+  lorawan_queue_entry_t *entry = lorawan_queue_at(chosen);
+  // Ask for a link check every now and then, the response tells the link margin for adapting data rate and power.
+  // LMIC keeps the request pending until an uplink carries it, even if this one fails to start.
+  if (link_adapt_should_probe(entry->confirmed))
+  {
+    link_check_requested = true;
+    // LMIC leaves the gateway count of the previous answer in place, it tells whether this request gets an answer.
+    LMIC.gwCnt = 0;
+    LMIC_setLinkCheckRequestOnce(1);
+  }
+  *err = LMIC_setTxData2_strict(entry->message.port, entry->message.buf, entry->message.len, entry->confirmed);
+  if (*err != LMIC_ERROR_SUCCESS)
+  {
+    // The message was not handed over, e.g. LMIC is busy or the message is too large, it stays in the queue as it is.
+    xSemaphoreGive(mutex);
+    return true;
+  }
+  next_tx_message.len = entry->message.len;
+  next_tx_message.port = entry->message.port;
+  next_tx_message.timestamp_millis = entry->message.timestamp_millis;
+  transmission.publish(next_tx_message);
+  next_tx_confirmed = entry->confirmed;
+  next_tx_delivery_id = entry->delivery_id;
+  next_tx_header = entry->message.len > 0 ? entry->message.buf[0] : 0;
+  if (entry->message.port == LORAWAN_PORT_SENSOR_SERIES)
+  {
+    // The series entry supersedes its predecessor in the queue, hence it carries the latest encoded series.
+    env_sensor_release_series();
+  }
+  ++entry->attempts;
+  if (entry->confirmed)
+  {
+    // The message stays in the queue until it is acknowledged. Hold it back until the outcome of this attempt is known.
+    entry->not_before_millis = millis() + LORAWAN_CONFIRMED_BACKOFF_SEC * 1000;
+    lorawan_update_delivery(entry, LORAWAN_DELIVERY_PENDING);
+  }
+  else if (entry->retries_left > 0)
+  {
+    --entry->retries_left;
+  }
+  else
+  {
+    lorawan_queue_remove(chosen);
+  }
   xSemaphoreGive(mutex);
+  return true;
+}
+
+size_t lorawan_get_queue_len()
+{
+  return queue_len;
+}
+
+size_t lorawan_get_max_payload_len()
+{
+  // The maximum application payload size "N" of EU863-870 in LoRaWAN Regional Parameters, assuming no MAC commands in FOpts.
+  switch (LMIC.datarate)
+  {
+  case DR_SF12:
+  case DR_SF11:
+  case DR_SF10:
+    return 51;
+  case DR_SF9:
+    return 115;
+  default:
+    return 222;
+  }
+}
+
+int lorawan_get_airtime_budget_ms()
+{
+  int budget_ms = airtime_get_fair_use_remaining_ms();
+  // LMIC picks the channel of the next uplink at random, hence the budget is that of the most exhausted sub-band in use.
+  for (size_t chan = 0; chan < MAX_CHANNELS; ++chan)
+  {
+    if ((LMIC.channelMap & (1 << chan)) && LMIC.channelFreq[chan] != 0)
+    {
+      // The lowest bits of an EU868 channel frequency carry LMIC's band index.
+      budget_ms = min(budget_ms, airtime_get_duty_cycle_remaining_ms(LMIC.channelFreq[chan] & ~(u4_t)3));
+    }
+  }
+  return budget_ms;
+}
+
+lorawan_delivery_t lorawan_get_last_delivery()
+{
+  return last_delivery;
 }
 
 lorawan_message_buf_t lorawan_get_last_reception()
 {
-  return last_rx_message;
+  return last_reception.read();
 }
 
-lorawan_message_buf_t lorawan_get_transmission()
+lorawan_transmission_t lorawan_get_transmission()
 {
-  return next_tx_message;
+  return transmission.read();
+}
+
+lorawan_callback_stats_t lorawan_get_callback_stats()
+{
+  return callback_stats;
 }
 
 size_t lorawan_get_total_tx_bytes()
@@ -217,145 +812,185 @@ size_t lorawan_get_total_rx_bytes()
   return total_rx_bytes;
 }
 
+// lorawan_enqueue_keepalive gives the network an opportunity to send a downlink message when there is nothing else to
+// transmit, as long as no uplink has been transmitted for SEND_ON_DELTA_KEEPALIVE_SEC.
+void lorawan_enqueue_keepalive()
+{
+  if (lorawan_get_queue_len() > 0)
+  {
+    return;
+  }
+  lorawan_transmission_t last_transmission = lorawan_get_transmission();
+  // The sender of a fragmented downlink message is waiting for the uplinks to send the remaining fragments.
+  bool is_due = last_transmission.timestamp_millis == 0 || downlink_frag_get_num_pending() > 0 ||
+                millis() - last_transmission.timestamp_millis >= SEND_ON_DELTA_KEEPALIVE_SEC * 1000;
+  if (!is_due)
+  {
+    return;
+  }
+  uint8_t num_suppressed = min(send_on_delta_take_num_suppressed(), 255);
+  lorawan_enqueue_uplink(&num_suppressed, 1, LORAWAN_PORT_KEEPALIVE, LORAWAN_PRIORITY_IDLE, LORAWAN_TELEMETRY_TTL_SEC, 0);
+  ESP_LOGI(LOG_TAG, "going to transmit a keepalive after %d suppressed frames", num_suppressed);
+}
+
 void lorawan_prepare_uplink_transmission()
 {
-  DataPacket pkt(LORAWAN_MAX_MESSAGE_LEN);
   int message_kind = power_get_lorawan_tx_counter() % LORAWAN_TX_KINDS;
-  if (message_kind == LORAWAN_TX_KIND_ENV)
+  if (message_kind == LORAWAN_TX_KIND_ENV && env_sensor_get_num_samples() >= ENV_SENSOR_SERIES_MIN_BATCH)
+  {
+    // Transmit a batch of samples in a single uplink, which saves the frame overhead and radio wake-ups of many status frames.
+    // The frames are serialised in place into the transmission queue, from where LMIC copies them for transmission.
+    uint8_t *frame = lorawan_begin_uplink(LORAWAN_PORT_SENSOR_SERIES, LORAWAN_PRIORITY_TELEMETRY, LORAWAN_TELEMETRY_TTL_SEC, 0);
+    if (frame == NULL)
+    {
+      return;
+    }
+    size_t len = env_sensor_encode_series(frame, lorawan_get_max_payload_len());
+    if (len == 0)
+    {
+      lorawan_abort_uplink();
+      return;
+    }
+    lorawan_commit_uplink(len);
+    ESP_LOGI(LOG_TAG, "going to transmit a series of sensor samples in %d bytes", len);
+  }
+  else if (message_kind == LORAWAN_TX_KIND_ENV)
   {
-    // Byte 0, 1 - number of seconds since the reception of last downlink message (0 - 65535).
+    // See compact_frame.cpp for the width and resolution of each field.
+    double fields[COMPACT_STATUS_NUM_FIELDS] = {0};
+    // Number of seconds since the reception of last downlink message (0 - 65536).
     lorawan_message_buf_t last_reception = lorawan_get_last_reception();
     unsigned long last_rx = (millis() - last_reception.timestamp_millis) / 1000;
     if (last_rx > 65536 || last_rx == 0)
     {
       last_rx = 65536;
     }
-    pkt.writeInteger(last_rx, 2);
-    // Byte 2, 3, 4, 5 - uptime in seconds.
-    pkt.writeInteger(power_get_uptime_sec(), 4);
-    // Byte 6, 7 - heap usage in KB.
-    pkt.writeInteger((ESP.getHeapSize() - ESP.getFreeHeap()) / 1024, 2);
-    // Byte 8, 9 - battery voltage in millivolts.
+    fields[COMPACT_STATUS_LAST_RX_SEC] = last_rx;
+    fields[COMPACT_STATUS_UPTIME_SEC] = power_get_uptime_sec();
+    fields[COMPACT_STATUS_HEAP_USAGE_KB] = (ESP.getHeapSize() - ESP.getFreeHeap()) / 1024;
     struct power_status power = power_get_status();
-    pkt.writeInteger(power.batt_millivolt, 2);
-    // Byte 10, 11 - power supply current draw in milliamps.
-    pkt.writeInteger((int)power.power_draw_milliamp, 2);
-    // Byte 12 - is battery charging (0 - false, 1 - true).
-    pkt.writeInteger(power.is_batt_charging ? 1 : 0, 1);
-    // Byte 13, 14, 15, 16 - ambient temperature in celcius.
+    fields[COMPACT_STATUS_BATT_MILLIVOLT] = power.batt_millivolt;
+    fields[COMPACT_STATUS_POWER_DRAW_MILLIAMP] = (int)power.power_draw_milliamp;
+    fields[COMPACT_STATUS_IS_BATT_CHARGING] = power.is_batt_charging ? 1 : 0;
     struct env_data env = env_sensor_get_data();
-    pkt.write32BitDouble(env.temp_celcius);
-    // Byte 17 - ambient humidity in percentage.
-    pkt.writeInteger((int)env.humidity_pct, 1);
-    // Byte 18, 19, 20, 21 - ambient pressure in hpa.
-    pkt.write32BitDouble(env.pressure_hpa);
-    // Byte 22, 23, 24, 25 - pressure altitude in meters.
-    pkt.write32BitDouble(env.altitude_metre);
+    fields[COMPACT_STATUS_TEMP_CELCIUS] = env.temp_celcius;
+    fields[COMPACT_STATUS_HUMIDITY_PCT] = (int)env.humidity_pct;
+    fields[COMPACT_STATUS_PRESSURE_HPA] = env.pressure_hpa;
+    fields[COMPACT_STATUS_ALTITUDE_METRE] = env.altitude_metre;
     // The reset reasons are explained in https://www.espressif.com/sites/default/files/documentation/esp32_technical_reference_manual_en.pdf
     // See "Table 9: PRO_CPU and APP_CPU Reset Reason Values".
-    // Byte 26 - CPU core 0's lower-level reset reason.
-    pkt.writeInteger(rtc_get_reset_reason(0), 1);
-    // Byte 27 - CPU core 1's lower-level reset reason.
-    pkt.writeInteger(rtc_get_reset_reason(1), 1);
-    // Byte 28 - CPU's wake-up cause.
-    pkt.writeInteger(rtc_get_wakeup_cause(), 1);
-    // Byte 29 - ESP's higher-level reset reason.
-    pkt.writeInteger(esp_reset_reason(), 1);
-    lorawan_set_next_transmission(pkt.content, pkt.cursor, LORAWAN_PORT_STATUS_SENSOR);
-    ESP_LOGI(LOG_TAG, "going to transmit status and sensor info in %d bytes", pkt.cursor);
+    fields[COMPACT_STATUS_CPU0_RESET_REASON] = rtc_get_reset_reason(0);
+    fields[COMPACT_STATUS_CPU1_RESET_REASON] = rtc_get_reset_reason(1);
+    fields[COMPACT_STATUS_WAKEUP_CAUSE] = rtc_get_wakeup_cause() & 0xFF;
+    fields[COMPACT_STATUS_ESP_RESET_REASON] = esp_reset_reason();
+    if (!send_on_delta_check(COMPACT_FRAME_STATUS, fields))
+    {
+      lorawan_enqueue_keepalive();
+      return;
+    }
+    uint8_t *frame = lorawan_begin_uplink(LORAWAN_PORT_STATUS_SENSOR_COMPACT, LORAWAN_PRIORITY_TELEMETRY, LORAWAN_TELEMETRY_TTL_SEC, 0);
+    if (frame == NULL)
+    {
+      return;
+    }
+    size_t len = compact_frame_encode(COMPACT_FRAME_STATUS, fields, frame, LORAWAN_MAX_MESSAGE_LEN);
+    if (len == 0)
+    {
+      lorawan_abort_uplink();
+      return;
+    }
+    lorawan_commit_uplink(len);
+    send_on_delta_commit(COMPACT_FRAME_STATUS, fields);
+    ESP_LOGI(LOG_TAG, "going to transmit status and sensor info in %d bytes", len);
   }
   else if (message_kind == LORAWAN_TX_KIND_POS)
   {
-    // Byte 0, 1, 2, 3 - GPS latitude.
+    // See compact_frame.cpp for the width and resolution of each field.
+    double fields[COMPACT_POS_NUM_FIELDS] = {0};
     struct gps_data gps = gps_get_data();
-    pkt.write32BitDouble(gps.latitude);
-    // Byte 4, 5, 6, 7 - GPS longitude.
-    pkt.write32BitDouble(gps.longitude);
-    // Byte 8, 9 - GPS speed in km/h.
-    pkt.writeInteger((int)gps.speed_kmh, 2);
-    // Byte 10, 11 - GPS heading in degrees.
-    pkt.writeInteger((int)gps.heading_deg, 2);
-    // Byte 12, 13, 14, 15 - GPS altitude in metres.
-    pkt.write32BitDouble(gps.altitude_metre);
-    // Byte 16, 17 - the age of last GPS fix in seconds (0 - 65536).
-    if (gps.pos_age_sec > 65536)
-    {
-      gps.pos_age_sec = 65536;
-    }
-    pkt.writeInteger(gps.pos_age_sec, 2);
-    // Byte 18 - HDOP in integer (0 - 256).
-    int hdop = (int)gps.hdop;
-    if (hdop > 256)
-    {
-      hdop = 256;
-    }
-    pkt.writeInteger(hdop, 1);
-    // Byte 19 - number of GPS satellites in view.
-    pkt.writeInteger(gps.satellites, 1);
-    // Byte 20 - WiFi monitor - number of inflight packets across all channels.
-    pkt.writeInteger(wifi_get_total_num_pkts(), 1);
-    // Byte 21 - WiFi monitor - the loudest sender's channel.
-    pkt.writeInteger(wifi_get_last_loudest_sender_channel(), 1);
-    // Byte 22 - WiFi monitor - the loudest sender's RSSI reading above RSSI floor (which is -100).
-    int wifi_rssi = wifi_get_last_loudest_sender_rssi();
-    if (wifi_rssi < WIFI_RSSI_FLOOR)
-    {
-      wifi_rssi = WIFI_RSSI_FLOOR;
-    }
-    pkt.writeInteger(wifi_rssi - WIFI_RSSI_FLOOR, 1);
-    // Byte 23, 24, 25, 26, 27, 28 - WiFi monitor - the loudest sender's MAC address.
+    fields[COMPACT_POS_LATITUDE] = gps.latitude;
+    fields[COMPACT_POS_LONGITUDE] = gps.longitude;
+    fields[COMPACT_POS_SPEED_KMH] = (int)gps.speed_kmh;
+    fields[COMPACT_POS_HEADING_DEG] = (int)gps.heading_deg;
+    fields[COMPACT_POS_ALTITUDE_METRE] = gps.altitude_metre;
+    fields[COMPACT_POS_AGE_SEC] = gps.pos_age_sec;
+    fields[COMPACT_POS_HDOP] = (int)gps.hdop;
+    fields[COMPACT_POS_SATELLITES] = gps.satellites;
+    fields[COMPACT_POS_WIFI_NUM_PKTS] = wifi_get_total_num_pkts();
+    fields[COMPACT_POS_WIFI_CHANNEL] = wifi_get_last_loudest_sender_channel();
+    fields[COMPACT_POS_WIFI_RSSI] = wifi_get_last_loudest_sender_rssi();
     uint8_t *wifi_mac = wifi_get_last_loudest_sender_mac();
-    for (int i = 0; i < 6; ++i)
-    {
-      pkt.writeInteger(wifi_mac[i], 1);
-    }
-    // Byte 29 - Bluetooth monitor - number of devices in the vicinity.
-    pkt.writeInteger(bluetooth_get_total_num_devices(), 1);
-    // Byte 30 - Bluetooth monitor - the loudest sender's RSSI reading above RSSI floor (which is -100).
+    fields[COMPACT_POS_WIFI_MAC_HI] = (wifi_mac[0] << 16) | (wifi_mac[1] << 8) | wifi_mac[2];
+    fields[COMPACT_POS_WIFI_MAC_LO] = (wifi_mac[3] << 16) | (wifi_mac[4] << 8) | wifi_mac[5];
+    fields[COMPACT_POS_BT_NUM_DEVICES] = bluetooth_get_total_num_devices();
     BLEAdvertisedDevice dev = bluetooth_get_loudest_sender();
-    int bt_rssi = dev.getRSSI();
-    if (bt_rssi < BLUETOOTH_RSSI_FLOOR)
-    {
-      bt_rssi = BLUETOOTH_RSSI_FLOOR;
-    }
-    pkt.writeInteger(bt_rssi - BLUETOOTH_RSSI_FLOOR, 1);
-    // Byte 31, 32, 33, 34, 35, 36 - Bluetooth monitor - the loudest sender's MAC address.
+    fields[COMPACT_POS_BT_RSSI] = dev.getRSSI();
     uint8_t bt_mac[6];
     memset(bt_mac, 0, sizeof(bt_mac));
     if (dev.haveRSSI())
     {
       memcpy(bt_mac, dev.getAddress().getNative(), 6);
     }
-    for (int i = 0; i < 6; ++i)
+    fields[COMPACT_POS_BT_MAC_HI] = (bt_mac[0] << 16) | (bt_mac[1] << 8) | bt_mac[2];
+    fields[COMPACT_POS_BT_MAC_LO] = (bt_mac[3] << 16) | (bt_mac[4] << 8) | bt_mac[5];
+    fields[COMPACT_POS_WIFI_DATA_KB] = wifi_get_total_pkt_data_len() / 1024;
+    if (!send_on_delta_check(COMPACT_FRAME_POS, fields))
     {
-      pkt.writeInteger(bt_mac[i], 1);
+      lorawan_enqueue_keepalive();
+      return;
+    }
+    uint8_t *frame = lorawan_begin_uplink(LORAWAN_PORT_GPS_WIFI_COMPACT, LORAWAN_PRIORITY_TELEMETRY, LORAWAN_TELEMETRY_TTL_SEC, 0);
+    if (frame == NULL)
+    {
+      return;
+    }
+    size_t len = compact_frame_encode(COMPACT_FRAME_POS, fields, frame, LORAWAN_MAX_MESSAGE_LEN);
+    if (len == 0)
+    {
+      lorawan_abort_uplink();
+      return;
     }
-    // Byte 37, 38 - the size of all inflight packets across all channels in KB.
-    int wifi_data_kb = wifi_get_total_pkt_data_len() / 1024;
-    pkt.writeInteger(wifi_data_kb, 2);
-    lorawan_set_next_transmission(pkt.content, pkt.cursor, LORAWAN_PORT_GPS_WIFI);
-    ESP_LOGI(LOG_TAG, "going to transmit GPS, wifi, and bluetooth info in %d bytes", pkt.cursor);
+    lorawan_commit_uplink(len);
+    send_on_delta_commit(COMPACT_FRAME_POS, fields);
+    ESP_LOGI(LOG_TAG, "going to transmit GPS, wifi, and bluetooth info in %d bytes", len);
   }
-  else if (message_kind == LORAWAN_TX_KIND_TEXT)
+  else if (message_kind == LORAWAN_TX_KIND_TEXT && rx_timing_is_report_due())
   {
-    String morse_message = gp_button_get_morse_message_buf();
-    uint8_t buf[LORAWAN_MAX_MESSAGE_LEN] = {0};
-    for (int i = 0; i < morse_message.length(); ++i)
+    // Take the place of a keepalive, which also gives the network an opportunity to send a downlink message.
+    uint8_t *frame = lorawan_begin_uplink(LORAWAN_PORT_RX_TIMING, LORAWAN_PRIORITY_IDLE, LORAWAN_TELEMETRY_TTL_SEC, 0);
+    if (frame == NULL)
     {
-      buf[i] = (uint8_t)morse_message.charAt(i);
+      return;
     }
-    // Determine the type of the message according to which OLED page the input came from.
-    int port = LORAWAN_PORT_MESSAGE;
-    if (oled_get_last_morse_input_page_num() == OLED_PAGE_TX_COMMAND)
+    size_t len = rx_timing_encode_report(frame, lorawan_get_max_payload_len(), LORAWAN_CLOCK_ERROR_PCT);
+    if (len == 0)
     {
-      port = LORAWAN_PORT_COMMAND;
+      lorawan_abort_uplink();
+      return;
     }
-    // Set the transmission buffer only if user is has finished typing a message.
-    if (oled_get_page_number() != OLED_PAGE_TX_COMMAND && oled_get_page_number() != OLED_PAGE_TX_MESSAGE)
+    lorawan_commit_uplink(len);
+    ESP_LOGI(LOG_TAG, "going to transmit RX timing report in %d bytes", len);
+  }
+  else if (message_kind == LORAWAN_TX_KIND_TEXT && energy_ledger_is_report_due())
+  {
+    uint8_t *frame = lorawan_begin_uplink(LORAWAN_PORT_ENERGY, LORAWAN_PRIORITY_IDLE, LORAWAN_TELEMETRY_TTL_SEC, 0);
+    if (frame == NULL)
     {
-      lorawan_set_next_transmission(buf, morse_message.length(), port);
-      ESP_LOGI(LOG_TAG, "going to transmit message/command \"%s\"", morse_message.c_str());
+      return;
     }
+    size_t len = energy_ledger_encode_report(frame, lorawan_get_max_payload_len());
+    if (len == 0)
+    {
+      lorawan_abort_uplink();
+      return;
+    }
+    lorawan_commit_uplink(len);
+    ESP_LOGI(LOG_TAG, "going to transmit energy ledger in %d bytes", len);
+  }
+  else if (message_kind == LORAWAN_TX_KIND_TEXT)
+  {
+    // The button module enqueues text messages and commands as soon as the user finishes typing them.
+    lorawan_enqueue_keepalive();
   }
 }
 
@@ -376,12 +1011,13 @@ void lorawan_debug_to_log()
 void lorawan_reset_tx_stats()
 {
   xSemaphoreTake(mutex, portMAX_DELAY);
-  LMIC_setDrTxpow(power_get_config().spreading_factor, power_get_config().power_dbm);
-  // Rely on LORAWAN_TX_INTERVAL_MS alone to control the duty cycle. Reset LMIC library's internal duty cycle stats.
+  int power_dbm = link_adapt_get_power_dbm();
+  LMIC_setDrTxpow(link_adapt_get_datarate(), power_dbm);
+  // The duty cycle and fair use budget are enforced by airtime.cpp when dequeuing an uplink. Reset LMIC library's internal duty cycle stats.
   for (size_t band = 0; band < MAX_BANDS; ++band)
   {
     LMIC.bands[band].txcap = 1;
-    LMIC.bands[band].txpow = power_get_config().power_dbm;
+    LMIC.bands[band].txpow = power_dbm;
     LMIC.bands[band].avail = os_getTime() - 1;
     if (LMIC.bands[band].avail < 0)
     {
@@ -391,12 +1027,59 @@ void lorawan_reset_tx_stats()
   xSemaphoreGive(mutex);
 }
 
+int lorawan_get_ms_until_next_job(int max_ms)
+{
+  // os_queryTimeCriticalJobs tells whether any scheduled job is due within the given time, the library does not
+  // otherwise reveal the deadline of its job queue. Binary search for the earliest deadline in whole milliseconds.
+  if (!os_queryTimeCriticalJobs(ms2osticks(max_ms)))
+  {
+    return max_ms;
+  }
+  int lo = 0, hi = max_ms;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (os_queryTimeCriticalJobs(ms2osticks(mid)))
+    {
+      hi = mid;
+    }
+    else
+    {
+      lo = mid + 1;
+    }
+  }
+  return lo;
+}
+
+int lorawan_get_sleep_ms()
+{
+  // Wake up a little before the deadline of the next library job. The RX jobs are scheduled RX_RAMPUP ahead of the
+  // RX window and the library waits for the exact opening time on its own, so the margin only needs to cover the tick granularity.
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  int sleep_ms = lorawan_get_ms_until_next_job(LORAWAN_TASK_LOOP_DELAY_MS) - LORAWAN_JOB_DEADLINE_MARGIN_MS;
+  xSemaphoreGive(mutex);
+  // Wake up in time for the next uplink too.
+  if (power_get_last_transmission_timestamp() > 0)
+  {
+    long ms_until_next_tx = (long)power_get_last_transmission_timestamp() + power_get_config().tx_interval_sec * 1000 - (long)millis();
+    if (ms_until_next_tx < sleep_ms)
+    {
+      sleep_ms = ms_until_next_tx;
+    }
+  }
+  return sleep_ms;
+}
+
 void lorawan_transceive()
 {
   power_set_cpu_freq_mhz(POWER_DEFAULT_CPU_FREQ_MHZ);
   // Give the LoRaWAN library a chance to do its work.
+  // A job may post further jobs that are runnable immediately, the library does not reveal them, hence run a short burst.
   xSemaphoreTake(mutex, portMAX_DELAY);
-  os_runloop_once();
+  for (int i = 0; i < LORAWAN_RUNLOOP_BURST; ++i)
+  {
+    os_runloop_once();
+  }
   xSemaphoreGive(mutex);
   // Rate-limit transmission to observe duty cycle.
   if (power_get_may_transmit_lorawan())
@@ -404,15 +1087,29 @@ void lorawan_transceive()
     ESP_LOGI(LOG_TAG, "last timestamp: %d, interval sec: %d", power_get_last_transmission_timestamp(), power_get_config().tx_interval_sec);
     lorawan_prepare_uplink_transmission();
     power_set_last_transmission_timestamp();
-    // Reset transmission power and spreading factor.
+    // Reset transmission power and spreading factor to those chosen by link adaptation.
     lorawan_reset_tx_stats();
-    xSemaphoreTake(mutex, portMAX_DELAY);
-    lmic_tx_error_t err = LMIC_setTxData2_strict(next_tx_message.port, next_tx_message.buf, next_tx_message.len, false);
-    xSemaphoreGive(mutex);
+    if (lorawan_get_queue_len() == 0)
+    {
+      ESP_LOGI(LOG_TAG, "there is nothing to transmit this round");
+      power_inc_lorawan_tx_counter();
+      return;
+    }
+    lmic_tx_error_t err;
+    if (!lorawan_dequeue_uplink(&err))
+    {
+      ESP_LOGW(LOG_TAG, "none of the %d queued messages fits into the current data rate and the %dms of airtime budget", lorawan_get_queue_len(), lorawan_get_airtime_budget_ms());
+      // Move on to the next kind of routine uplink.
+      power_inc_lorawan_tx_counter();
+      return;
+    }
     if (err == LMIC_ERROR_SUCCESS)
     {
       power_inc_lorawan_tx_counter();
       total_tx_bytes += next_tx_message.len;
+      ESP_LOGI(LOG_TAG, "the task loop woke up %lu times for the previous uplink", wakeups_since_last_uplink);
+      wakeups_last_uplink = wakeups_since_last_uplink;
+      wakeups_since_last_uplink = 0;
       // lorawan_debug_to_log();
     }
     else
@@ -430,21 +1127,35 @@ void lorawan_transceive()
   }
 }
 
+unsigned long lorawan_get_wakeups_last_uplink()
+{
+  return wakeups_last_uplink;
+}
+
+unsigned long lorawan_get_total_wakeups()
+{
+  return total_wakeups;
+}
+
 void lorawan_task_loop(void *_)
 {
+  task_handle = xTaskGetCurrentTaskHandle();
   while (true)
   {
     esp_task_wdt_reset();
     if (power_get_todo() & POWER_TODO_LORAWAN_TX_RX)
     {
-      // This interval must be kept extremely short, or the timing will be so off that LMIC MCCI library will be prevented from
-      // receiving downlink packets.
       lorawan_transceive();
-      vTaskDelay(pdMS_TO_TICKS(2));
+      ++wakeups_since_last_uplink;
+      ++total_wakeups;
+      // Sleep until the deadline of the next library job, or until the radio raises a DIO interrupt, or until a new
+      // uplink message is set. Oversleeping the deadline will prevent LMIC MCCI library from receiving downlink packets.
+      int sleep_ms = lorawan_get_sleep_ms();
+      ulTaskNotifyTake(pdTRUE, sleep_ms > 0 ? pdMS_TO_TICKS(sleep_ms) : 1);
     }
     else
     {
-      vTaskDelay(pdMS_TO_TICKS(1000));
+      power_wait_todo(POWER_TODO_LORAWAN_TX_RX, POWER_TODO_WAIT_TIMEOUT_MS);
     }
   }
 }
\ No newline at end of file
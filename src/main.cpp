@@ -11,6 +11,7 @@
 #include "wifi.h"
 #include "bluetooth.h"
 #include "supervisor.h"
+#include "ulp_wake.h"
 
 static const char LOG_TAG[] = __FILE__;
 
@@ -22,10 +23,17 @@ void setup()
   ESP_ERROR_CHECK(esp_task_wdt_add(NULL));
   Serial.begin(SERIAL_MONITOR_BAUD_RATE);
   ESP_LOGI(LOG_TAG, "hzgl-lorawan-communicator is starting up");
+  // Read why the main cores woke up before anything else reconfigures the button and the PMU IRQ line.
+  ulp_wake_setup();
   pinMode(GENERIC_PURPOSE_BUTTON, INPUT);
   power_setup();
   lorawan_setup();
   env_sensor_setup();
+  if (ulp_wake_is_fast_boot())
+  {
+    // The device woke up for the next uplink only, the screen stays off until the user presses the button.
+    oled_start_asleep();
+  }
   // The supervisor starts all essential tasks.
   supervisor_setup();
   ESP_LOGI(LOG_TAG, "setup completed");
@@ -1,8 +1,13 @@
 #include <esp_task_wdt.h>
+#include "airtime.h"
+#include "battery.h"
+#include "energy_ledger.h"
 #include "env_sensor.h"
 #include "gp_button.h"
 #include "gps.h"
 #include "hardware_facts.h"
+#include "i2c_bus.h"
+#include "link_adapt.h"
 #include "lorawan.h"
 #include "oled.h"
 #include "wifi.h"
@@ -17,7 +22,23 @@ static struct gps_data last_gps_data;
 static bool is_oled_on = false, is_initialised = false;
 static unsigned long last_input_timestamp = 0;
 
-static SSD1306Wire oled(OLED_I2C_ADDR, -1, -1, GEOMETRY_128_64, I2C_ONE, I2C_FREQUENCY_HZ);
+// PagedSSD1306Wire gives access to the frame drawn in memory, which oled_push_frame pushes to the display.
+class PagedSSD1306Wire : public SSD1306Wire
+{
+public:
+    using SSD1306Wire::SSD1306Wire;
+
+    // get_frame returns the frame buffer, frame page after frame page.
+    const uint8_t *get_frame()
+    {
+        return buffer;
+    }
+};
+
+static PagedSSD1306Wire oled(OLED_I2C_ADDR, -1, -1, GEOMETRY_128_64, I2C_ONE, I2C_FREQUENCY_HZ);
+// pushed_frame is the content of the display memory as of the latest push.
+static uint8_t pushed_frame[OLED_FRAME_NUM_PAGES][OLED_FRAME_WIDTH];
+static bool is_pushed_frame_valid = false;
 
 bool oled_reset_last_input_timestamp()
 {
@@ -26,6 +47,12 @@ bool oled_reset_last_input_timestamp()
     return ret;
 }
 
+void oled_start_asleep()
+{
+    // The latest input is long enough ago for the screen to be asleep, the unsigned arithmetic wraps around shortly after boot.
+    last_input_timestamp = millis() - OLED_SLEEP_AFTER_INACTIVE_MS - 1;
+}
+
 bool oled_get_state()
 {
     return is_oled_on;
@@ -63,7 +90,8 @@ unsigned long oled_get_last_page_nav_timestamp()
 
 void oled_display_page_rx_info(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1])
 {
-    lorawan_message_buf_t last_reception = lorawan_get_last_reception(), last_transmission = lorawan_get_transmission();
+    lorawan_message_buf_t last_reception = lorawan_get_last_reception();
+    lorawan_transmission_t last_transmission = lorawan_get_transmission();
     unsigned long last_tx_sec = (millis() - last_transmission.timestamp_millis) / 1000;
     int next_tx_sec = 0, tx_interval_sec = power_get_config().tx_interval_sec;
     String morse_signals = gp_button_get_latest_morse_signals(), morse_message = gp_button_get_morse_message_buf();
@@ -115,6 +143,29 @@ void oled_display_page_rx_info(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN
         snprintf(lines[4], OLED_MAX_LINE_LEN + 1, "to next page. Hold 4sec");
         snprintf(lines[5], OLED_MAX_LINE_LEN + 1, "to shutdown.");
     }
+    // Show the delivery of the latest user message on the line left blank above.
+    lorawan_delivery_t delivery = lorawan_get_last_delivery();
+    int delivery_line = last_reception.timestamp_millis > 0 ? 5 : 2;
+    int delivery_sec = (millis() - delivery.status_millis) / 1000;
+    switch (delivery.status)
+    {
+    case LORAWAN_DELIVERY_PENDING:
+        if (delivery.attempts == 0)
+        {
+            snprintf(lines[delivery_line], OLED_MAX_LINE_LEN + 1, "Msg waiting to be sent");
+        }
+        else
+        {
+            snprintf(lines[delivery_line], OLED_MAX_LINE_LEN + 1, "Msg sent %dx, no ack yet", delivery.attempts);
+        }
+        break;
+    case LORAWAN_DELIVERY_DELIVERED:
+        snprintf(lines[delivery_line], OLED_MAX_LINE_LEN + 1, "Msg delivered %ds ago", delivery_sec);
+        break;
+    case LORAWAN_DELIVERY_FAILED:
+        snprintf(lines[delivery_line], OLED_MAX_LINE_LEN + 1, "Msg FAILED after %d tries", delivery.attempts);
+        break;
+    }
 }
 
 void oled_display_page_tx_message(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1])
@@ -269,24 +320,25 @@ void oled_display_page_env_bt_sniffer_info(char lines[OLED_MAX_NUM_LINES][OLED_M
 
 void oled_display_page_power_mgmt(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1])
 {
-    power_config_t conf = power_get_config();
-    int sf_reading = 0;
-    switch (conf.spreading_factor)
+    const power_config_t &conf = power_get_config();
+    // The data rate and power are adapted to the link margin, the power mode sets their most robust values.
+    int dr = link_adapt_get_datarate();
+
+    if (conf.mode_id == POWER_ADAPTIVE)
     {
-    case DR_SF7:
-        sf_reading = 7;
-        break;
-    case DR_SF9:
-        sf_reading = 9;
-        break;
+        // The target runtime, the level, the state of charge, and the projected runtime.
+        snprintf(lines[0], OLED_MAX_LINE_LEN + 1, "Adapt %dd L%d %.0f%% %ldh", power_get_adaptive_target_hours() / 24, power_get_adaptive_level(),
+                 battery_get_soc_pct(), battery_get_projected_runtime_sec() / 3600);
     }
-
-    snprintf(lines[0], OLED_MAX_LINE_LEN + 1, "Power mode: %s", conf.mode_name.c_str());
-    snprintf(lines[1], OLED_MAX_LINE_LEN + 1, "TX %ddBm SF %d Intv %ds", conf.power_dbm, sf_reading, conf.tx_interval_sec);
-    snprintf(lines[2], OLED_MAX_LINE_LEN + 1, "LoRaWAN DR#%d Ch#%d", LMIC.datarate, LMIC.txChnl);
-    snprintf(lines[3], OLED_MAX_LINE_LEN + 1, "LoRa RSSI %d SNR %d", LMIC.rssi, LMIC.snr);
-    snprintf(lines[4], OLED_MAX_LINE_LEN + 1, "Click the user button");
-    snprintf(lines[5], OLED_MAX_LINE_LEN + 1, "to change power mode.");
+    else
+    {
+        snprintf(lines[0], OLED_MAX_LINE_LEN + 1, "Power mode: %s", conf.mode_name.c_str());
+    }
+    snprintf(lines[1], OLED_MAX_LINE_LEN + 1, "TX %ddBm SF %d Intv %ds", link_adapt_get_power_dbm(), link_adapt_get_spreading_factor(dr), conf.tx_interval_sec);
+    snprintf(lines[2], OLED_MAX_LINE_LEN + 1, "DR#%d Ch#%d Margin %.0fdB", LMIC.datarate, LMIC.txChnl, link_adapt_get_margin_db());
+    snprintf(lines[3], OLED_MAX_LINE_LEN + 1, "RSSI %ddBm SNR %.1fdB", link_adapt_get_rssi_dbm(), link_adapt_get_snr_db());
+    snprintf(lines[4], OLED_MAX_LINE_LEN + 1, "%s %d/%d", link_adapt_get_last_decision(), link_adapt_get_num_responses(dr), link_adapt_get_num_probes(dr));
+    snprintf(lines[5], OLED_MAX_LINE_LEN + 1, "Click btn->power mode");
 }
 
 void oled_display_page_diagnosis(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1])
@@ -310,10 +362,28 @@ void oled_display_page_diagnosis(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LE
     }
     snprintf(lines[2], OLED_MAX_LINE_LEN + 1, "Pkts: %d up %d dn", LMIC.seqnoUp, LMIC.seqnoDn);
     snprintf(lines[3], OLED_MAX_LINE_LEN + 1, "Data: %dB up %dB dn", lorawan_get_total_tx_bytes(), lorawan_get_total_rx_bytes());
-    snprintf(lines[4], OLED_MAX_LINE_LEN + 1, "GPS: read %luB", gps_get_chars_processed());
+    snprintf(lines[4], OLED_MAX_LINE_LEN + 1, "Air left %.1fs/%.1fs day", lorawan_get_airtime_budget_ms() / 1000.0, airtime_get_fair_use_remaining_ms() / 1000.0);
     snprintf(lines[5], OLED_MAX_LINE_LEN + 1, "Scan: WiFi %lu BT %lu", wifi_get_round_num(), bluetooth_get_round_num());
 }
 
+void oled_display_page_energy(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1])
+{
+    energy_ledger_entry_t total = energy_ledger_get_total();
+    snprintf(lines[0], OLED_MAX_LINE_LEN + 1, "Used %.1fmAh in %.1fh", total.milliamp_hours, total.duration_ms / 3600000.0);
+    // Two states per line, the charge in mAh attributed to each.
+    for (int i = 0; i < ENERGY_LEDGER_NUM_STATES; i += 2)
+    {
+        if (i + 1 < ENERGY_LEDGER_NUM_STATES)
+        {
+            snprintf(lines[1 + i / 2], OLED_MAX_LINE_LEN + 1, "%s %.1f %s %.1f", energy_ledger_get_state_name(i), energy_ledger_get_attributed_mah(i), energy_ledger_get_state_name(i + 1), energy_ledger_get_attributed_mah(i + 1));
+        }
+        else
+        {
+            snprintf(lines[1 + i / 2], OLED_MAX_LINE_LEN + 1, "%s %.1f (mAh)", energy_ledger_get_state_name(i), energy_ledger_get_attributed_mah(i));
+        }
+    }
+}
+
 void oled_display_morse_table(char lines[OLED_MAX_NUM_LINES][OLED_MAX_LINE_LEN + 1])
 {
     snprintf(lines[0], OLED_MAX_LINE_LEN + 1, "User button->next page");
@@ -366,10 +436,10 @@ unsigned int oled_get_ms_since_last_input()
 
 void oled_on()
 {
-    power_i2c_lock();
+    i2c_bus_lock(I2C_BUS_DEVICE_OLED);
     if (is_oled_on)
     {
-        power_i2c_unlock();
+        i2c_bus_unlock(I2C_BUS_DEVICE_OLED);
         return;
     }
     if (!is_initialised)
@@ -383,27 +453,28 @@ void oled_on()
         oled.flipScreenVertically();
         oled.setTextAlignment(TEXT_ALIGN_LEFT);
         oled.setFont(ArialMT_Plain_10);
+        is_pushed_frame_valid = false;
         is_initialised = true;
         last_input_timestamp = millis();
     }
     ESP_LOGI(LOG_TAG, "turning on OLED");
     oled.displayOn();
     is_oled_on = true;
-    power_i2c_unlock();
+    i2c_bus_unlock(I2C_BUS_DEVICE_OLED);
 }
 
 void oled_off()
 {
-    power_i2c_lock();
+    i2c_bus_lock(I2C_BUS_DEVICE_OLED);
     if (!is_oled_on)
     {
-        power_i2c_unlock();
+        i2c_bus_unlock(I2C_BUS_DEVICE_OLED);
         return;
     }
     ESP_LOGI(LOG_TAG, "turning off OLED");
     oled.displayOff();
     is_oled_on = false;
-    power_i2c_unlock();
+    i2c_bus_unlock(I2C_BUS_DEVICE_OLED);
 }
 
 void oled_display_refresh()
@@ -461,6 +532,9 @@ void oled_display_refresh()
             case OLED_PAGE_DIAGNOSIS:
                 oled_display_page_diagnosis(lines);
                 break;
+            case OLED_PAGE_ENERGY:
+                oled_display_page_energy(lines);
+                break;
             case OLED_PAGE_MORSE_TABLE:
                 oled_display_morse_table(lines);
                 break;
@@ -468,15 +542,57 @@ void oled_display_refresh()
                 break;
             }
         }
-        power_i2c_lock();
+        // The frame is drawn in memory, only the push needs the I2C bus.
         oled.clear();
         for (int i = 0; i < OLED_MAX_NUM_LINES; i++)
         {
             oled_draw_string_line(i, lines[i]);
         }
-        oled.display();
-        power_i2c_unlock();
+        oled_push_frame();
+    }
+}
+
+// oled_push_frame_page writes a frame page to the display memory, the caller must hold the I2C bus.
+void oled_push_frame_page(int page, const uint8_t *data)
+{
+    Wire.beginTransmission(OLED_I2C_ADDR);
+    // The control byte 0x00 tells that the following bytes are all commands: address the columns of the frame page.
+    Wire.write(0x00);
+    Wire.write(COLUMNADDR);
+    Wire.write(0);
+    Wire.write(OLED_FRAME_WIDTH - 1);
+    Wire.write(PAGEADDR);
+    Wire.write(page);
+    Wire.write(page);
+    Wire.endTransmission();
+    for (int i = 0; i < OLED_FRAME_WIDTH; i += OLED_PUSH_CHUNK_LEN)
+    {
+        Wire.beginTransmission(OLED_I2C_ADDR);
+        // The control byte 0x40 tells that the following bytes are all display data.
+        Wire.write(0x40);
+        Wire.write(data + i, OLED_PUSH_CHUNK_LEN);
+        Wire.endTransmission();
+    }
+}
+
+// oled_push_frame pushes the frame pages that have changed since the previous push. It releases the I2C bus after each
+// frame page, a whole frame would hold the bus for about 90ms.
+void oled_push_frame()
+{
+    const uint8_t *frame = oled.get_frame();
+    for (int page = 0; page < OLED_FRAME_NUM_PAGES; ++page)
+    {
+        const uint8_t *data = frame + page * OLED_FRAME_WIDTH;
+        if (is_pushed_frame_valid && memcmp(data, pushed_frame[page], OLED_FRAME_WIDTH) == 0)
+        {
+            continue;
+        }
+        i2c_bus_lock(I2C_BUS_DEVICE_OLED);
+        oled_push_frame_page(page, data);
+        i2c_bus_unlock(I2C_BUS_DEVICE_OLED);
+        memcpy(pushed_frame[page], data, OLED_FRAME_WIDTH);
     }
+    is_pushed_frame_valid = true;
 }
 
 void oled_task_loop(void *_)
@@ -0,0 +1,108 @@
+#include <Arduino.h>
+#include <Wire.h>
+#include "pmu_sample.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// pmu_sample_read_regs reads the registers from reg onwards in one transaction. It returns true on success.
+bool pmu_sample_read_regs(uint8_t reg, uint8_t *buf, int len)
+{
+    Wire.beginTransmission(PMU_SAMPLE_I2C_ADDR);
+    Wire.write(reg);
+    // Repeated start, the read follows the register address without releasing the bus.
+    if (Wire.endTransmission(false) != 0)
+    {
+        return false;
+    }
+    if ((int)Wire.requestFrom(PMU_SAMPLE_I2C_ADDR, len) != len)
+    {
+        return false;
+    }
+    return (int)Wire.readBytes(buf, len) == len;
+}
+
+bool pmu_sample_read(pmu_sample_t *sample)
+{
+    uint8_t status_regs[PMU_SAMPLE_STATUS_LEN];
+    if (!pmu_sample_read_regs(PMU_SAMPLE_STATUS_REG, status_regs, PMU_SAMPLE_STATUS_LEN))
+    {
+        ESP_LOGW(LOG_TAG, "failed to read the status registers");
+        return false;
+    }
+#ifdef AXP192
+    uint8_t adc_regs[PMU_SAMPLE_AXP192_ADC_LEN] = {0}, coulomb_regs[PMU_SAMPLE_AXP192_COULOMB_LEN] = {0};
+    if (!pmu_sample_read_regs(PMU_SAMPLE_AXP192_ADC_REG, adc_regs, PMU_SAMPLE_AXP192_ADC_LEN) ||
+        !pmu_sample_read_regs(PMU_SAMPLE_AXP192_COULOMB_REG, coulomb_regs, PMU_SAMPLE_AXP192_COULOMB_LEN))
+    {
+        ESP_LOGW(LOG_TAG, "failed to read the ADC and coulomb counter registers");
+        return false;
+    }
+    pmu_sample_decode_axp192(status_regs, adc_regs, coulomb_regs, sample);
+#endif
+#ifdef AXP2101
+    uint8_t adc_regs[PMU_SAMPLE_AXP2101_ADC_LEN] = {0};
+    if (!pmu_sample_read_regs(PMU_SAMPLE_AXP2101_ADC_REG, adc_regs, PMU_SAMPLE_AXP2101_ADC_LEN))
+    {
+        ESP_LOGW(LOG_TAG, "failed to read the ADC registers");
+        return false;
+    }
+    pmu_sample_decode_axp2101(status_regs, adc_regs, sample);
+#endif
+    return true;
+}
+
+// pmu_sample_h8_l4 returns the 12-bit ADC reading stored as the high 8 bits in the first register and the low 4 bits in the next.
+uint16_t pmu_sample_h8_l4(const uint8_t *regs)
+{
+    return (regs[0] << 4) | (regs[1] & 0x0F);
+}
+
+// pmu_sample_h8_l5 returns the 13-bit ADC reading stored as the high 8 bits in the first register and the low 5 bits in the next.
+uint16_t pmu_sample_h8_l5(const uint8_t *regs)
+{
+    return (regs[0] << 5) | (regs[1] & 0x1F);
+}
+
+// pmu_sample_be32 returns the big-endian 32-bit counter stored in four registers.
+uint32_t pmu_sample_be32(const uint8_t *regs)
+{
+    return ((uint32_t)regs[0] << 24) | ((uint32_t)regs[1] << 16) | ((uint32_t)regs[2] << 8) | regs[3];
+}
+
+void pmu_sample_decode_axp192(const uint8_t *status_regs, const uint8_t *adc_regs, const uint8_t *coulomb_regs, pmu_sample_t *sample)
+{
+    // Register 0x00 bit 5 - VBUS present. Register 0x01 bit 6 - charging, bit 5 - battery connected.
+    sample->is_vbus_present = status_regs[0] & (1 << 5);
+    sample->is_charging = status_regs[1] & (1 << 6);
+    sample->is_batt_connected = status_regs[1] & (1 << 5);
+    // The offsets are relative to PMU_SAMPLE_AXP192_ADC_REG (0x5A). VBUS voltage 1.7mV per step, VBUS current 0.375mA per step.
+    sample->vbus_millivolt = sample->is_vbus_present ? pmu_sample_h8_l4(&adc_regs[0x5A - PMU_SAMPLE_AXP192_ADC_REG]) * 1.7 : 0;
+    sample->vbus_milliamp = pmu_sample_h8_l4(&adc_regs[0x5C - PMU_SAMPLE_AXP192_ADC_REG]) * 0.375;
+    // Battery voltage 1.1mV per step, battery charge and discharge current 0.5mA per step.
+    sample->batt_millivolt = sample->is_batt_connected ? pmu_sample_h8_l4(&adc_regs[0x78 - PMU_SAMPLE_AXP192_ADC_REG]) * 1.1 : 0;
+    sample->batt_charge_milliamp = pmu_sample_h8_l5(&adc_regs[0x7A - PMU_SAMPLE_AXP192_ADC_REG]) * 0.5;
+    sample->batt_discharge_milliamp = pmu_sample_h8_l5(&adc_regs[0x7C - PMU_SAMPLE_AXP192_ADC_REG]) * 0.5;
+    sample->has_current = true;
+    sample->coulomb_charge = pmu_sample_be32(&coulomb_regs[0]);
+    sample->coulomb_discharge = pmu_sample_be32(&coulomb_regs[4]);
+    sample->has_coulomb = true;
+}
+
+void pmu_sample_decode_axp2101(const uint8_t *status_regs, const uint8_t *adc_regs, pmu_sample_t *sample)
+{
+    // Register 0x00 bit 5 - VBUS good, bit 3 - battery present. Register 0x01 bits 6:5 - current direction, 01 is charging.
+    sample->is_vbus_present = status_regs[0] & (1 << 5);
+    sample->is_batt_connected = status_regs[0] & (1 << 3);
+    sample->is_charging = ((status_regs[1] >> 5) & 0x03) == 0x01;
+    // The offsets are relative to PMU_SAMPLE_AXP2101_ADC_REG (0x34). Both voltages are 1mV per step, the battery voltage is
+    // 13 bits wide and the VBUS voltage 14 bits.
+    sample->batt_millivolt = sample->is_batt_connected ? ((adc_regs[0] & 0x1F) << 8) | adc_regs[1] : 0;
+    sample->vbus_millivolt = sample->is_vbus_present ? ((adc_regs[0x38 - PMU_SAMPLE_AXP2101_ADC_REG] & 0x3F) << 8) | adc_regs[0x39 - PMU_SAMPLE_AXP2101_ADC_REG] : 0;
+    sample->batt_charge_milliamp = 0;
+    sample->batt_discharge_milliamp = 0;
+    sample->vbus_milliamp = 0;
+    sample->has_current = false;
+    sample->coulomb_charge = 0;
+    sample->coulomb_discharge = 0;
+    sample->has_coulomb = false;
+}
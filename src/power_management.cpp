@@ -1,7 +1,14 @@
 #include <esp_log.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
 #include <esp_task_wdt.h>
+#include <driver/gpio.h>
+#include <driver/uart.h>
+#include <freertos/event_groups.h>
 #include <SPI.h>
+#include "battery.h"
 #include "hardware_facts.h"
+#include "i2c_bus.h"
 #include "oled.h"
 #include "lorawan.h"
 #include "power_management.h"
@@ -9,35 +16,169 @@
 #include "bluetooth.h"
 #include "gps.h"
 #include "env_sensor.h"
+#include "energy_ledger.h"
+#include "pmu_sample.h"
+#include "prep_window.h"
+#include "snapshot.h"
+#include "ulp_wake.h"
 
 static const char LOG_TAG[] = __FILE__;
 
 static XPowersPMU *pmu;
-static SemaphoreHandle_t i2c_mutex = xSemaphoreCreateMutex(), wifi_bt_mutex = xSemaphoreCreateMutex();
+static SemaphoreHandle_t wifi_bt_mutex = xSemaphoreCreateMutex();
+// cpu_freq_mutex serialises the CPU frequency changes, conserve_mutex the switches in and out of power conservation.
+static SemaphoreHandle_t cpu_freq_mutex = xSemaphoreCreateMutex(), conserve_mutex = xSemaphoreCreateMutex();
 static unsigned long last_transmision_timestamp = 0;
 static int last_cpu_freq_mhz = 240;
 static int lorawan_tx_counter = 0;
 static double sum_curr_draw_readings = 0.0;
 static bool pmu_irq_flag = false;
-
+// The PMU stays powered through deep sleep and retains its registers, they are written once after a cold boot.
+// RTC memory survives software, panic, and watchdog resets as well, the flag is only trusted after deep sleep.
+RTC_DATA_ATTR static bool is_pmu_configured = false;
+// todo_events holds the TODO bits computed once per tick of the power task loop, the other task loops block on their bits.
+static EventGroupHandle_t todo_events = xEventGroupCreate();
+// is_pm_configured is true if dynamic frequency scaling is in charge of the CPU frequency.
+static bool is_pm_configured = false, is_light_sleep_enabled = false;
+#ifdef CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t pm_locks[POWER_PM_NUM_LOCKS];
+#endif
+// The baseline is the power drawn in between transmissions, when only GPS is wanted.
+static double baseline_draw_sum = 0.0;
+static unsigned long baseline_draw_samples = 0;
+// The AXP192 coulomb counter readings of the latest power status reading.
+static uint32_t coulomb_charge = 0, coulomb_discharge = 0;
+static bool has_coulomb_reading = false;
+// The coulomb counter readings and the RTC time in seconds of the previous booking to the energy ledger. They are kept
+// across deep sleep, the PMU counts on while the CPUs are powered off.
+RTC_DATA_ATTR static uint32_t booked_coulomb_charge = 0, booked_coulomb_discharge = 0;
+RTC_DATA_ATTR static bool has_booked_coulomb_reading = false;
+RTC_DATA_ATTR static uint32_t last_booking_sec = 0;
+static unsigned long last_booking_millis = 0;
+
+// status is the working copy of the power task loop, other tasks read the copy published to latest_status.
 RTC_DATA_ATTR static struct power_status status;
+static Snapshot<struct power_status> latest_status;
 RTC_DATA_ATTR static bool is_conserving_power;
 RTC_DATA_ATTR static int config_mode_id = POWER_REGULAR;
 RTC_DATA_ATTR static int config_mode_id_before_conserving = config_mode_id;
 RTC_DATA_ATTR static unsigned long last_stop_conserve_power_timestamp = 0;
-
-// The durations must be sufficient for taking two rounds of readings, the first round is often unreliable.
+// The adaptive mode aims to run on battery until the deadline (RTC time in seconds), it is at a level since level_since_sec.
+RTC_DATA_ATTR static int adaptive_target_hours = POWER_ADAPTIVE_DEFAULT_TARGET_HOURS;
+RTC_DATA_ATTR static uint32_t adaptive_deadline_sec = 0;
+RTC_DATA_ATTR static int adaptive_level = 0;
+RTC_DATA_ATTR static uint32_t adaptive_level_since_sec = 0;
+
+// The worst case durations must be sufficient for taking two rounds of readings, the first round is often unreliable.
+// They are used until the preparation windows have been measured, and cap the measured windows afterwards.
 static const int bt_prep_duration_ms = (3000 * 2 + BLUETOOTH_TASK_LOOP_DELAY_MS * 3 + POWER_TASK_LOOP_DELAY_MS * 3); // typical: 3 seconds per bluetooth scan at 80MHz CPU frequency.
 static const int bt_wifi_gap_ms = (2000 + POWER_TASK_LOOP_DELAY_MS * 3);                                             // typical: 2 seconds to shut down bluetooth and free up memory for wifi.
 static const int wifi_prep_duration_ms = (4000 * 2 + WIFI_TASK_LOOP_DELAY_MS * 3 + POWER_TASK_LOOP_DELAY_MS * 3);    // typical: 4 seconds per wifi scan at 80MHz CPU frequency.
 static const int env_sensor_prep_duration_ms = (ENV_SENSOR_TASK_LOOP_DELAY_MS * 3 + POWER_TASK_LOOP_DELAY_MS * 3);
+// The measured windows are padded for the power task loop, which turns a peripheral on up to a tick late.
+static const int prep_margin_ms = POWER_TASK_LOOP_DELAY_MS * 2;
+// last_published_todo is the TODO bits published by the previous tick of the power task loop.
+static int last_published_todo = 0;
+
+// power_pm_setup hands the CPU frequency over to dynamic frequency scaling, and enables automatic light sleep if the
+// framework supports it (see POWER_PM_LIGHT_SLEEP_ENABLE).
+void power_pm_setup()
+{
+#ifdef CONFIG_PM_ENABLE
+    static const char *lock_names[POWER_PM_NUM_LOCKS] = {"radio", "gps_uart", "i2c"};
+    for (int i = 0; i < POWER_PM_NUM_LOCKS; ++i)
+    {
+        // SPI, UART, and I2C are clocked by APB, holding it at full speed keeps the chip out of light sleep as well.
+        if (esp_pm_lock_create(ESP_PM_APB_FREQ_MAX, 0, lock_names[i], &pm_locks[i]) != ESP_OK)
+        {
+            ESP_LOGW(LOG_TAG, "failed to create power management lock %s, the CPU frequency is set manually", lock_names[i]);
+            return;
+        }
+    }
+#if defined(CONFIG_FREERTOS_USE_TICKLESS_IDLE) && POWER_PM_LIGHT_SLEEP_ENABLE
+    bool light_sleep = true;
+#else
+    bool light_sleep = false;
+#endif
+    // The serial monitor UART is clocked by APB, which frequency scaling slows down without telling the Arduino serial
+    // driver to update the baud rate. REF_TICK stays at 1MHz regardless of the APB frequency.
+    uart_config_t monitor_config = {
+        .baud_rate = SERIAL_MONITOR_BAUD_RATE,
+        .data_bits = UART_DATA_8_BITS,
+        .parity = UART_PARITY_DISABLE,
+        .stop_bits = UART_STOP_BITS_1,
+        .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
+        .rx_flow_ctrl_thresh = 0,
+        .source_clk = UART_SCLK_REF_TICK};
+    if (uart_param_config(UART_NUM_0, &monitor_config) != ESP_OK)
+    {
+        ESP_LOGW(LOG_TAG, "failed to clock the serial monitor by REF_TICK, the CPU frequency is set manually");
+        return;
+    }
+    esp_pm_config_esp32_t pm_config = {
+        .max_freq_mhz = POWER_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = POWER_LOWEST_CPU_FREQ_MHZ,
+        .light_sleep_enable = light_sleep};
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(LOG_TAG, "failed to configure power management (%s), the CPU frequency is set manually", esp_err_to_name(err));
+        return;
+    }
+    // The button is active low, GPIO interrupts do not fire while the chip is in light sleep. The PMU IRQ line is armed
+    // for wake-up by power_attach_pmu_irq.
+    gpio_wakeup_enable((gpio_num_t)GENERIC_PURPOSE_BUTTON, GPIO_INTR_LOW_LEVEL);
+    esp_sleep_enable_gpio_wakeup();
+    is_pm_configured = true;
+    is_light_sleep_enabled = light_sleep;
+    ESP_LOGI(LOG_TAG, "dynamic frequency scaling between %d and %d MHz, light sleep? %d", POWER_LOWEST_CPU_FREQ_MHZ, POWER_DEFAULT_CPU_FREQ_MHZ, light_sleep);
+#else
+    ESP_LOGW(LOG_TAG, "power management is not enabled in the framework, the CPU frequency is set manually");
+#endif
+}
+
+// power_attach_pmu_irq handles the active low PMU IRQ line by setting pmu_irq_flag.
+void power_attach_pmu_irq()
+{
+    pinMode(POWER_PMU_IRQ, INPUT);
+    if (!is_pm_configured)
+    {
+        attachInterrupt(POWER_PMU_IRQ, power_set_pmu_irq_flag, FALLING);
+        return;
+    }
+    // The line must wake the chip from light sleep too. The wake-up shares the interrupt type of the pin, which only
+    // wakes on a level, and attachInterrupt would override it, so both use the low level.
+    attachInterrupt(POWER_PMU_IRQ, power_set_pmu_irq_flag, ONLOW);
+    gpio_wakeup_enable((gpio_num_t)POWER_PMU_IRQ, GPIO_INTR_LOW_LEVEL);
+}
+
+void power_pm_lock(int lock_id)
+{
+#ifdef CONFIG_PM_ENABLE
+    if (is_pm_configured)
+    {
+        esp_pm_lock_acquire(pm_locks[lock_id]);
+    }
+#endif
+}
+
+void power_pm_unlock(int lock_id)
+{
+#ifdef CONFIG_PM_ENABLE
+    if (is_pm_configured)
+    {
+        esp_pm_lock_release(pm_locks[lock_id]);
+    }
+#endif
+}
 
 void power_setup()
 {
     ESP_LOGI(LOG_TAG, "setting up power management");
     memset(&status, 0, sizeof(status));
     power_set_cpu_freq_mhz(POWER_DEFAULT_CPU_FREQ_MHZ);
-    power_i2c_lock();
+    power_pm_setup();
+    i2c_bus_lock(I2C_BUS_DEVICE_PMU);
 
     if (!Wire.begin(I2C_SDA, I2C_SCL, (uint32_t)I2C_FREQUENCY_HZ))
     {
@@ -61,8 +202,19 @@ void power_setup()
     }
 #endif
 
+    if (esp_reset_reason() != ESP_RST_DEEPSLEEP)
+    {
+        // The reset may have interrupted the configuration halfway.
+        is_pmu_configured = false;
+    }
+    if (is_pmu_configured)
+    {
+        ESP_LOGI(LOG_TAG, "PMU retains its configuration from before deep sleep");
+        power_attach_pmu_irq();
+        pmu->clearIrqStatus();
+    }
     // Set USB power limits.
-    if (pmu->getChipModel() == XPOWERS_AXP192)
+    else if (pmu->getChipModel() == XPOWERS_AXP192)
     {
         ESP_LOGI(LOG_TAG, "setting up AXP192");
 #ifdef AXP192
@@ -84,6 +236,8 @@ void power_setup()
         pmu->enableVbusVoltageMeasure();
         pmu->enableBattVoltageMeasure();
         pmu->enableSystemVoltageMeasure();
+        // The coulomb counter measures the charge consumed from the battery for the energy ledger.
+        pmu->enableCoulomb();
 
         // https://www.solomon-systech.com/product/ssd1306/
         // "– VDD= 1.65V – 3.3V, <VBAT for IC Logic"
@@ -111,8 +265,7 @@ void power_setup()
         pmu->setBackupBattChargerCurr(XPOWERS_AXP192_BACKUP_BAT_CUR_100UA);
 
         // Handle power management events.
-        pinMode(POWER_PMU_IRQ, INPUT);
-        attachInterrupt(POWER_PMU_IRQ, power_set_pmu_irq_flag, FALLING);
+        power_attach_pmu_irq();
         pmu->disableIRQ(XPOWERS_AXP192_ALL_IRQ);
         pmu->clearIrqStatus();
         pmu->enableIRQ(
@@ -121,6 +274,7 @@ void power_setup()
             XPOWERS_AXP192_PKEY_SHORT_IRQ |
             XPOWERS_AXP192_BAT_CHG_DONE_IRQ | XPOWERS_AXP192_BAT_CHG_START_IRQ);
         pmu->clearIrqStatus();
+        is_pmu_configured = true;
 #endif
     }
     else if (pmu->getChipModel() == XPOWERS_AXP2101)
@@ -184,8 +338,7 @@ void power_setup()
         pmu->enableButtonBatteryCharge();
 
         // Handle power management events.
-        pinMode(POWER_PMU_IRQ, INPUT);
-        attachInterrupt(POWER_PMU_IRQ, power_set_pmu_irq_flag, FALLING);
+        power_attach_pmu_irq();
         pmu->disableIRQ(XPOWERS_AXP192_ALL_IRQ);
         pmu->clearIrqStatus();
         pmu->enableIRQ(
@@ -194,31 +347,23 @@ void power_setup()
             XPOWERS_AXP202_PKEY_SHORT_IRQ |
             XPOWERS_AXP202_BAT_CHG_DONE_IRQ | XPOWERS_AXP202_BAT_CHG_START_IRQ);
         pmu->clearIrqStatus();
+        is_pmu_configured = true;
 #endif
     }
-    power_i2c_unlock();
+    i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
     ESP_LOGI(LOG_TAG, "power management is ready");
 }
 
 void power_set_pmu_irq_flag(void)
 {
     pmu_irq_flag = true;
-}
-
-void power_i2c_lock()
-{
-    if (xSemaphoreTake(i2c_mutex, MUTEX_LOCK_TIMEOUT_MS) == pdFALSE)
+    if (is_pm_configured)
     {
-        ESP_LOGE(LOG_TAG, "failed to obtain i2c_mutex lock");
-        assert(false);
+        // The low level interrupt keeps firing until the IRQ is cleared, power_read_handle_lastest_irq enables it again.
+        gpio_intr_disable((gpio_num_t)POWER_PMU_IRQ);
     }
 }
 
-void power_i2c_unlock()
-{
-    xSemaphoreGive(i2c_mutex);
-}
-
 void power_wifi_bt_lock()
 {
     if (xSemaphoreTake(wifi_bt_mutex, MUTEX_LOCK_TIMEOUT_MS) == pdFALSE)
@@ -243,6 +388,25 @@ void power_set_last_transmission_timestamp()
     last_transmision_timestamp = millis();
 }
 
+void power_restore_lorawan_tx_schedule(int tx_counter, uint32_t sec_since_last_tx)
+{
+    lorawan_tx_counter = tx_counter;
+    if (sec_since_last_tx < (uint32_t)power_get_config().tx_interval_sec)
+    {
+        // The arithmetic is modular, the timestamp may well be "before" the startup.
+        last_transmision_timestamp = millis() - sec_since_last_tx * 1000;
+        if (last_transmision_timestamp == 0)
+        {
+            last_transmision_timestamp = 1;
+        }
+    }
+    else
+    {
+        last_transmision_timestamp = 0;
+    }
+    ESP_LOGI(LOG_TAG, "restored tx counter %d, last transmission was %u seconds ago", tx_counter, sec_since_last_tx);
+}
+
 bool power_get_may_transmit_lorawan()
 {
     return last_transmision_timestamp == 0 || millis() - last_transmision_timestamp > power_get_config().tx_interval_sec * 1000;
@@ -250,16 +414,16 @@ bool power_get_may_transmit_lorawan()
 
 void power_led_on()
 {
-    power_i2c_lock();
+    i2c_bus_lock(I2C_BUS_DEVICE_PMU);
     pmu->setChargingLedMode(true);
-    power_i2c_unlock();
+    i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
 }
 
 void power_led_off()
 {
-    power_i2c_lock();
+    i2c_bus_lock(I2C_BUS_DEVICE_PMU);
     pmu->setChargingLedMode(false);
-    power_i2c_unlock();
+    i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
 }
 
 double power_get_sum_curr_draw_readings()
@@ -269,8 +433,9 @@ double power_get_sum_curr_draw_readings()
 
 void power_read_handle_lastest_irq()
 {
-    power_i2c_lock();
-    if (pmu_irq_flag)
+    i2c_bus_lock(I2C_BUS_DEVICE_PMU);
+    // The line stays low until the IRQ is cleared, which also catches an interrupt that went missing around light sleep.
+    if (pmu_irq_flag || (is_pm_configured && digitalRead(POWER_PMU_IRQ) == LOW))
     {
         pmu_irq_flag = false;
         pmu->getIrqStatus();
@@ -303,38 +468,47 @@ void power_read_handle_lastest_irq()
             pmu->shutdown();
         }
         pmu->clearIrqStatus();
+        if (is_pm_configured)
+        {
+            gpio_intr_enable((gpio_num_t)POWER_PMU_IRQ);
+        }
     }
-    power_i2c_unlock();
+    i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
 }
 
 void power_start_conserving()
 {
-    power_i2c_lock();
+    xSemaphoreTake(conserve_mutex, portMAX_DELAY);
     if (is_conserving_power)
     {
-        power_i2c_unlock();
+        xSemaphoreGive(conserve_mutex);
         return;
     }
-    ESP_LOGW(LOG_TAG, "start conserving power by switching from mode %d to power save mode, battery current reads: %+.1f", config_mode_id, status.batt_milliamp);
     config_mode_id_before_conserving = config_mode_id;
-    config_mode_id = POWER_SAVER;
     is_conserving_power = true;
-    power_i2c_unlock();
+    xSemaphoreGive(conserve_mutex);
+    if (config_mode_id == POWER_SAVER || config_mode_id == POWER_ADAPTIVE)
+    {
+        ESP_LOGW(LOG_TAG, "start conserving power in mode %d, battery current reads: %+.1f", config_mode_id, status.batt_milliamp);
+        return;
+    }
+    ESP_LOGW(LOG_TAG, "start conserving power by switching from mode %d to adaptive mode, battery current reads: %+.1f", config_mode_id, status.batt_milliamp);
+    power_set_adaptive_target_hours(POWER_ADAPTIVE_DEFAULT_TARGET_HOURS);
 }
 
 void power_stop_conserving()
 {
-    power_i2c_lock();
+    xSemaphoreTake(conserve_mutex, portMAX_DELAY);
     if (!is_conserving_power || ((millis() - last_stop_conserve_power_timestamp) / 1000) <= POWER_MIN_CONSERVATION_PERIOD_SEC)
     {
-        power_i2c_unlock();
+        xSemaphoreGive(conserve_mutex);
         return;
     }
     ESP_LOGW(LOG_TAG, "stop conserving power and return to power mode %d", config_mode_id_before_conserving);
     config_mode_id = config_mode_id_before_conserving;
     is_conserving_power = false;
     last_stop_conserve_power_timestamp = millis();
-    power_i2c_unlock();
+    xSemaphoreGive(conserve_mutex);
 }
 
 int power_get_uptime_sec()
@@ -344,20 +518,24 @@ int power_get_uptime_sec()
 
 struct power_status power_get_status()
 {
-    return status;
+    return latest_status.read();
 }
 
 // The returned TODO flag bits will instruct peripherals' task loops to turn their power off (or stop collecting
 // samples) when they are not in-use, hence conserving power.
 // The general rule is to turn on peripherals required for the upcoming LoRaWAN transmission shortly before the transmission.
-int power_get_todo()
+int power_compute_todo()
 {
-    power_config_t config = power_get_config();
+    const power_config_t &config = power_get_config();
     int ret = 0;
     int uptime_sec = millis() / 1000;
-    int deep_sleep_start_sec = power_get_config().deep_sleep_start_sec;
+    // Turn the peripherals on just in time for the upcoming transmission.
+    int bt_window_ms = prep_window_get_ms(PREP_WINDOW_BLUETOOTH, bt_prep_duration_ms, prep_margin_ms);
+    int gap_window_ms = prep_window_get_ms(PREP_WINDOW_BT_WIFI_GAP, bt_wifi_gap_ms, prep_margin_ms);
+    int wifi_window_ms = prep_window_get_ms(PREP_WINDOW_WIFI, wifi_prep_duration_ms, prep_margin_ms);
+    int env_sensor_window_ms = prep_window_get_ms(PREP_WINDOW_ENV_SENSOR, env_sensor_prep_duration_ms, prep_margin_ms);
     // Do not enter deep sleep if user has made recent button inputs.
-    if (deep_sleep_start_sec > 0 && uptime_sec >= deep_sleep_start_sec && oled_get_ms_since_last_input() > OLED_SLEEP_AFTER_INACTIVE_MS)
+    if (config.deep_sleep_start_sec > 0 && uptime_sec >= config.deep_sleep_start_sec && oled_get_ms_since_last_input() > OLED_SLEEP_AFTER_INACTIVE_MS)
     {
         return POWER_TODO_ENTER_DEEP_SLEEP;
         // There's no need to ask caller to turn on anything else. The CPUs will be powered off entirely during deep sleep.
@@ -392,20 +570,20 @@ int power_get_todo()
     }
 
     // Give Bluetooth and WiFi a turn at scanning prior to transmitting foxhunt info.
-    if (lorawan_tx_counter % LORAWAN_TX_KINDS == LORAWAN_TX_KIND_POS &&
+    if (lorawan_tx_counter % LORAWAN_TX_KINDS == LORAWAN_TX_KIND_POS && config.wifi_bt_scan &&
         // There is not enough memory to run bluetooth and wifi simultaneously.
         !(ret & POWER_TODO_TURN_ON_WIFI) && (!oled_get_state() || oled_get_page_number() != OLED_PAGE_WIFI_INFO) &&
         // Is it time to turn on bluetooth for routine scan?
-        (ms_since_last_tx > config.tx_interval_sec * 1000 - bt_prep_duration_ms - wifi_prep_duration_ms - bt_wifi_gap_ms &&
-         ms_since_last_tx < config.tx_interval_sec * 1000 - wifi_prep_duration_ms - bt_wifi_gap_ms))
+        (ms_since_last_tx > config.tx_interval_sec * 1000 - bt_window_ms - wifi_window_ms - gap_window_ms &&
+         ms_since_last_tx < config.tx_interval_sec * 1000 - wifi_window_ms - gap_window_ms))
     {
         ret |= POWER_TODO_TURN_ON_BLUETOOTH;
     }
-    if (lorawan_tx_counter % LORAWAN_TX_KINDS == LORAWAN_TX_KIND_POS &&
+    if (lorawan_tx_counter % LORAWAN_TX_KINDS == LORAWAN_TX_KIND_POS && config.wifi_bt_scan &&
         // There is not enough memory to run bluetooth and wifi simultaneously.
         !(ret & POWER_TODO_TURN_ON_BLUETOOTH) && (!oled_get_state() || oled_get_page_number() != OLED_PAGE_BT_INFO) &&
         // Is it time to turn on wifi for routine scan?
-        (ms_since_last_tx > config.tx_interval_sec * 1000 - wifi_prep_duration_ms &&
+        (ms_since_last_tx > config.tx_interval_sec * 1000 - wifi_window_ms &&
          ms_since_last_tx < config.tx_interval_sec * 1000))
     {
         ret |= POWER_TODO_TURN_ON_WIFI;
@@ -414,7 +592,7 @@ int power_get_todo()
     // The sensor readings need to be taken for the first TX since boot as well as shortly before next TX.
     if (lorawan_tx_counter == 0 ||
         (lorawan_tx_counter % LORAWAN_TX_KINDS == LORAWAN_TX_KIND_ENV &&
-         (ms_since_last_tx > config.tx_interval_sec * 1000 - env_sensor_prep_duration_ms && ms_since_last_tx < config.tx_interval_sec * 1000)))
+         (ms_since_last_tx > config.tx_interval_sec * 1000 - env_sensor_window_ms && ms_since_last_tx < config.tx_interval_sec * 1000)))
     {
         ret |= POWER_TODO_READ_ENV_SENSOR;
     }
@@ -432,6 +610,78 @@ int power_get_todo()
     return ret;
 }
 
+// power_track_prep_windows measures the preparation windows of the peripherals that have just been turned on (rising) and
+// closes the windows of those that have just been turned off (falling).
+void power_track_prep_windows(int rising, int falling)
+{
+    if (rising & POWER_TODO_TURN_ON_BLUETOOTH)
+    {
+        prep_window_begin(PREP_WINDOW_BLUETOOTH);
+    }
+    if (falling & POWER_TODO_TURN_ON_BLUETOOTH)
+    {
+        prep_window_close(PREP_WINDOW_BLUETOOTH);
+        prep_window_begin(PREP_WINDOW_BT_WIFI_GAP);
+    }
+    if (rising & POWER_TODO_TURN_ON_WIFI)
+    {
+        prep_window_begin(PREP_WINDOW_WIFI);
+    }
+    if (falling & POWER_TODO_TURN_ON_WIFI)
+    {
+        prep_window_close(PREP_WINDOW_WIFI);
+    }
+    if (rising & POWER_TODO_READ_ENV_SENSOR)
+    {
+        prep_window_begin(PREP_WINDOW_ENV_SENSOR);
+    }
+    if (falling & POWER_TODO_READ_ENV_SENSOR)
+    {
+        prep_window_close(PREP_WINDOW_ENV_SENSOR);
+    }
+}
+
+// power_publish_todo computes the TODO bits and publishes them to the task loops. The peripheral shown on the OLED
+// page is kept on as well, so that the user may watch it live.
+int power_publish_todo()
+{
+    int todo = power_compute_todo();
+    int published = todo;
+    if (oled_get_state())
+    {
+        switch (oled_get_page_number())
+        {
+        case OLED_PAGE_GPS_INFO:
+            published |= POWER_TODO_TURN_ON_GPS;
+            break;
+        case OLED_PAGE_ENV_SENSOR_INFO:
+            published |= POWER_TODO_READ_ENV_SENSOR;
+            break;
+        case OLED_PAGE_WIFI_INFO:
+            published |= POWER_TODO_TURN_ON_WIFI;
+            break;
+        case OLED_PAGE_BT_INFO:
+            published |= POWER_TODO_TURN_ON_BLUETOOTH;
+            break;
+        }
+    }
+    xEventGroupClearBits(todo_events, POWER_TODO_ALL & ~published);
+    xEventGroupSetBits(todo_events, published);
+    power_track_prep_windows(published & ~last_published_todo, last_published_todo & ~published);
+    last_published_todo = published;
+    return todo;
+}
+
+int power_get_todo()
+{
+    return xEventGroupGetBits(todo_events) & POWER_TODO_ALL;
+}
+
+int power_wait_todo(int bits, int timeout_ms)
+{
+    return xEventGroupWaitBits(todo_events, bits, pdFALSE, pdFALSE, pdMS_TO_TICKS(timeout_ms)) & POWER_TODO_ALL;
+}
+
 int power_get_lorawan_tx_counter()
 {
     return lorawan_tx_counter;
@@ -444,31 +694,32 @@ void power_inc_lorawan_tx_counter()
 
 void power_read_status()
 {
-    power_i2c_lock();
-    status.is_batt_charging = pmu->isCharging();
-    status.batt_millivolt = pmu->getBattVoltage();
+    pmu_sample_t sample;
+    i2c_bus_lock(I2C_BUS_DEVICE_PMU);
+    bool is_read = pmu_sample_read(&sample);
+    i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
+    if (!is_read)
+    {
+        // Keep the previous readings.
+        return;
+    }
+    status.is_batt_charging = sample.is_charging;
+    status.batt_millivolt = sample.batt_millivolt;
     if (status.batt_millivolt < 500)
     {
         // The AXP chip occasionally produces erranous and exceedingly low battery voltage readings even without a battery installed.
         status.batt_millivolt = 0;
     }
-    status.usb_millivolt = pmu->getVbusVoltage();
-#ifdef AXP192
-    if (status.is_batt_charging)
-    {
-        status.batt_milliamp = pmu->getBatteryChargeCurrent();
-    }
-    else
+    status.usb_millivolt = sample.vbus_millivolt;
+    // Unsure if the library is capable of reading the current consumptino of AXP2101: https://github.com/lewisxhe/XPowersLib/issues/12
+    status.batt_milliamp = status.is_batt_charging ? sample.batt_charge_milliamp : -sample.batt_discharge_milliamp;
+    status.power_draw_milliamp = sample.vbus_milliamp;
+    if (sample.has_coulomb)
     {
-        status.batt_milliamp = -pmu->getBattDischargeCurrent();
+        coulomb_charge = sample.coulomb_charge;
+        coulomb_discharge = sample.coulomb_discharge;
+        has_coulomb_reading = true;
     }
-    status.power_draw_milliamp = pmu->getVbusCurrent();
-#endif
-#ifdef AXP2101
-    // Unsure if the library is capable of reading the current consumptino: https://github.com/lewisxhe/XPowersLib/issues/12
-    status.batt_milliamp = 0;
-    status.power_draw_milliamp = 0;
-#endif
     // The power management chip always draws power from USB when it is available.
     // Use battery discharging current as a condition too because the VBus current occasionally reads 0.
     status.is_usb_power_available = status.is_batt_charging || status.batt_milliamp > 3 || status.batt_millivolt < 3000 || status.power_draw_milliamp > 3 || status.usb_millivolt > 4000;
@@ -482,7 +733,72 @@ void power_read_status()
         status.power_draw_milliamp = 0;
     }
     sum_curr_draw_readings += status.power_draw_milliamp;
-    power_i2c_unlock();
+    latest_status.publish(status);
+}
+
+// power_book_energy books the charge consumed since the previous power status reading to the energy ledger, along with
+// the states active at the moment, and advances the battery model. The first reading after waking up from deep sleep
+// books the sleep instead.
+void power_book_energy(int todo)
+{
+    unsigned long now = millis();
+    uint32_t now_sec = (uint32_t)time(NULL);
+    bool is_first_booking = last_booking_millis == 0;
+    bool is_after_deep_sleep = is_first_booking && last_booking_sec != 0 && now_sec > last_booking_sec && esp_reset_reason() == ESP_RST_DEEPSLEEP;
+    // The RTC time keeps running during deep sleep, the interval includes the boot as well.
+    unsigned long duration_ms = is_after_deep_sleep ? (now_sec - last_booking_sec) * 1000UL : now - last_booking_millis;
+    last_booking_millis = now;
+    last_booking_sec = now_sec;
+    bool has_coulomb_counts = has_coulomb_reading && has_booked_coulomb_reading;
+    bool from_coulomb_counter = has_coulomb_counts && !status.is_usb_power_available;
+    // The counters wrap around, the differences are unaffected.
+    int64_t coulomb_counts = (int64_t)(uint32_t)(coulomb_discharge - booked_coulomb_discharge) - (int64_t)(uint32_t)(coulomb_charge - booked_coulomb_charge);
+    booked_coulomb_charge = coulomb_charge;
+    booked_coulomb_discharge = coulomb_discharge;
+    has_booked_coulomb_reading = has_coulomb_reading;
+    if (is_after_deep_sleep)
+    {
+        double sleep_milliamp_hours = from_coulomb_counter ? coulomb_counts * ENERGY_LEDGER_AXP192_MAH_PER_COUNT : POWER_DEEP_SLEEP_DRAW_MILLIAMP * duration_ms / 3600000.0;
+        double sleep_batt_milliamp_hours = has_coulomb_counts ? -coulomb_counts * ENERGY_LEDGER_AXP192_MAH_PER_COUNT : (status.is_usb_power_available ? 0 : -sleep_milliamp_hours);
+        ESP_LOGI(LOG_TAG, "booking %.3f mAh to %lu seconds of deep sleep, coulomb counter? %d", sleep_milliamp_hours, duration_ms / 1000, from_coulomb_counter);
+        battery_update(status.batt_millivolt, status.batt_milliamp, sleep_batt_milliamp_hours, sleep_milliamp_hours, duration_ms);
+        energy_ledger_record(1 << ENERGY_LEDGER_DEEP_SLEEP, sleep_milliamp_hours, duration_ms, from_coulomb_counter);
+        return;
+    }
+    if (is_first_booking)
+    {
+        return;
+    }
+
+    double draw_milliamp_hours = status.power_draw_milliamp * duration_ms / 3600000.0;
+    double milliamp_hours = from_coulomb_counter ? coulomb_counts * ENERGY_LEDGER_AXP192_MAH_PER_COUNT : draw_milliamp_hours;
+    double batt_milliamp_hours = has_coulomb_counts ? -coulomb_counts * ENERGY_LEDGER_AXP192_MAH_PER_COUNT : status.batt_milliamp * duration_ms / 3600000.0;
+    battery_update(status.batt_millivolt, status.batt_milliamp, batt_milliamp_hours, draw_milliamp_hours, duration_ms);
+    int states = 0;
+    if (todo & POWER_TODO_LORAWAN_TX_RX)
+    {
+        states |= 1 << ENERGY_LEDGER_LORAWAN;
+    }
+    if (wifi_get_state())
+    {
+        states |= 1 << ENERGY_LEDGER_WIFI;
+    }
+    if (bluetooth_get_state())
+    {
+        states |= 1 << ENERGY_LEDGER_BLUETOOTH;
+    }
+    if (gps_get_state())
+    {
+        states |= 1 << ENERGY_LEDGER_GPS;
+    }
+    if (oled_get_state())
+    {
+        states |= 1 << ENERGY_LEDGER_OLED;
+    }
+    // Dynamic frequency scaling slows the CPU down whenever there is nothing to do.
+    bool is_cpu_reduced = is_pm_configured ? (todo & POWER_TODO_REDUCE_CPU_FREQ) : last_cpu_freq_mhz <= POWER_LOWEST_CPU_FREQ_MHZ;
+    states |= 1 << (is_cpu_reduced ? ENERGY_LEDGER_CPU_REDUCED : ENERGY_LEDGER_CPU_FULL);
+    energy_ledger_record(states, milliamp_hours, duration_ms, from_coulomb_counter);
 }
 
 void power_log_status()
@@ -491,6 +807,14 @@ void power_log_status()
              config_mode_id,
              wifi_get_state(), bluetooth_get_state(), gps_get_state(), oled_get_state(),
              status.is_batt_charging, status.is_usb_power_available, status.usb_millivolt, status.batt_millivolt, status.batt_milliamp, status.power_draw_milliamp);
+    ESP_LOGI(LOG_TAG, "battery state of charge: %.1f%%, average draw: %.2f milliamp, projected runtime: %ld sec, adaptive mode target: %d hours, level: %d",
+             battery_get_soc_pct(), battery_get_avg_draw_milliamp(), battery_get_projected_runtime_sec(), adaptive_target_hours, adaptive_level);
+    if (baseline_draw_samples > 0)
+    {
+        ESP_LOGI(LOG_TAG, "baseline power draw in between transmissions: %.2f milliamp over %lu readings, frequency scaling? %d, light sleep? %d",
+                 baseline_draw_sum / baseline_draw_samples, baseline_draw_samples, is_pm_configured, is_light_sleep_enabled);
+    }
+    i2c_bus_log_stats();
 }
 
 void power_set_config(int new_mode_id)
@@ -499,7 +823,66 @@ void power_set_config(int new_mode_id)
     config_mode_id = new_mode_id;
 }
 
-power_config_t power_get_config()
+void power_set_adaptive_target_hours(int hours)
+{
+    ESP_LOGI(LOG_TAG, "setting adaptive power mode to run for %d hours", hours);
+    adaptive_target_hours = hours;
+    adaptive_deadline_sec = (uint32_t)time(NULL) + hours * 3600;
+    adaptive_level = 0;
+    adaptive_level_since_sec = (uint32_t)time(NULL);
+    config_mode_id = POWER_ADAPTIVE;
+}
+
+int power_get_adaptive_target_hours()
+{
+    return adaptive_target_hours;
+}
+
+int power_get_adaptive_level()
+{
+    return adaptive_level;
+}
+
+// power_adapt_level moves the adaptive mode to the level that makes the battery last until the deadline.
+void power_adapt_level()
+{
+    if (config_mode_id != POWER_ADAPTIVE)
+    {
+        return;
+    }
+    uint32_t now_sec = (uint32_t)time(NULL);
+    int new_level = adaptive_level;
+    if (status.is_usb_power_available)
+    {
+        new_level = 0;
+    }
+    else if (now_sec - adaptive_level_since_sec >= POWER_ADAPTIVE_MIN_LEVEL_DURATION_SEC && now_sec < adaptive_deadline_sec)
+    {
+        long runtime_sec = battery_get_projected_runtime_sec();
+        long sec_left = adaptive_deadline_sec - now_sec;
+        if (runtime_sec < 0)
+        {
+            return;
+        }
+        if (runtime_sec < sec_left && adaptive_level < POWER_ADAPTIVE_NUM_LEVELS - 1)
+        {
+            ++new_level;
+        }
+        else if (runtime_sec > sec_left * POWER_ADAPTIVE_STEP_UP_MARGIN && adaptive_level > 0)
+        {
+            --new_level;
+        }
+    }
+    if (new_level != adaptive_level)
+    {
+        ESP_LOGI(LOG_TAG, "moving adaptive power mode from level %d to %d, projected runtime %ld sec, %ld sec left until the target", adaptive_level, new_level,
+                 battery_get_projected_runtime_sec(), (long)(adaptive_deadline_sec - now_sec));
+        adaptive_level = new_level;
+        adaptive_level_since_sec = now_sec;
+    }
+}
+
+const power_config_t &power_get_config()
 {
     switch (config_mode_id)
     {
@@ -512,6 +895,9 @@ power_config_t power_get_config()
     case POWER_SAVER:
         return power_config_saver;
         break;
+    case POWER_ADAPTIVE:
+        return power_config_adaptive_levels[adaptive_level];
+        break;
     default:
         return power_config_regular;
     }
@@ -519,11 +905,21 @@ power_config_t power_get_config()
 
 void power_set_cpu_freq_mhz(int new_mhz)
 {
-    power_i2c_lock();
+    if (is_pm_configured)
+    {
+        // Dynamic frequency scaling lowers the CPU frequency on its own whenever no task needs it at full speed. The serial
+        // monitor is clocked by REF_TICK in the meantime, its baud rate does not need updating.
+        return;
+    }
+    xSemaphoreTake(cpu_freq_mutex, portMAX_DELAY);
     if (last_cpu_freq_mhz != new_mhz)
     {
         ESP_LOGI(LOG_TAG, "setting CPU frequency to %d MHz", new_mhz);
+        // Below 80MHz the APB clock of the I2C controller slows down along with the CPU, which would garble a transfer in
+        // progress. Only an actual change waits for the bus.
+        i2c_bus_lock(I2C_BUS_DEVICE_PMU);
         bool success = setCpuFrequencyMhz(new_mhz);
+        i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
         // Changing CPU frequency seems to always mess up the monitor baud rate.
         // See also: https://github.com/espressif/arduino-esp32/issues/6032 ("setCpuFrequencyMhz() changes Serial bauds if frequency<80Mhz")
         Serial.updateBaudRate(SERIAL_MONITOR_BAUD_RATE);
@@ -533,7 +929,7 @@ void power_set_cpu_freq_mhz(int new_mhz)
         }
         last_cpu_freq_mhz = new_mhz;
     }
-    power_i2c_unlock();
+    xSemaphoreGive(cpu_freq_mutex);
 }
 
 void power_enter_deep_sleep()
@@ -544,6 +940,11 @@ void power_enter_deep_sleep()
     gps_off();
     oled_off();
     power_led_off();
+    // The ULP program wakes up on the falling edge of the PMU IRQ line, which stays low until the IRQ is cleared.
+    i2c_bus_lock(I2C_BUS_DEVICE_PMU);
+    pmu->clearIrqStatus();
+    i2c_bus_unlock(I2C_BUS_DEVICE_PMU);
+    ulp_wake_arm();
     esp_sleep_enable_timer_wakeup(power_get_config().deep_sleep_duration_sec * 1000 * 1000);
     ESP_LOGW(LOG_TAG, "entering deep sleep now");
     esp_deep_sleep_start();
@@ -555,7 +956,8 @@ void power_task_loop(void *_)
     while (true)
     {
         esp_task_wdt_reset();
-        if (power_get_todo() & POWER_TODO_ENTER_DEEP_SLEEP)
+        int todo = power_publish_todo();
+        if (todo & POWER_TODO_ENTER_DEEP_SLEEP)
         {
             power_enter_deep_sleep();
             return; // Not reachable, the CPUs shut down during deep sleep.
@@ -563,6 +965,13 @@ void power_task_loop(void *_)
         if (rounds % (POWER_TASK_READ_STATUS_DELAY_MS / POWER_TASK_LOOP_DELAY_MS) == 0)
         {
             power_read_status();
+            power_book_energy(todo);
+            power_adapt_level();
+            if ((todo & ~POWER_TODO_REDUCE_CPU_FREQ) == POWER_TODO_TURN_ON_GPS)
+            {
+                baseline_draw_sum += status.power_draw_milliamp;
+                ++baseline_draw_samples;
+            }
             // Act upon the latest power status readings.
             if (status.batt_milliamp < -10)
             {
@@ -572,7 +981,7 @@ void power_task_loop(void *_)
             {
                 power_stop_conserving();
             }
-            if (power_get_todo() & POWER_TODO_REDUCE_CPU_FREQ)
+            if (todo & POWER_TODO_REDUCE_CPU_FREQ)
             {
                 power_set_cpu_freq_mhz(POWER_LOWEST_CPU_FREQ_MHZ);
             }
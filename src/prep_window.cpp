@@ -0,0 +1,89 @@
+#include <Arduino.h>
+#include "prep_window.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+static const char *window_names[PREP_WINDOW_NUM_WINDOWS] = {"bluetooth", "wifi", "env_sensor", "bt_wifi_gap"};
+
+// prep_window_estimate_t is the estimated duration of a window.
+typedef struct
+{
+    float mean_ms, deviation_ms;
+    unsigned long num_samples;
+} prep_window_estimate_t;
+
+static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+RTC_DATA_ATTR static prep_window_estimate_t estimates[PREP_WINDOW_NUM_WINDOWS];
+// The measurements in progress do not survive deep sleep, the peripherals are turned off before entering it.
+static bool is_measuring[PREP_WINDOW_NUM_WINDOWS];
+static unsigned long begin_millis[PREP_WINDOW_NUM_WINDOWS];
+
+void prep_window_begin(int window)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!is_measuring[window])
+    {
+        is_measuring[window] = true;
+        begin_millis[window] = millis();
+    }
+    xSemaphoreGive(mutex);
+}
+
+void prep_window_end(int window)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!is_measuring[window])
+    {
+        xSemaphoreGive(mutex);
+        return;
+    }
+    is_measuring[window] = false;
+    float sample_ms = millis() - begin_millis[window];
+    prep_window_estimate_t *est = &estimates[window];
+    if (est->num_samples == 0)
+    {
+        est->mean_ms = sample_ms;
+        est->deviation_ms = sample_ms / 2;
+    }
+    else
+    {
+        // The deviation is updated with the error of the previous average, like the retransmission timer of TCP.
+        est->deviation_ms += PREP_WINDOW_DEVIATION_GAIN * (fabs(sample_ms - est->mean_ms) - est->deviation_ms);
+        est->mean_ms += PREP_WINDOW_MEAN_GAIN * (sample_ms - est->mean_ms);
+    }
+    ++est->num_samples;
+    xSemaphoreGive(mutex);
+    ESP_LOGI(LOG_TAG, "%s took %.0fms, estimate %.0fms +/- %.0fms over %lu samples", window_names[window], sample_ms, est->mean_ms, est->deviation_ms, est->num_samples);
+}
+
+void prep_window_close(int window)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    if (!is_measuring[window])
+    {
+        xSemaphoreGive(mutex);
+        return;
+    }
+    is_measuring[window] = false;
+    unsigned long elapsed_ms = millis() - begin_millis[window];
+    prep_window_estimate_t *est = &estimates[window];
+    if (est->num_samples > 0)
+    {
+        // The result takes longer than the window that has just closed, which is itself capped to the worst case.
+        est->mean_ms = max(est->mean_ms, (float)(elapsed_ms * PREP_WINDOW_TOO_SHORT_GROWTH));
+    }
+    xSemaphoreGive(mutex);
+    ESP_LOGW(LOG_TAG, "%s window closed after %lums before the result arrived, estimate grows to %.0fms", window_names[window], elapsed_ms, est->mean_ms);
+}
+
+int prep_window_get_ms(int window, int worst_case_ms, int margin_ms)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    prep_window_estimate_t est = estimates[window];
+    xSemaphoreGive(mutex);
+    if (est.num_samples < PREP_WINDOW_MIN_SAMPLES)
+    {
+        return worst_case_ms;
+    }
+    return min((int)(est.mean_ms + PREP_WINDOW_DEVIATIONS * est.deviation_ms) + margin_ms, worst_case_ms);
+}
@@ -0,0 +1,171 @@
+#include <Arduino.h>
+#include <lmic.h>
+#include "airtime.h"
+#include "data_packet.h"
+#include "rx_timing.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// rx_timing_dio_t is a DIO interrupt raised by the radio during an uplink.
+typedef struct
+{
+    int dio;
+    int64_t timestamp_us;
+    // The LMIC states of the receive window in progress, copied when the interrupt arrives.
+    ostime_t rxtime, txend;
+    uint8_t rxsyms, dndr, rx_delay_sec;
+} rx_timing_dio_t;
+
+// rx_timing_histogram_t counts the measurements falling into each bucket.
+typedef struct
+{
+    uint32_t buckets[RX_TIMING_NUM_BUCKETS];
+} rx_timing_histogram_t;
+
+// The upper boundaries of the histogram buckets, the last bucket is unbounded.
+static const int32_t bucket_upper_us[RX_TIMING_NUM_BUCKETS - 1] = {
+    -64000, -32000, -16000, -8000, -4000, -2000, -1000, 0, 1000, 2000, 4000, 8000, 16000, 32000, 64000};
+
+// The interrupts of an uplink are written by the interrupt service routines and read by the LoRaWAN event task after
+// LMIC has closed the receive windows.
+static rx_timing_dio_t dio_events[RX_TIMING_MAX_DIO_EVENTS];
+static volatile int num_dio_events = 0;
+
+static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+static unsigned long num_uplinks = 0, num_windows = 0, num_preambles = 0, num_expected = 0, num_missed = 0, num_late_windows = 0;
+static rx_timing_histogram_t open_late, open_offset, downlink_offset;
+static unsigned long last_report_millis = 0;
+
+void IRAM_ATTR rx_timing_record_dio(int dio)
+{
+    int i = num_dio_events;
+    if (i >= RX_TIMING_MAX_DIO_EVENTS)
+    {
+        return;
+    }
+    dio_events[i].dio = dio;
+    dio_events[i].timestamp_us = esp_timer_get_time();
+    dio_events[i].rxtime = LMIC.rxtime;
+    dio_events[i].txend = LMIC.txend;
+    dio_events[i].rxsyms = LMIC.rxsyms;
+    dio_events[i].dndr = LMIC.dndr;
+    dio_events[i].rx_delay_sec = LMIC.rxDelay;
+    num_dio_events = i + 1;
+}
+
+void rx_timing_begin_uplink()
+{
+    num_dio_events = 0;
+}
+
+void rx_timing_histogram_add(rx_timing_histogram_t *histogram, int32_t value_us)
+{
+    int i = 0;
+    while (i < RX_TIMING_NUM_BUCKETS - 1 && value_us >= bucket_upper_us[i])
+    {
+        ++i;
+    }
+    ++histogram->buckets[i];
+}
+
+void rx_timing_end_uplink(bool expect_response, size_t downlink_phy_len)
+{
+    int num_events = num_dio_events;
+    if (num_events == 0 || dio_events[0].dio != 0)
+    {
+        ESP_LOGW(LOG_TAG, "missed the TX done interrupt of the uplink, there is nothing to measure");
+        return;
+    }
+    int64_t txend_us = dio_events[0].timestamp_us;
+    bool received = false;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    ++num_uplinks;
+    for (int window = 1; window < num_events; ++window)
+    {
+        const rx_timing_dio_t *event = &dio_events[window];
+        // LoRaWAN treats an RX1 delay of 0 as 1 second, RX2 opens a second after RX1.
+        int64_t nominal_us = (int64_t)(max((int)event->rx_delay_sec, 1) + window - 1) * 1000000;
+        int32_t scheduled_us = (int32_t)(osticks2us(event->rxtime - event->txend) - nominal_us);
+        uint32_t duration_us = event->rxsyms * airtime_get_symbol_us(event->dndr);
+        ++num_windows;
+        if (event->dio == 1)
+        {
+            // The window timed out without detecting a preamble, it was open for exactly its duration.
+            int32_t actual_us = (int32_t)(event->timestamp_us - txend_us - nominal_us - duration_us);
+            rx_timing_histogram_add(&open_late, actual_us - scheduled_us);
+            rx_timing_histogram_add(&open_offset, actual_us);
+            if (actual_us > 0)
+            {
+                ++num_late_windows;
+            }
+            ESP_LOGI(LOG_TAG, "RX%d at DR%d scheduled at %+dus, opened at %+dus for %uus, no preamble", window, event->dndr, scheduled_us, actual_us, duration_us);
+        }
+        else
+        {
+            // A frame that LMIC rejected, e.g. one addressed to another device, is assumed to be the shortest frame possible.
+            size_t phy_len = downlink_phy_len > 0 ? downlink_phy_len : AIRTIME_MAC_OVERHEAD_BYTES - 1;
+            int32_t arrival_us = (int32_t)(event->timestamp_us - txend_us - nominal_us - airtime_get_downlink_toa_us(event->dndr, phy_len));
+            rx_timing_histogram_add(&downlink_offset, arrival_us);
+            ++num_preambles;
+            received = true;
+            ESP_LOGI(LOG_TAG, "RX%d at DR%d scheduled at %+dus for %uus, received a downlink that arrived at %+dus", window, event->dndr, scheduled_us, duration_us, arrival_us);
+        }
+    }
+    if (expect_response)
+    {
+        ++num_expected;
+        if (!received)
+        {
+            ++num_missed;
+        }
+    }
+    xSemaphoreGive(mutex);
+}
+
+bool rx_timing_is_report_due()
+{
+    return num_uplinks >= RX_TIMING_REPORT_MIN_UPLINKS && (last_report_millis == 0 || millis() - last_report_millis >= RX_TIMING_REPORT_INTERVAL_SEC * 1000);
+}
+
+// rx_timing_write_histogram writes the buckets of the histogram into the packet and logs them.
+void rx_timing_write_histogram(DataPacket &pkt, const char *name, const rx_timing_histogram_t *histogram)
+{
+    char line[RX_TIMING_NUM_BUCKETS * 11 + 1] = {0};
+    size_t line_len = 0;
+    for (int i = 0; i < RX_TIMING_NUM_BUCKETS; ++i)
+    {
+        pkt.writeVarint(histogram->buckets[i], 4);
+        line_len += snprintf(line + line_len, sizeof(line) - line_len, " %u", histogram->buckets[i]);
+    }
+    ESP_LOGI(LOG_TAG, "%s histogram:%s", name, line);
+}
+
+size_t rx_timing_encode_report(uint8_t *buf, size_t max_len, int clock_error_pct)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    ESP_LOGI(LOG_TAG, "%lu uplinks, %lu receive windows, %lu preambles, %lu of %lu expected responses missed, %lu windows opened late, clock error allowance %d%%",
+             num_uplinks, num_windows, num_preambles, num_missed, num_expected, num_late_windows, clock_error_pct);
+    DataPacket pkt(buf, max_len);
+    pkt.writeBits(RX_TIMING_REPORT_VERSION, 2);
+    pkt.writeBits(clock_error_pct, 7);
+    pkt.writeVarint(num_uplinks, 7);
+    pkt.writeVarint(num_windows, 7);
+    pkt.writeVarint(num_preambles, 7);
+    pkt.writeVarint(num_expected, 7);
+    pkt.writeVarint(num_missed, 7);
+    pkt.writeVarint(num_late_windows, 7);
+    rx_timing_write_histogram(pkt, "open later than scheduled", &open_late);
+    rx_timing_write_histogram(pkt, "open off nominal", &open_offset);
+    rx_timing_write_histogram(pkt, "downlink arrival off nominal", &downlink_offset);
+    size_t len = pkt.overflow ? 0 : pkt.length();
+    if (len > 0)
+    {
+        num_uplinks = num_windows = num_preambles = num_expected = num_missed = num_late_windows = 0;
+        memset(&open_late, 0, sizeof(open_late));
+        memset(&open_offset, 0, sizeof(open_offset));
+        memset(&downlink_offset, 0, sizeof(downlink_offset));
+        last_report_millis = millis();
+    }
+    xSemaphoreGive(mutex);
+    return len;
+}
@@ -0,0 +1,182 @@
+#include <Arduino.h>
+#include <math.h>
+#include "send_on_delta.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// The thresholds are a little above the noise of each reading on a device that sits still.
+static const send_on_delta_rule_t status_rules[COMPACT_STATUS_NUM_FIELDS] = {
+    // Seconds since the last downlink.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Uptime in seconds.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Heap usage in KB.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 8},
+    // Battery voltage in millivolts.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 50},
+    // Power draw in milliamps.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 25},
+    // Battery is charging.
+    {.rule = SEND_ON_DELTA_ANY_CHANGE, .threshold = 0},
+    // Temperature in degrees celcius.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 0.2},
+    // Relative humidity in percent.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 2},
+    // Pressure in hPa.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 1},
+    // Altitude in metres, it is derived from the pressure.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Reset reasons and wake-up cause.
+    {.rule = SEND_ON_DELTA_ANY_CHANGE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_ANY_CHANGE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_ANY_CHANGE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_ANY_CHANGE, .threshold = 0},
+};
+
+static const send_on_delta_rule_t pos_rules[COMPACT_POS_NUM_FIELDS] = {
+    // Latitude and longitude, a 25 metres move is significant.
+    {.rule = SEND_ON_DELTA_DISTANCE, .threshold = 25},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Speed in km/h.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 5},
+    // Heading in degrees, it is meaningless when standing still.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // GPS altitude in metres.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 25},
+    // Age of the position, HDOP, and number of satellites.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Cumulative number of wifi packets.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Channel, RSSI, and MAC of the loudest wifi sender. The loudest sender alternates between neighbours of similar
+    // strength on a device that sits still, hence only the RSSI and the number of devices tell a change of surroundings.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 5},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Number of bluetooth devices.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 3},
+    // RSSI and MAC of the loudest bluetooth sender.
+    {.rule = SEND_ON_DELTA_ABSOLUTE, .threshold = 5},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+    // Cumulative wifi data size in KB.
+    {.rule = SEND_ON_DELTA_IGNORE, .threshold = 0},
+};
+
+// send_on_delta_sent_t is the latest frame of a kind that was sent.
+typedef struct
+{
+    double values[COMPACT_FRAME_MAX_FIELDS];
+    unsigned long timestamp_millis;
+    bool valid;
+} send_on_delta_sent_t;
+
+static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+static send_on_delta_sent_t last_sent[COMPACT_FRAME_KINDS];
+static int num_suppressed = 0;
+static unsigned long total_suppressed = 0;
+
+// send_on_delta_get_distance_metre returns the approximate distance between two nearby positions.
+double send_on_delta_get_distance_metre(double lat1, double lon1, double lat2, double lon2)
+{
+    // The equirectangular approximation is accurate enough for the distances in question.
+    const double earth_radius_metre = 6371000, deg_to_rad = M_PI / 180;
+    double x = (lon2 - lon1) * deg_to_rad * cos((lat1 + lat2) / 2 * deg_to_rad);
+    double y = (lat2 - lat1) * deg_to_rad;
+    return sqrt(x * x + y * y) * earth_radius_metre;
+}
+
+// send_on_delta_find_change returns the index of the first field that has changed significantly, or -1 if none has.
+int send_on_delta_find_change(const send_on_delta_rule_t *rules, size_t num_fields, const double *prev, const double *curr)
+{
+    for (size_t i = 0; i < num_fields; ++i)
+    {
+        switch (rules[i].rule)
+        {
+        case SEND_ON_DELTA_ABSOLUTE:
+            if (fabs(curr[i] - prev[i]) >= rules[i].threshold)
+            {
+                return i;
+            }
+            break;
+        case SEND_ON_DELTA_ANY_CHANGE:
+            if (curr[i] != prev[i])
+            {
+                return i;
+            }
+            break;
+        case SEND_ON_DELTA_DISTANCE:
+            if (i + 1 < num_fields && send_on_delta_get_distance_metre(prev[i], prev[i + 1], curr[i], curr[i + 1]) >= rules[i].threshold)
+            {
+                return i;
+            }
+            break;
+        }
+    }
+    return -1;
+}
+
+bool send_on_delta_check(int kind, const double *values)
+{
+    if (kind < 0 || kind >= COMPACT_FRAME_KINDS)
+    {
+        return true;
+    }
+    size_t num_fields;
+    compact_frame_get_schema(kind, &num_fields);
+    const send_on_delta_rule_t *rules = kind == COMPACT_FRAME_POS ? pos_rules : status_rules;
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    send_on_delta_sent_t *sent = &last_sent[kind];
+    bool is_heartbeat_due = !sent->valid || millis() - sent->timestamp_millis >= SEND_ON_DELTA_HEARTBEAT_SEC * 1000;
+    int changed_field = sent->valid ? send_on_delta_find_change(rules, num_fields, sent->values, values) : -1;
+    if (!is_heartbeat_due && changed_field == -1)
+    {
+        ++num_suppressed;
+        ++total_suppressed;
+        xSemaphoreGive(mutex);
+        ESP_LOGI(LOG_TAG, "suppressing frame kind %d, nothing has changed significantly in %lus", kind, (millis() - sent->timestamp_millis) / 1000);
+        return false;
+    }
+    xSemaphoreGive(mutex);
+    if (changed_field == -1)
+    {
+        ESP_LOGI(LOG_TAG, "sending frame kind %d as a heartbeat", kind);
+    }
+    else
+    {
+        ESP_LOGI(LOG_TAG, "sending frame kind %d, field %d has changed significantly", kind, changed_field);
+    }
+    return true;
+}
+
+void send_on_delta_commit(int kind, const double *values)
+{
+    if (kind < 0 || kind >= COMPACT_FRAME_KINDS)
+    {
+        return;
+    }
+    size_t num_fields;
+    compact_frame_get_schema(kind, &num_fields);
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    send_on_delta_sent_t *sent = &last_sent[kind];
+    memcpy(sent->values, values, num_fields * sizeof(double));
+    sent->timestamp_millis = millis();
+    sent->valid = true;
+    xSemaphoreGive(mutex);
+}
+
+int send_on_delta_take_num_suppressed()
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    int ret = num_suppressed;
+    num_suppressed = 0;
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+unsigned long send_on_delta_get_total_suppressed()
+{
+    return total_suppressed;
+}
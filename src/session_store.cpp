@@ -0,0 +1,116 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <time.h>
+#include <lmic.h>
+#include "power_management.h"
+#include "session_store.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+RTC_DATA_ATTR static session_checkpoint_t rtc_checkpoint;
+// uplinks_since_nvs_write counts the checkpoints since the last write of the backup copy.
+RTC_DATA_ATTR static int uplinks_since_nvs_write = 0;
+
+// session_store_checksum returns a FNV-1a hash of the checkpoint, excluding the checksum itself.
+uint32_t session_store_checksum(const session_checkpoint_t *checkpoint)
+{
+    const uint8_t *bytes = (const uint8_t *)checkpoint;
+    uint32_t hash = 2166136261;
+    for (size_t i = 0; i < offsetof(session_checkpoint_t, checksum); ++i)
+    {
+        hash = (hash ^ bytes[i]) * 16777619;
+    }
+    return hash;
+}
+
+bool session_store_is_valid(const session_checkpoint_t *checkpoint, uint32_t devaddr)
+{
+    return checkpoint->magic == SESSION_STORE_MAGIC && checkpoint->devaddr == devaddr && checkpoint->checksum == session_store_checksum(checkpoint);
+}
+
+// session_store_write_nvs writes the backup copy to NVS.
+void session_store_write_nvs(const session_checkpoint_t *checkpoint)
+{
+    Preferences prefs;
+    if (prefs.begin(SESSION_STORE_NVS_NAMESPACE, false))
+    {
+        prefs.putBytes(SESSION_STORE_NVS_KEY, checkpoint, sizeof(*checkpoint));
+        prefs.end();
+        uplinks_since_nvs_write = 0;
+        ESP_LOGI(LOG_TAG, "saved session backup to NVS, uplink frame counter %u", checkpoint->seqno_up);
+    }
+    else
+    {
+        ESP_LOGW(LOG_TAG, "failed to open NVS for saving the session backup");
+    }
+}
+
+void session_store_checkpoint()
+{
+    session_checkpoint_t checkpoint;
+    memset(&checkpoint, 0, sizeof(checkpoint));
+    checkpoint.magic = SESSION_STORE_MAGIC;
+    checkpoint.devaddr = LMIC.devaddr;
+    checkpoint.seqno_up = LMIC.seqnoUp;
+    checkpoint.seqno_dn = LMIC.seqnoDn;
+    checkpoint.channel_map = LMIC.channelMap;
+    checkpoint.tx_counter = power_get_lorawan_tx_counter();
+    if (power_get_last_transmission_timestamp() != 0)
+    {
+        checkpoint.last_tx_time_sec = (uint32_t)time(NULL) - (millis() - power_get_last_transmission_timestamp()) / 1000;
+    }
+    checkpoint.checksum = session_store_checksum(&checkpoint);
+    rtc_checkpoint = checkpoint;
+
+    if (++uplinks_since_nvs_write >= SESSION_STORE_NVS_INTERVAL || checkpoint.seqno_up <= 1)
+    {
+        session_store_write_nvs(&checkpoint);
+    }
+}
+
+bool session_store_restore(uint32_t devaddr)
+{
+    session_checkpoint_t checkpoint;
+    if (session_store_is_valid(&rtc_checkpoint, devaddr))
+    {
+        checkpoint = rtc_checkpoint;
+        ESP_LOGI(LOG_TAG, "restoring session from RTC memory, uplink frame counter %u", checkpoint.seqno_up);
+    }
+    else
+    {
+        Preferences prefs;
+        size_t len = 0;
+        if (prefs.begin(SESSION_STORE_NVS_NAMESPACE, true))
+        {
+            len = prefs.getBytes(SESSION_STORE_NVS_KEY, &checkpoint, sizeof(checkpoint));
+            prefs.end();
+        }
+        if (len != sizeof(checkpoint) || !session_store_is_valid(&checkpoint, devaddr))
+        {
+            ESP_LOGI(LOG_TAG, "there is no saved session, starting afresh");
+            return false;
+        }
+        // Up to SESSION_STORE_NVS_INTERVAL uplinks may have been transmitted since the backup was written.
+        checkpoint.seqno_up += SESSION_STORE_NVS_INTERVAL;
+        ESP_LOGI(LOG_TAG, "restoring session from NVS, uplink frame counter skips ahead to %u", checkpoint.seqno_up);
+        // Reserve the window right away, another power loss before the next backup must skip past it again.
+        checkpoint.checksum = session_store_checksum(&checkpoint);
+        rtc_checkpoint = checkpoint;
+        session_store_write_nvs(&checkpoint);
+    }
+    LMIC.seqnoUp = checkpoint.seqno_up;
+    LMIC.seqnoDn = checkpoint.seqno_dn;
+    if (checkpoint.channel_map != 0)
+    {
+        LMIC.channelMap = checkpoint.channel_map;
+    }
+    // The RTC time does not survive a power loss, in which case the last uplink is long gone anyway.
+    uint32_t now_sec = (uint32_t)time(NULL);
+    uint32_t sec_since_last_tx = UINT32_MAX;
+    if (checkpoint.last_tx_time_sec != 0 && now_sec >= checkpoint.last_tx_time_sec)
+    {
+        sec_since_last_tx = now_sec - checkpoint.last_tx_time_sec;
+    }
+    power_restore_lorawan_tx_schedule(checkpoint.tx_counter, sec_since_last_tx);
+    return true;
+}
@@ -14,7 +14,7 @@
 
 static const char LOG_TAG[] = __FILE__;
 static TaskHandle_t bluetooth_task, wifi_task, env_sensor_task,
-    gps_task, lorawan_task, oled_task, gp_button_task, power_task, supervisor_task;
+    gps_task, lorawan_event_task, lorawan_task, oled_task, gp_button_task, power_task, supervisor_task;
 
 static unsigned long gps_chars_processed_reading = 0;
 static int gps_consecutive_readings = 0;
@@ -82,6 +82,9 @@ void supervisor_setup()
     ESP_ERROR_CHECK(esp_task_wdt_add(gps_task));
     xTaskCreatePinnedToCore(env_sensor_task_loop, "env_sensor_task_loop", 8 * 1024, NULL, priority++, &env_sensor_task, 1);
     ESP_ERROR_CHECK(esp_task_wdt_add(env_sensor_task));
+    // The LMIC callback hands the events over to the event task, which must not preempt the LoRaWAN task running LMIC.
+    xTaskCreatePinnedToCore(lorawan_event_task_loop, "lorawan_event_task_loop", 8 * 1024, NULL, priority++, &lorawan_event_task, 1);
+    ESP_ERROR_CHECK(esp_task_wdt_add(lorawan_event_task));
     xTaskCreatePinnedToCore(lorawan_task_loop, "lorawan_task_loop", 16 * 1024, NULL, priority++, &lorawan_task, 1);
     ESP_ERROR_CHECK(esp_task_wdt_add(lorawan_task));
     xTaskCreatePinnedToCore(oled_task_loop, "oled_task_loop", 16 * 1024, NULL, priority++, &oled_task, 1);
@@ -112,6 +115,7 @@ void supervisor_check_task_stack()
                 sensor_stack_free_kb = uxTaskGetStackHighWaterMark(env_sensor_task) / 1024,
                 gps_stack_free_kb = uxTaskGetStackHighWaterMark(gps_task) / 1024,
                 lorawan_stack_free_kb = uxTaskGetStackHighWaterMark(lorawan_task) / 1024,
+                lorawan_event_stack_free_kb = uxTaskGetStackHighWaterMark(lorawan_event_task) / 1024,
                 oled_stack_free_kb = uxTaskGetStackHighWaterMark(oled_task) / 1024,
                 button_stack_free_kb = uxTaskGetStackHighWaterMark(gp_button_task) / 1024,
                 power_stack_free_kb = uxTaskGetStackHighWaterMark(power_task) / 1024,
@@ -120,6 +124,7 @@ void supervisor_check_task_stack()
         bluetooth_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB ||
         wifi_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB || sensor_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB ||
         gps_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB || lorawan_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB ||
+        lorawan_event_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB ||
         oled_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB || button_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB ||
         power_stack_free_kb < SUPERVISOR_FREE_MEM_RESET_THRESHOLD_KB)
     {
@@ -128,6 +133,7 @@ void supervisor_check_task_stack()
         ESP_LOGE(LOG_TAG, "gps task state: %d, min.free stack: %dKB", eTaskGetState(gps_task), gps_stack_free_kb);
         ESP_LOGE(LOG_TAG, "sensor task state: %d, min.free stack: %dKB", eTaskGetState(env_sensor_task), sensor_stack_free_kb);
         ESP_LOGE(LOG_TAG, "lorawan task state: %d, min.free stack: %dKB", eTaskGetState(lorawan_task), lorawan_stack_free_kb);
+        ESP_LOGE(LOG_TAG, "lorawan event task state: %d, min.free stack: %dKB", eTaskGetState(lorawan_event_task), lorawan_event_stack_free_kb);
         ESP_LOGE(LOG_TAG, "oled task state: %d, min.free stack: %dKB", eTaskGetState(oled_task), oled_stack_free_kb);
         ESP_LOGE(LOG_TAG, "GP button task state: %d, min.free stack: %dKB", eTaskGetState(gp_button_task), button_stack_free_kb);
         ESP_LOGE(LOG_TAG, "power task state: %d, min.free stack: %dKB", eTaskGetState(power_task), power_stack_free_kb);
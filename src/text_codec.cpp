@@ -0,0 +1,119 @@
+#include <Arduino.h>
+#include <ctype.h>
+#include "data_packet.h"
+#include "text_codec.h"
+
+static const char LOG_TAG[] = __FILE__;
+
+// symbols is the text represented by each symbol, the first two symbols are control symbols.
+static const char *const symbols[TEXT_CODEC_NUM_SYMBOLS] = {
+    "", "", " ",
+    "a", "b", "c", "d", "e", "f", "g", "h", "i", "j", "k", "l", "m",
+    "n", "o", "p", "q", "r", "s", "t", "u", "v", "w", "x", "y", "z",
+    "0", "1", "2", "3", "4", "5", "6", "7", "8", "9",
+    ".", ",", "?", "'", "!", "/", "(", ")", "&", ":", ";", "=", "+", "-", "_", "\"", "$", "@",
+    "the ", "and ", "ing", "you", "to ", "of ", "er"};
+
+// code_lens is the length of the canonical Huffman code of each symbol.
+static const uint8_t code_lens[TEXT_CODEC_NUM_SYMBOLS] = {
+    7, 8, 3,
+    4, 6, 6, 5, 4, 6, 6, 5, 4, 10, 7, 5, 6,
+    4, 4, 6, 10, 4, 4, 4, 6, 7, 6, 9, 6, 10,
+    9, 9, 9, 9, 9, 9, 9, 9, 8, 8,
+    7, 7, 8, 9, 8, 10, 11, 11, 11, 10, 11, 11, 11, 9, 11, 11, 11, 11,
+    6, 7, 8, 8, 7, 8, 7};
+
+// codes is the canonical Huffman code of each symbol, calculated from code_lens upon first use.
+static uint16_t codes[TEXT_CODEC_NUM_SYMBOLS];
+static bool codes_ready = false;
+
+// text_codec_build_codes assigns consecutive codes to the symbols ordered by code length and then symbol number.
+void text_codec_build_codes()
+{
+    uint16_t code = 0;
+    for (int len = 1; len <= TEXT_CODEC_MAX_CODE_LEN; ++len)
+    {
+        for (int sym = 0; sym < TEXT_CODEC_NUM_SYMBOLS; ++sym)
+        {
+            if (code_lens[sym] == len)
+            {
+                codes[sym] = code++;
+            }
+        }
+        code <<= 1;
+    }
+    codes_ready = true;
+}
+
+void text_codec_write_symbol(DataPacket &pkt, int sym)
+{
+    for (int bit = code_lens[sym] - 1; bit >= 0; --bit)
+    {
+        pkt.writeBits((codes[sym] >> bit) & 1, 1);
+    }
+}
+
+// text_codec_match_symbol returns the symbol that represents the longest prefix of the text, or -1 if there is none.
+int text_codec_match_symbol(const char *text, bool is_upper_case)
+{
+    int ret = -1;
+    size_t ret_len = 0;
+    for (int sym = TEXT_CODEC_SYMBOL_TOGGLE_CASE + 1; sym < TEXT_CODEC_NUM_SYMBOLS; ++sym)
+    {
+        size_t len = strlen(symbols[sym]);
+        if (len <= ret_len || strncmp(text, symbols[sym], len) != 0)
+        {
+            continue;
+        }
+        // The letters in upper case mode are matched separately, the fragments only exist in lower case.
+        if (is_upper_case && len > 1)
+        {
+            continue;
+        }
+        ret = sym;
+        ret_len = len;
+    }
+    return ret;
+}
+
+size_t text_codec_encode(const char *text, uint8_t *buf, size_t buf_len)
+{
+    if (!codes_ready)
+    {
+        text_codec_build_codes();
+    }
+    DataPacket pkt(buf, buf_len);
+    bool is_upper_case = false;
+    for (const char *pos = text; *pos != 0;)
+    {
+        char ch = *pos;
+        if (isalpha(ch) && (isupper(ch) != 0) != is_upper_case)
+        {
+            text_codec_write_symbol(pkt, TEXT_CODEC_SYMBOL_TOGGLE_CASE);
+            is_upper_case = !is_upper_case;
+        }
+        int sym;
+        if (is_upper_case && isalpha(ch))
+        {
+            char lower[2] = {(char)tolower(ch), 0};
+            sym = text_codec_match_symbol(lower, true);
+        }
+        else
+        {
+            sym = text_codec_match_symbol(pos, is_upper_case);
+        }
+        if (sym < 0)
+        {
+            ESP_LOGW(LOG_TAG, "character 0x%02x is not in the symbol table", ch);
+            return 0;
+        }
+        text_codec_write_symbol(pkt, sym);
+        pos += strlen(symbols[sym]);
+    }
+    text_codec_write_symbol(pkt, TEXT_CODEC_SYMBOL_END);
+    if (pkt.overflow)
+    {
+        return 0;
+    }
+    return pkt.length();
+}
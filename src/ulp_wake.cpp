@@ -0,0 +1,202 @@
+#include <Arduino.h>
+#include <esp_sleep.h>
+#include <driver/rtc_io.h>
+#include <soc/rtc_cntl_reg.h>
+#include <soc/rtc_io_reg.h>
+#include "hardware_facts.h"
+#include "power_management.h"
+#include "ulp_wake.h"
+
+#if defined(CONFIG_ESP32_ULP_COPROC_ENABLED) || defined(CONFIG_ULP_COPROC_ENABLED)
+#include <esp32/ulp.h>
+#define ULP_WAKE_HAS_COPROC 1
+#endif
+
+static const char LOG_TAG[] = __FILE__;
+
+static const char *reason_names[ULP_WAKE_NUM_REASONS] = {"power on", "timer", "button", "PMU IRQ", "other"};
+
+// The variables of the ULP program in RTC slow memory, by word offset. Only the lower 16 bits of a word are written by
+// the ULP program.
+enum
+{
+    VAR_REASON_BITS,
+    VAR_BUTTON_ARMED,
+    VAR_BUTTON_LOW_SAMPLES,
+    VAR_PMU_ARMED,
+    VAR_PMU_LOW_SAMPLES,
+    NUM_VARS
+};
+// The bits of VAR_REASON_BITS.
+static const int reason_bit_button = 1 << 0, reason_bit_pmu = 1 << 1;
+
+RTC_DATA_ATTR static int wake_reason = ULP_WAKE_REASON_POWER_ON;
+RTC_DATA_ATTR static unsigned long wake_counts[ULP_WAKE_NUM_REASONS];
+
+void ulp_wake_setup()
+{
+    esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+    switch (cause)
+    {
+    case ESP_SLEEP_WAKEUP_UNDEFINED:
+        wake_reason = ULP_WAKE_REASON_POWER_ON;
+        break;
+    case ESP_SLEEP_WAKEUP_TIMER:
+        wake_reason = ULP_WAKE_REASON_TIMER;
+        break;
+    case ESP_SLEEP_WAKEUP_EXT0:
+        wake_reason = ULP_WAKE_REASON_BUTTON;
+        break;
+#ifdef ULP_WAKE_HAS_COPROC
+    case ESP_SLEEP_WAKEUP_ULP:
+    {
+        uint32_t bits = RTC_SLOW_MEM[VAR_REASON_BITS] & 0xFFFF;
+        wake_reason = (bits & reason_bit_button) ? ULP_WAKE_REASON_BUTTON : (bits & reason_bit_pmu) ? ULP_WAKE_REASON_PMU_IRQ
+                                                                                                      : ULP_WAKE_REASON_OTHER;
+        break;
+    }
+#endif
+    default:
+        wake_reason = ULP_WAKE_REASON_OTHER;
+        break;
+    }
+    ++wake_counts[wake_reason];
+#ifdef ULP_WAKE_HAS_COPROC
+    // Stop the ULP timer, the program must not wake the main cores while they are running.
+    CLEAR_PERI_REG_MASK(RTC_CNTL_STATE0_REG, RTC_CNTL_ULP_CP_SLP_TIMER_EN);
+#endif
+    // Hand the lines back to the digital GPIO matrix for the regular interrupts and readings.
+    rtc_gpio_deinit((gpio_num_t)GENERIC_PURPOSE_BUTTON);
+    rtc_gpio_deinit((gpio_num_t)POWER_PMU_IRQ);
+    ESP_LOGI(LOG_TAG, "wake-up reason is %s (cause %d), woken up by button %lu times and by PMU IRQ %lu times", reason_names[wake_reason], cause,
+             wake_counts[ULP_WAKE_REASON_BUTTON], wake_counts[ULP_WAKE_REASON_PMU_IRQ]);
+}
+
+#ifdef ULP_WAKE_HAS_COPROC
+// ulp_wake_load_program loads the ULP program that debounces the button and the PMU IRQ line. It returns true on success.
+bool ulp_wake_load_program()
+{
+    enum
+    {
+        LABEL_BUTTON_HIGH,
+        LABEL_PMU,
+        LABEL_PMU_HIGH,
+        LABEL_HALT,
+        LABEL_WAKE,
+    };
+    const int button_bit = RTC_GPIO_IN_NEXT_S + rtc_io_number_get((gpio_num_t)GENERIC_PURPOSE_BUTTON);
+    const int pmu_bit = RTC_GPIO_IN_NEXT_S + rtc_io_number_get((gpio_num_t)POWER_PMU_IRQ);
+    const ulp_insn_t program[] = {
+        // R3 holds the base address of the variables, R0 the line level and the variables read, R2 the reason bits.
+        I_MOVI(R3, 0),
+        I_RD_REG(RTC_GPIO_IN_REG, button_bit, button_bit),
+        M_BGE(LABEL_BUTTON_HIGH, 1),
+        // The button is down, it counts only after it has been seen up.
+        I_LD(R0, R3, VAR_BUTTON_ARMED),
+        M_BL(LABEL_PMU, 1),
+        I_LD(R0, R3, VAR_BUTTON_LOW_SAMPLES),
+        I_ADDI(R0, R0, 1),
+        I_ST(R0, R3, VAR_BUTTON_LOW_SAMPLES),
+        M_BL(LABEL_PMU, ULP_WAKE_DEBOUNCE_SAMPLES),
+        I_MOVI(R2, reason_bit_button),
+        M_BX(LABEL_WAKE),
+        M_LABEL(LABEL_BUTTON_HIGH),
+        I_MOVI(R0, 1),
+        I_ST(R0, R3, VAR_BUTTON_ARMED),
+        I_MOVI(R0, 0),
+        I_ST(R0, R3, VAR_BUTTON_LOW_SAMPLES),
+
+        M_LABEL(LABEL_PMU),
+        I_RD_REG(RTC_GPIO_IN_REG, pmu_bit, pmu_bit),
+        M_BGE(LABEL_PMU_HIGH, 1),
+        I_LD(R0, R3, VAR_PMU_ARMED),
+        M_BL(LABEL_HALT, 1),
+        I_LD(R0, R3, VAR_PMU_LOW_SAMPLES),
+        I_ADDI(R0, R0, 1),
+        I_ST(R0, R3, VAR_PMU_LOW_SAMPLES),
+        M_BL(LABEL_HALT, ULP_WAKE_DEBOUNCE_SAMPLES),
+        I_MOVI(R2, reason_bit_pmu),
+        M_BX(LABEL_WAKE),
+        M_LABEL(LABEL_PMU_HIGH),
+        I_MOVI(R0, 1),
+        I_ST(R0, R3, VAR_PMU_ARMED),
+        I_MOVI(R0, 0),
+        I_ST(R0, R3, VAR_PMU_LOW_SAMPLES),
+
+        M_LABEL(LABEL_HALT),
+        I_HALT(),
+
+        // The main cores cannot be woken up while they are still on their way into deep sleep, try again on the next
+        // sample, the line is still low by then.
+        M_LABEL(LABEL_WAKE),
+        I_RD_REG(RTC_CNTL_LOW_POWER_ST_REG, RTC_CNTL_RDY_FOR_WAKEUP_S, RTC_CNTL_RDY_FOR_WAKEUP_S),
+        M_BL(LABEL_HALT, 1),
+        I_ST(R2, R3, VAR_REASON_BITS),
+        I_WAKE(),
+        // Stop the ULP timer until the program is armed again.
+        I_END(),
+        I_HALT(),
+    };
+    for (int i = 0; i < NUM_VARS; ++i)
+    {
+        RTC_SLOW_MEM[i] = 0;
+    }
+    size_t size = sizeof(program) / sizeof(program[0]);
+    esp_err_t err = ulp_process_macros_and_load(ULP_WAKE_PROGRAM_OFFSET, program, &size);
+    if (err != ESP_OK)
+    {
+        ESP_LOGW(LOG_TAG, "failed to load the ULP program (%s)", esp_err_to_name(err));
+        return false;
+    }
+    return true;
+}
+#endif
+
+void ulp_wake_arm()
+{
+#ifdef ULP_WAKE_HAS_COPROC
+    if (ulp_wake_load_program())
+    {
+        gpio_num_t lines[] = {(gpio_num_t)GENERIC_PURPOSE_BUTTON, (gpio_num_t)POWER_PMU_IRQ};
+        for (gpio_num_t line : lines)
+        {
+            // Both lines have external pull-up resistors, the pins are input only.
+            rtc_gpio_init(line);
+            rtc_gpio_set_direction(line, RTC_GPIO_MODE_INPUT_ONLY);
+        }
+        // The ULP program reads the RTC IO registers, which are powered down in deep sleep by default.
+        esp_sleep_pd_config(ESP_PD_DOMAIN_RTC_PERIPH, ESP_PD_OPTION_ON);
+        ulp_set_wakeup_period(0, ULP_WAKE_SAMPLE_INTERVAL_MS * 1000);
+        esp_err_t err = ulp_run(ULP_WAKE_PROGRAM_OFFSET);
+        if (err == ESP_OK)
+        {
+            esp_sleep_enable_ulp_wakeup();
+            ESP_LOGI(LOG_TAG, "the button and PMU IRQ will wake up the main cores");
+            return;
+        }
+        ESP_LOGW(LOG_TAG, "failed to start the ULP program (%s)", esp_err_to_name(err));
+    }
+#endif
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)GENERIC_PURPOSE_BUTTON, 0);
+    ESP_LOGI(LOG_TAG, "the button will wake up the main cores");
+}
+
+int ulp_wake_get_reason()
+{
+    return wake_reason;
+}
+
+bool ulp_wake_is_fast_boot()
+{
+    return wake_reason == ULP_WAKE_REASON_TIMER;
+}
+
+const char *ulp_wake_get_reason_name(int reason)
+{
+    return reason_names[reason];
+}
+
+unsigned long ulp_wake_get_count(int reason)
+{
+    return wake_counts[reason];
+}
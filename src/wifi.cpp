@@ -6,14 +6,14 @@
 
 #include "power_management.h"
 #include "bluetooth.h"
+#include "prep_window.h"
 #include "wifi.h"
-#include "oled.h"
 
 static const char LOG_TAG[] = __FILE__;
 
 static bool is_powered_on = false;
 
-static unsigned long round_num = 0;
+static unsigned long round_num = 0, rounds_since_on = 0;
 static size_t channel_num = 1;
 static size_t pkt_counter = 0;
 static size_t pkt_size_sum = 0;
@@ -43,6 +43,7 @@ void wifi_on()
     ESP_LOGI(LOG_TAG, "turning on WiFi");
     memset(&channel_pkt_counter, 0, WIFI_MAX_CHANNEL_NUM);
     memset(&channel_pkt_size_sum, 0, WIFI_MAX_CHANNEL_NUM);
+    rounds_since_on = 0;
     power_set_cpu_freq_mhz(POWER_DEFAULT_CPU_FREQ_MHZ);
     wifi_init_config_t wifi_init_conf = WIFI_INIT_CONFIG_DEFAULT();
     wifi_init_conf.nvs_enable = 0;
@@ -92,16 +93,17 @@ void wifi_task_loop(void *_)
     while (true)
     {
         esp_task_wdt_reset();
-        if ((power_get_todo() & POWER_TODO_TURN_ON_WIFI) || (oled_get_state() && oled_get_page_number() == OLED_PAGE_WIFI_INFO))
+        if (power_get_todo() & POWER_TODO_TURN_ON_WIFI)
         {
             wifi_on();
             wifi_next_channel();
+            vTaskDelay(pdMS_TO_TICKS(WIFI_TASK_LOOP_DELAY_MS));
         }
         else
         {
             wifi_off();
+            power_wait_todo(POWER_TODO_TURN_ON_WIFI, POWER_TODO_WAIT_TIMEOUT_MS);
         }
-        vTaskDelay(pdMS_TO_TICKS(WIFI_TASK_LOOP_DELAY_MS));
     }
 }
 
@@ -134,7 +136,12 @@ void wifi_next_channel()
     esp_wifi_set_channel(channel_num, WIFI_SECOND_CHAN_NONE);
     channel_pkt_counter[channel_num] = 0;
     channel_pkt_size_sum[channel_num] = 0;
+    bool is_round_done = channel_num == 1;
     power_wifi_bt_unlock();
+    if (is_round_done && ++rounds_since_on == PREP_WINDOW_SCAN_ROUNDS)
+    {
+        prep_window_end(PREP_WINDOW_WIFI);
+    }
 }
 
 int wifi_get_last_loudest_sender_rssi()
@@ -0,0 +1,49 @@
+#pragma once
+
+// The host stand-ins of the few Arduino and FreeRTOS facilities used by the hardware independent modules, which are built
+// and tested on the host in the native environment (pio test -e native).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
+using std::max;
+using std::min;
+
+#define RTC_DATA_ATTR
+
+#define ESP_LOGE(tag, ...) ((void)(tag))
+#define ESP_LOGW(tag, ...) ((void)(tag))
+#define ESP_LOGI(tag, ...) ((void)(tag))
+#define ESP_LOGD(tag, ...) ((void)(tag))
+
+typedef std::mutex *SemaphoreHandle_t;
+#define portMAX_DELAY 0xFFFFFFFF
+#define pdTRUE 1
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    return new std::mutex();
+}
+
+inline int xSemaphoreTake(SemaphoreHandle_t mutex, uint32_t)
+{
+    mutex->lock();
+    return pdTRUE;
+}
+
+inline int xSemaphoreGive(SemaphoreHandle_t mutex)
+{
+    mutex->unlock();
+    return pdTRUE;
+}
+
+inline unsigned long millis()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+// The host stand-in of the I2C bus, a register file of a single device that the tests fill in.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+class TwoWire
+{
+public:
+    uint8_t regs[256];
+    // is_present is false to make each transaction fail as if the device did not acknowledge.
+    bool is_present = true;
+
+    void beginTransmission(uint8_t) {}
+
+    size_t write(uint8_t reg)
+    {
+        cursor = reg;
+        return 1;
+    }
+
+    uint8_t endTransmission(bool = true)
+    {
+        return is_present ? 0 : 2;
+    }
+
+    size_t requestFrom(int, int len)
+    {
+        return is_present ? len : 0;
+    }
+
+    size_t readBytes(uint8_t *buf, size_t len)
+    {
+        for (size_t i = 0; i < len; ++i)
+        {
+            buf[i] = regs[(uint8_t)(cursor + i)];
+        }
+        cursor += len;
+        return len;
+    }
+
+private:
+    uint8_t cursor = 0;
+};
+
+// stub_wire returns the bus shared by all translation units.
+inline TwoWire &stub_wire()
+{
+    static TwoWire wire;
+    return wire;
+}
+
+#define Wire stub_wire()
@@ -0,0 +1,314 @@
+#include <unity.h>
+#include "compact_frame.h"
+#include "data_packet.h"
+
+// TEST_FUZZ_SEED seeds the random field values of the fuzz test, a failure reproduces with the same seed.
+#define TEST_FUZZ_SEED 20261016
+// TEST_FUZZ_NUM_FRAMES is the number of frames of each kind encoded by the fuzz test.
+#define TEST_FUZZ_NUM_FRAMES 5000
+
+// The frames are encoded in sequence, each test continues from the state the previous one left behind.
+static double values[COMPACT_POS_NUM_FIELDS];
+static uint8_t frame[64];
+static size_t frame_len = 0;
+
+// read_header reads the frame header, checks the format version, and stores the delta flag and key frame ID.
+void read_header(DataPacketReader &reader, bool *is_delta, int *key_id)
+{
+    TEST_ASSERT_EQUAL(COMPACT_FRAME_VERSION, reader.readBits(2));
+    *is_delta = reader.readBits(1) == 1;
+    *key_id = reader.readBits(5);
+}
+
+// quantise returns the value of the field as encoded, before clamping.
+int32_t quantise(const compact_field_t *field, double val)
+{
+    return (int32_t)round((val - field->offset) / field->resolution);
+}
+
+// quantise_clamped returns the value of the field as encoded, after clamping to the range of the field.
+int32_t quantise_clamped(const compact_field_t *field, double val)
+{
+    double scaled = round((val - field->offset) / field->resolution);
+    double min = 0, max = INT32_MAX;
+    if (field->encoding == COMPACT_FIELD_UNSIGNED)
+    {
+        max = (1 << field->bits) - 1;
+    }
+    else if (field->encoding == COMPACT_FIELD_SIGNED)
+    {
+        min = -(1 << (field->bits - 1));
+        max = (1 << (field->bits - 1)) - 1;
+    }
+    return (int32_t)(scaled < min ? min : scaled > max ? max : scaled);
+}
+
+// fuzz_state is the xorshift32 state of the fuzz test.
+static uint32_t fuzz_state = TEST_FUZZ_SEED;
+
+uint32_t fuzz_next()
+{
+    fuzz_state ^= fuzz_state << 13;
+    fuzz_state ^= fuzz_state >> 17;
+    fuzz_state ^= fuzz_state << 5;
+    return fuzz_state;
+}
+
+// fuzz_value returns a random value for the field, a quarter of which lie outside of the field's range.
+double fuzz_value(const compact_field_t *field)
+{
+    // The varint fields are drawn from the lower 24 bits of their range, the rest is covered by the out-of-range values.
+    double min = 0, max = (1 << 24) - 1;
+    if (field->encoding == COMPACT_FIELD_UNSIGNED)
+    {
+        max = (1 << field->bits) - 1;
+    }
+    else if (field->encoding == COMPACT_FIELD_SIGNED)
+    {
+        min = -(1 << (field->bits - 1));
+        max = (1 << (field->bits - 1)) - 1;
+    }
+    double scaled = min + (max - min) * (fuzz_next() / (double)UINT32_MAX);
+    switch (fuzz_next() % 8)
+    {
+    case 0:
+        scaled = min - 1 - (max - min) * (fuzz_next() / (double)UINT32_MAX);
+        break;
+    case 1:
+        scaled = max + 1 + 1e10 * (fuzz_next() / (double)UINT32_MAX);
+        break;
+    }
+    return scaled * field->resolution + field->offset;
+}
+
+// read_frame decodes a frame of the kind into quantised, given the quantised values of the acknowledged key frame.
+void read_frame(int kind, const uint8_t *buf, size_t len, const int32_t *reference, int reference_id, bool *is_delta, int *key_id, int32_t *quantised)
+{
+    size_t num_fields;
+    const compact_field_t *schema = compact_frame_get_schema(kind, &num_fields);
+    DataPacketReader reader(buf, len);
+    read_header(reader, is_delta, key_id);
+    if (*is_delta)
+    {
+        TEST_ASSERT_EQUAL(reference_id, *key_id);
+        bool is_changed[COMPACT_FRAME_MAX_FIELDS];
+        for (size_t i = 0; i < num_fields; ++i)
+        {
+            is_changed[i] = reader.readBits(1) == 1;
+        }
+        for (size_t i = 0; i < num_fields; ++i)
+        {
+            quantised[i] = reference[i] + (is_changed[i] ? reader.readZigZagVarint(schema[i].delta_bits) : 0);
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < num_fields; ++i)
+        {
+            switch (schema[i].encoding)
+            {
+            case COMPACT_FIELD_UNSIGNED:
+                quantised[i] = reader.readBits(schema[i].bits);
+                break;
+            case COMPACT_FIELD_SIGNED:
+                quantised[i] = reader.readSignedBits(schema[i].bits);
+                break;
+            default:
+                quantised[i] = reader.readVarint(schema[i].bits);
+                break;
+            }
+        }
+    }
+    TEST_ASSERT_FALSE(reader.overflow);
+    TEST_ASSERT_EQUAL(len, (reader.bit_cursor + 7) / 8);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_key_frame_round_trip()
+{
+    values[COMPACT_POS_LATITUDE] = 52.52001;
+    values[COMPACT_POS_LONGITUDE] = -13.40495;
+    values[COMPACT_POS_SPEED_KMH] = 93;
+    values[COMPACT_POS_HEADING_DEG] = 270;
+    values[COMPACT_POS_ALTITUDE_METRE] = -12;
+    values[COMPACT_POS_HDOP] = 2;
+    values[COMPACT_POS_SATELLITES] = 9;
+    values[COMPACT_POS_WIFI_RSSI] = -67;
+    values[COMPACT_POS_WIFI_MAC_HI] = 0xA4CF12;
+    values[COMPACT_POS_WIFI_MAC_LO] = 0x3456FE;
+    values[COMPACT_POS_BT_RSSI] = -120;
+    values[COMPACT_POS_WIFI_DATA_KB] = 70000;
+    frame_len = compact_frame_encode(COMPACT_FRAME_POS, values, frame, sizeof(frame));
+    TEST_ASSERT_TRUE(frame_len > 0);
+
+    size_t num_fields;
+    const compact_field_t *schema = compact_frame_get_schema(COMPACT_FRAME_POS, &num_fields);
+    TEST_ASSERT_EQUAL(COMPACT_POS_NUM_FIELDS, num_fields);
+    DataPacketReader reader(frame, frame_len);
+    bool is_delta;
+    int key_id;
+    read_header(reader, &is_delta, &key_id);
+    TEST_ASSERT_FALSE(is_delta);
+    for (size_t i = 0; i < num_fields; ++i)
+    {
+        int32_t val;
+        switch (schema[i].encoding)
+        {
+        case COMPACT_FIELD_UNSIGNED:
+            val = reader.readBits(schema[i].bits);
+            break;
+        case COMPACT_FIELD_SIGNED:
+            val = reader.readSignedBits(schema[i].bits);
+            break;
+        default:
+            val = reader.readVarint(schema[i].bits);
+            break;
+        }
+        TEST_ASSERT_EQUAL_INT_MESSAGE(quantise(&schema[i], values[i]), val, schema[i].name);
+    }
+    TEST_ASSERT_FALSE(reader.overflow);
+    // Nothing but the padding of the last byte follows.
+    TEST_ASSERT_EQUAL(frame_len, (reader.bit_cursor + 7) / 8);
+}
+
+void test_delta_frame_after_acknowledgement()
+{
+    uint8_t key_header = frame[0];
+    compact_frame_acknowledge(COMPACT_FRAME_POS, key_header);
+    values[COMPACT_POS_LATITUDE] += 0.00010;
+    values[COMPACT_POS_SATELLITES] -= 3;
+    frame_len = compact_frame_encode(COMPACT_FRAME_POS, values, frame, sizeof(frame));
+    TEST_ASSERT_TRUE(frame_len > 0);
+
+    size_t num_fields;
+    const compact_field_t *schema = compact_frame_get_schema(COMPACT_FRAME_POS, &num_fields);
+    DataPacketReader reader(frame, frame_len);
+    bool is_delta;
+    int key_id;
+    read_header(reader, &is_delta, &key_id);
+    TEST_ASSERT_EQUAL(key_header >> 3, key_id);
+    TEST_ASSERT_TRUE(is_delta);
+    for (size_t i = 0; i < num_fields; ++i)
+    {
+        TEST_ASSERT_EQUAL_INT_MESSAGE(i == COMPACT_POS_LATITUDE || i == COMPACT_POS_SATELLITES, reader.readBits(1), schema[i].name);
+    }
+    TEST_ASSERT_EQUAL(10, reader.readZigZagVarint(schema[COMPACT_POS_LATITUDE].delta_bits));
+    TEST_ASSERT_EQUAL(-3, reader.readZigZagVarint(schema[COMPACT_POS_SATELLITES].delta_bits));
+    TEST_ASSERT_FALSE(reader.overflow);
+}
+
+void test_discarded_frame_keeps_key_id()
+{
+    // A status frame does not fit into a single byte, it is discarded without using up a key frame ID.
+    double status[COMPACT_STATUS_NUM_FIELDS] = {0};
+    uint8_t status_frame[64];
+    TEST_ASSERT_EQUAL(0, compact_frame_encode(COMPACT_FRAME_STATUS, status, status_frame, 1));
+    size_t len = compact_frame_encode(COMPACT_FRAME_STATUS, status, status_frame, sizeof(status_frame));
+    TEST_ASSERT_TRUE(len > 0);
+    // The position key frame took ID 0.
+    DataPacketReader reader(status_frame, len);
+    bool is_delta;
+    int key_id;
+    read_header(reader, &is_delta, &key_id);
+    TEST_ASSERT_EQUAL(1, key_id);
+    TEST_ASSERT_FALSE(is_delta);
+}
+
+void test_stale_acknowledgement_is_ignored()
+{
+    double status[COMPACT_STATUS_NUM_FIELDS] = {0};
+    uint8_t stale[64], latest[64];
+    compact_frame_encode(COMPACT_FRAME_STATUS, status, stale, sizeof(stale));
+    status[COMPACT_STATUS_UPTIME_SEC] = 60;
+    compact_frame_encode(COMPACT_FRAME_STATUS, status, latest, sizeof(latest));
+    // The acknowledgement of an older key frame does not make the latest key frame the reference.
+    compact_frame_acknowledge(COMPACT_FRAME_STATUS, stale[0]);
+    size_t len = compact_frame_encode(COMPACT_FRAME_STATUS, status, stale, sizeof(stale));
+    DataPacketReader reader(stale, len);
+    bool is_delta;
+    int key_id;
+    read_header(reader, &is_delta, &key_id);
+    TEST_ASSERT_FALSE(is_delta);
+}
+
+void test_random_frames_round_trip()
+{
+    for (int kind = 0; kind < COMPACT_FRAME_KINDS; ++kind)
+    {
+        size_t num_fields;
+        const compact_field_t *schema = compact_frame_get_schema(kind, &num_fields);
+        double fuzz_values[COMPACT_FRAME_MAX_FIELDS] = {0};
+        uint8_t buf[256];
+        int32_t reference[COMPACT_FRAME_MAX_FIELDS], decoded[COMPACT_FRAME_MAX_FIELDS];
+        bool is_delta = true;
+        int key_id = 0, reference_id = -1;
+        // The previous tests left a reference behind, start over from a key frame acknowledged here.
+        for (int i = 0; i <= COMPACT_FRAME_MAX_DELTAS && is_delta; ++i)
+        {
+            size_t len = compact_frame_encode(kind, fuzz_values, buf, sizeof(buf));
+            DataPacketReader reader(buf, len);
+            read_header(reader, &is_delta, &key_id);
+        }
+        TEST_ASSERT_FALSE(is_delta);
+        compact_frame_acknowledge(kind, buf[0]);
+        for (size_t i = 0; i < num_fields; ++i)
+        {
+            reference[i] = quantise_clamped(&schema[i], 0);
+        }
+        reference_id = key_id;
+
+        int num_keys = 0, num_deltas = 0;
+        for (int n = 0; n < TEST_FUZZ_NUM_FRAMES; ++n)
+        {
+            // Change a random subset of the fields, so that the delta frames carry anything from none to all of them.
+            uint32_t num_changes = fuzz_next() % (num_fields + 1);
+            for (uint32_t i = 0; i < num_changes; ++i)
+            {
+                size_t field = fuzz_next() % num_fields;
+                fuzz_values[field] = fuzz_value(&schema[field]);
+            }
+            size_t len = compact_frame_encode(kind, fuzz_values, buf, sizeof(buf));
+            TEST_ASSERT_TRUE(len > 0);
+            read_frame(kind, buf, len, reference, reference_id, &is_delta, &key_id, decoded);
+            for (size_t i = 0; i < num_fields; ++i)
+            {
+                TEST_ASSERT_EQUAL_INT_MESSAGE(quantise_clamped(&schema[i], fuzz_values[i]), decoded[i], schema[i].name);
+            }
+            if (is_delta)
+            {
+                ++num_deltas;
+            }
+            else
+            {
+                ++num_keys;
+                // Acknowledge a third of the key frames, the rest are lost as far as the encoder knows.
+                if (fuzz_next() % 3 == 0)
+                {
+                    compact_frame_acknowledge(kind, buf[0]);
+                    memcpy(reference, decoded, sizeof(decoded));
+                    reference_id = key_id;
+                }
+            }
+        }
+        TEST_ASSERT_TRUE(num_keys > 0);
+        TEST_ASSERT_TRUE(num_deltas > 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_key_frame_round_trip);
+    RUN_TEST(test_delta_frame_after_acknowledgement);
+    RUN_TEST(test_discarded_frame_keeps_key_id);
+    RUN_TEST(test_stale_acknowledgement_is_ignored);
+    RUN_TEST(test_random_frames_round_trip);
+    return UNITY_END();
+}
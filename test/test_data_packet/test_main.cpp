@@ -0,0 +1,130 @@
+#include <unity.h>
+#include <new>
+#include <stdlib.h>
+#include "compact_frame.h"
+#include "data_packet.h"
+#include "text_codec.h"
+
+// num_allocs counts the heap allocations made while counting is on.
+static unsigned long num_allocs = 0;
+static bool is_counting = false;
+
+void *operator new(size_t size)
+{
+    if (is_counting)
+    {
+        ++num_allocs;
+    }
+    void *ret = malloc(size);
+    if (ret == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return ret;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+#ifdef __GLIBC__
+// glibc lets the program interpose malloc and calloc, which DataPacket used to call.
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+
+extern "C" void *malloc(size_t size)
+{
+    if (is_counting)
+    {
+        ++num_allocs;
+    }
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t num, size_t size)
+{
+    if (is_counting)
+    {
+        ++num_allocs;
+    }
+    return __libc_calloc(num, size);
+}
+#endif
+
+void setUp()
+{
+    num_allocs = 0;
+    is_counting = false;
+}
+
+void tearDown()
+{
+}
+
+void test_round_trip()
+{
+    uint8_t buf[16];
+    DataPacket pkt(buf, sizeof(buf));
+    pkt.writeBits(6, 3);
+    pkt.writeSignedBits(-3, 4);
+    pkt.writeVarint(100, 3);
+    pkt.writeZigZagVarint(-1234, 5);
+    pkt.writeBits(0xDEADBEEF, 32);
+    TEST_ASSERT_FALSE(pkt.overflow);
+    TEST_ASSERT_EQUAL(3 + 4 + 3 * 4 + 3 * 6 + 32, pkt.bit_cursor);
+
+    DataPacketReader reader(buf, pkt.length());
+    TEST_ASSERT_EQUAL(6, reader.readBits(3));
+    TEST_ASSERT_EQUAL(-3, reader.readSignedBits(4));
+    TEST_ASSERT_EQUAL(100, reader.readVarint(3));
+    TEST_ASSERT_EQUAL(-1234, reader.readZigZagVarint(5));
+    TEST_ASSERT_EQUAL_UINT32(0xDEADBEEF, reader.readBits(32));
+    TEST_ASSERT_FALSE(reader.overflow);
+}
+
+void test_overflow_stays_in_buffer()
+{
+    // The guard bytes on either side of the buffer must never be written.
+    uint8_t buf[6];
+    memset(buf, 0xA5, sizeof(buf));
+    DataPacket pkt(buf + 1, 4);
+    pkt.writeBits(0xFFFFFFFF, 30);
+    pkt.writeBits(0xF, 4);
+    TEST_ASSERT_TRUE(pkt.overflow);
+    TEST_ASSERT_EQUAL(30, pkt.bit_cursor);
+    TEST_ASSERT_EQUAL(4, pkt.length());
+    TEST_ASSERT_EQUAL_UINT8(0xA5, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(0xA5, buf[5]);
+}
+
+// The test covers the encoders only. The transmission queue in lorawan.cpp (lorawan_begin_uplink, lorawan_commit_uplink,
+// and lorawan_dequeue_uplink) is entangled with LMIC and FreeRTOS and does not build on the host. Its single copy, by
+// LMIC_setTxData2_strict into the LMIC frame buffer, is checked by reading rather than by a test.
+void test_encoders_do_not_allocate()
+{
+    double values[COMPACT_FRAME_MAX_FIELDS] = {0};
+    values[COMPACT_STATUS_UPTIME_SEC] = 86400;
+    values[COMPACT_STATUS_BATT_MILLIVOLT] = 4012;
+    values[COMPACT_STATUS_TEMP_CELCIUS] = 21.45;
+    uint8_t frame[64], text[64];
+    // Encode once beforehand, so that only the steady state is counted.
+    compact_frame_encode(COMPACT_FRAME_STATUS, values, frame, sizeof(frame));
+
+    is_counting = true;
+    size_t frame_len = compact_frame_encode(COMPACT_FRAME_STATUS, values, frame, sizeof(frame));
+    size_t text_len = text_codec_encode("meet you at the station", text, sizeof(text));
+    is_counting = false;
+    TEST_ASSERT_TRUE(frame_len > 0);
+    TEST_ASSERT_TRUE(text_len > 0);
+    TEST_ASSERT_EQUAL(0, num_allocs);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip);
+    RUN_TEST(test_overflow_stays_in_buffer);
+    RUN_TEST(test_encoders_do_not_allocate);
+    return UNITY_END();
+}
@@ -0,0 +1,140 @@
+#include <unity.h>
+#include <Wire.h>
+#include "pmu_sample.h"
+
+// The register dumps are put together from the register layout in the datasheets, they decode to round figures.
+
+// AXP192 on USB power, charging the battery.
+static const uint8_t axp192_charging_status[PMU_SAMPLE_STATUS_LEN] = {0x20, 0x60};
+static uint8_t axp192_charging_adc[PMU_SAMPLE_AXP192_ADC_LEN];
+static const uint8_t axp192_coulomb[PMU_SAMPLE_AXP192_COULOMB_LEN] = {0x00, 0x01, 0x23, 0x45, 0x00, 0x00, 0xAB, 0xCD};
+
+// AXP192 on battery power.
+static const uint8_t axp192_discharging_status[PMU_SAMPLE_STATUS_LEN] = {0x00, 0x20};
+static uint8_t axp192_discharging_adc[PMU_SAMPLE_AXP192_ADC_LEN];
+
+// AXP2101 on USB power, charging the battery.
+static const uint8_t axp2101_charging_status[PMU_SAMPLE_STATUS_LEN] = {0x28, 0x20};
+static const uint8_t axp2101_charging_adc[PMU_SAMPLE_AXP2101_ADC_LEN] = {0x10, 0x68, 0x00, 0x00, 0x13, 0x88};
+
+// AXP2101 on battery power, VBUS reads a residual voltage.
+static const uint8_t axp2101_discharging_status[PMU_SAMPLE_STATUS_LEN] = {0x08, 0x40};
+static const uint8_t axp2101_discharging_adc[PMU_SAMPLE_AXP2101_ADC_LEN] = {0x0E, 0xA6, 0x00, 0x00, 0x00, 0x40};
+
+void setUp()
+{
+    // VBUS 4991mV, VBUS 157.875mA, battery 3751mV, charging at 168mA.
+    memset(axp192_charging_adc, 0, sizeof(axp192_charging_adc));
+    axp192_charging_adc[0x5A - PMU_SAMPLE_AXP192_ADC_REG] = 0xB7;
+    axp192_charging_adc[0x5B - PMU_SAMPLE_AXP192_ADC_REG] = 0x08;
+    axp192_charging_adc[0x5C - PMU_SAMPLE_AXP192_ADC_REG] = 0x1A;
+    axp192_charging_adc[0x5D - PMU_SAMPLE_AXP192_ADC_REG] = 0x05;
+    axp192_charging_adc[0x78 - PMU_SAMPLE_AXP192_ADC_REG] = 0xD5;
+    axp192_charging_adc[0x79 - PMU_SAMPLE_AXP192_ADC_REG] = 0x02;
+    axp192_charging_adc[0x7A - PMU_SAMPLE_AXP192_ADC_REG] = 0x0A;
+    axp192_charging_adc[0x7B - PMU_SAMPLE_AXP192_ADC_REG] = 0x10;
+    // VBUS reads a residual voltage, battery 3751mV, discharging at 241.5mA.
+    memset(axp192_discharging_adc, 0, sizeof(axp192_discharging_adc));
+    axp192_discharging_adc[0x5A - PMU_SAMPLE_AXP192_ADC_REG] = 0x10;
+    axp192_discharging_adc[0x78 - PMU_SAMPLE_AXP192_ADC_REG] = 0xD5;
+    axp192_discharging_adc[0x79 - PMU_SAMPLE_AXP192_ADC_REG] = 0x02;
+    axp192_discharging_adc[0x7C - PMU_SAMPLE_AXP192_ADC_REG] = 0x0F;
+    axp192_discharging_adc[0x7D - PMU_SAMPLE_AXP192_ADC_REG] = 0x03;
+    Wire.is_present = true;
+}
+
+void tearDown()
+{
+}
+
+void test_axp192_charging()
+{
+    pmu_sample_t sample;
+    pmu_sample_decode_axp192(axp192_charging_status, axp192_charging_adc, axp192_coulomb, &sample);
+    TEST_ASSERT_TRUE(sample.is_vbus_present);
+    TEST_ASSERT_TRUE(sample.is_batt_connected);
+    TEST_ASSERT_TRUE(sample.is_charging);
+    TEST_ASSERT_EQUAL(4991, sample.vbus_millivolt);
+    TEST_ASSERT_EQUAL(3751, sample.batt_millivolt);
+    TEST_ASSERT_TRUE(sample.has_current);
+    TEST_ASSERT_EQUAL_FLOAT(157.875, sample.vbus_milliamp);
+    TEST_ASSERT_EQUAL_FLOAT(168, sample.batt_charge_milliamp);
+    TEST_ASSERT_EQUAL_FLOAT(0, sample.batt_discharge_milliamp);
+    TEST_ASSERT_TRUE(sample.has_coulomb);
+    TEST_ASSERT_EQUAL_UINT32(0x12345, sample.coulomb_charge);
+    TEST_ASSERT_EQUAL_UINT32(0xABCD, sample.coulomb_discharge);
+}
+
+void test_axp192_discharging()
+{
+    pmu_sample_t sample;
+    pmu_sample_decode_axp192(axp192_discharging_status, axp192_discharging_adc, axp192_coulomb, &sample);
+    TEST_ASSERT_FALSE(sample.is_vbus_present);
+    TEST_ASSERT_TRUE(sample.is_batt_connected);
+    TEST_ASSERT_FALSE(sample.is_charging);
+    // The reading of an absent power source is 0.
+    TEST_ASSERT_EQUAL(0, sample.vbus_millivolt);
+    TEST_ASSERT_EQUAL(3751, sample.batt_millivolt);
+    TEST_ASSERT_EQUAL_FLOAT(0, sample.batt_charge_milliamp);
+    TEST_ASSERT_EQUAL_FLOAT(241.5, sample.batt_discharge_milliamp);
+}
+
+void test_axp2101_charging()
+{
+    pmu_sample_t sample;
+    pmu_sample_decode_axp2101(axp2101_charging_status, axp2101_charging_adc, &sample);
+    TEST_ASSERT_TRUE(sample.is_vbus_present);
+    TEST_ASSERT_TRUE(sample.is_batt_connected);
+    TEST_ASSERT_TRUE(sample.is_charging);
+    TEST_ASSERT_EQUAL(4200, sample.batt_millivolt);
+    TEST_ASSERT_EQUAL(5000, sample.vbus_millivolt);
+    TEST_ASSERT_FALSE(sample.has_current);
+    TEST_ASSERT_FALSE(sample.has_coulomb);
+}
+
+void test_axp2101_discharging()
+{
+    pmu_sample_t sample;
+    pmu_sample_decode_axp2101(axp2101_discharging_status, axp2101_discharging_adc, &sample);
+    TEST_ASSERT_FALSE(sample.is_vbus_present);
+    TEST_ASSERT_TRUE(sample.is_batt_connected);
+    TEST_ASSERT_FALSE(sample.is_charging);
+    TEST_ASSERT_EQUAL(3750, sample.batt_millivolt);
+    TEST_ASSERT_EQUAL(0, sample.vbus_millivolt);
+}
+
+void test_read_decodes_the_registers()
+{
+    memcpy(&Wire.regs[PMU_SAMPLE_STATUS_REG], axp192_charging_status, sizeof(axp192_charging_status));
+    memcpy(&Wire.regs[PMU_SAMPLE_AXP192_ADC_REG], axp192_charging_adc, sizeof(axp192_charging_adc));
+    memcpy(&Wire.regs[PMU_SAMPLE_AXP192_COULOMB_REG], axp192_coulomb, sizeof(axp192_coulomb));
+    pmu_sample_t sample;
+    TEST_ASSERT_TRUE(pmu_sample_read(&sample));
+    TEST_ASSERT_TRUE(sample.is_charging);
+    TEST_ASSERT_EQUAL(4991, sample.vbus_millivolt);
+    TEST_ASSERT_EQUAL(3751, sample.batt_millivolt);
+    TEST_ASSERT_EQUAL_FLOAT(168, sample.batt_charge_milliamp);
+    TEST_ASSERT_EQUAL_UINT32(0x12345, sample.coulomb_charge);
+    TEST_ASSERT_EQUAL_UINT32(0xABCD, sample.coulomb_discharge);
+}
+
+void test_failed_read_leaves_sample_untouched()
+{
+    Wire.is_present = false;
+    pmu_sample_t sample;
+    memset(&sample, 0xA5, sizeof(sample));
+    TEST_ASSERT_FALSE(pmu_sample_read(&sample));
+    TEST_ASSERT_EQUAL(0xA5A5A5A5, sample.coulomb_charge);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_axp192_charging);
+    RUN_TEST(test_axp192_discharging);
+    RUN_TEST(test_axp2101_charging);
+    RUN_TEST(test_axp2101_discharging);
+    RUN_TEST(test_read_decodes_the_registers);
+    RUN_TEST(test_failed_read_leaves_sample_untouched);
+    return UNITY_END();
+}
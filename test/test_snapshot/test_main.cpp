@@ -0,0 +1,116 @@
+#include <unity.h>
+#include <atomic>
+#include <thread>
+#include "snapshot.h"
+
+// TEST_NUM_PUBLISHED is the number of records published by the writer thread of the stress test.
+#define TEST_NUM_PUBLISHED 2000000
+// TEST_NUM_READERS is the number of reader threads of the stress test.
+#define TEST_NUM_READERS 3
+
+// test_record_t is about as large as the largest record published through a snapshot, each word holds the same counter.
+typedef struct
+{
+    uint32_t words[68];
+} test_record_t;
+
+static Snapshot<test_record_t> snapshot;
+static std::atomic<bool> is_writing;
+
+// reader_failures counts the torn reads and the reads that went back in time, of all readers.
+static std::atomic<unsigned long> reader_failures;
+static std::atomic<unsigned long> reader_reads;
+
+void reader()
+{
+    uint32_t last = 0;
+    unsigned long reads = 0;
+    do
+    {
+        test_record_t record = snapshot.read();
+        for (size_t i = 1; i < sizeof(record.words) / sizeof(record.words[0]); ++i)
+        {
+            if (record.words[i] != record.words[0])
+            {
+                ++reader_failures;
+                break;
+            }
+        }
+        if (record.words[0] < last)
+        {
+            ++reader_failures;
+        }
+        last = record.words[0];
+        ++reads;
+    } while (is_writing.load());
+    reader_reads += reads;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+void test_read_before_publish()
+{
+    Snapshot<test_record_t> empty;
+    test_record_t record = empty.read();
+    for (size_t i = 0; i < sizeof(record.words) / sizeof(record.words[0]); ++i)
+    {
+        TEST_ASSERT_EQUAL(0, record.words[i]);
+    }
+}
+
+void test_read_after_publish()
+{
+    Snapshot<test_record_t> single;
+    test_record_t record;
+    for (uint32_t val = 1; val <= 3; ++val)
+    {
+        memset(&record, 0, sizeof(record));
+        record.words[0] = val;
+        single.publish(record);
+        TEST_ASSERT_EQUAL(val, single.read().words[0]);
+    }
+}
+
+void test_concurrent_readers_never_see_torn_records()
+{
+    reader_failures = 0;
+    reader_reads = 0;
+    is_writing = true;
+    std::thread readers[TEST_NUM_READERS];
+    for (int i = 0; i < TEST_NUM_READERS; ++i)
+    {
+        readers[i] = std::thread(reader);
+    }
+    test_record_t record;
+    for (uint32_t val = 1; val <= TEST_NUM_PUBLISHED; ++val)
+    {
+        for (size_t i = 0; i < sizeof(record.words) / sizeof(record.words[0]); ++i)
+        {
+            record.words[i] = val;
+        }
+        snapshot.publish(record);
+    }
+    is_writing = false;
+    for (int i = 0; i < TEST_NUM_READERS; ++i)
+    {
+        readers[i].join();
+    }
+    TEST_ASSERT_EQUAL(0, reader_failures.load());
+    TEST_ASSERT_TRUE(reader_reads.load() > 0);
+    TEST_ASSERT_EQUAL(TEST_NUM_PUBLISHED, snapshot.read().words[0]);
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_read_before_publish);
+    RUN_TEST(test_read_after_publish);
+    RUN_TEST(test_concurrent_readers_never_see_torn_records);
+    return UNITY_END();
+}
@@ -0,0 +1,226 @@
+#!/usr/bin/env python3
+"""Generate the compact frame schema tables of the decoders from include/payload_schema.h.
+
+The TTN payload formatter and the Go ingest each carry a copy of the schema between a pair of marker comments. This
+script rewrites the copies from the firmware's schema, so that the three never disagree. Run it from anywhere after
+changing a field; pass --check to fail instead of writing when a copy is out of date.
+
+Afterwards a key frame and a delta frame of each kind are encoded according to the schema, in the same way as the
+firmware's compact_frame.cpp, and decoded by the TTN payload formatter with node (skipped if node is not installed). A
+mismatch fails the run.
+"""
+
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+REPO_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+SCHEMA_PATH = os.path.join(REPO_DIR, 'include', 'payload_schema.h')
+JS_PATH = os.path.join(REPO_DIR, 'ttn_v3_uplink_payload_formatter.js')
+GO_PATH = os.path.join(REPO_DIR, 'azure-event-to-blob-store', 'compact_frame.go')
+COMPACT_FRAME_PATH = os.path.join(REPO_DIR, 'include', 'compact_frame.h')
+LORAWAN_PATH = os.path.join(REPO_DIR, 'include', 'lorawan.h')
+
+BEGIN_MARKER = 'BEGIN GENERATED PAYLOAD SCHEMA'
+END_MARKER = 'END GENERATED PAYLOAD SCHEMA'
+# The encodings are numbered as COMPACT_FIELD_UNSIGNED and so on in compact_frame.h.
+ENCODINGS = {'UNSIGNED': 0, 'SIGNED': 1, 'VARINT': 2}
+
+SCHEMA_RE = re.compile(r'#define PAYLOAD_SCHEMA_(\w+)\(FIELD\)')
+KIND_RE = re.compile(r'decoded as frame kind "(\w+)"')
+FIELD_RE = re.compile(r'FIELD\((\w+),\s*"(\w+)",\s*(\w+),\s*(\d+),\s*(\d+),\s*([-+.\deE]+),\s*([-+.\deE]+)\)')
+
+
+def parse_schema(path):
+    """Return a list of (symbol, kind, fields) in the order of the header, each field is a dict."""
+    schemas = []
+    kind = None
+    with open(path) as header:
+        for line in header:
+            match = KIND_RE.search(line)
+            if match:
+                kind = match.group(1)
+            match = SCHEMA_RE.search(line)
+            if match:
+                if kind is None:
+                    raise ValueError('PAYLOAD_SCHEMA_%s does not tell its decoded frame kind' % match.group(1))
+                schemas.append((match.group(1), kind, []))
+                kind = None
+                continue
+            match = FIELD_RE.search(line)
+            if match:
+                _, name, encoding, bits, delta_bits, resolution, offset = match.groups()
+                if encoding not in ENCODINGS:
+                    raise ValueError('field %s has an unknown encoding %s' % (name, encoding))
+                schemas[-1][2].append({'name': name, 'encoding': ENCODINGS[encoding], 'bits': bits,
+                                       'delta_bits': delta_bits, 'resolution': resolution, 'offset': offset})
+    return schemas
+
+
+def generate_js(schemas):
+    lines = ['// encoding: 0 - unsigned fixed-width, 1 - signed fixed-width, 2 - varint.']
+    for i, (symbol, _, fields) in enumerate(schemas):
+        if i > 0:
+            lines.append('')
+        lines.append('var COMPACT_%s_FIELDS = [' % symbol)
+        entries = ["    { name: '%(name)s', encoding: %(encoding)d, bits: %(bits)s, delta_bits: %(delta_bits)s, "
+                   "resolution: %(resolution)s, offset: %(offset)s }" % field for field in fields]
+        lines.append(',\n'.join(entries))
+        lines.append('];')
+    return lines
+
+
+def generate_go(schemas):
+    lines = ['var compactSchemas = map[string][]compactField{']
+    for _, kind, fields in schemas:
+        lines.append('\t"%s": {' % kind)
+        for field in fields:
+            lines.append('\t\t{"%(name)s", %(resolution)s, %(offset)s},' % field)
+        lines.append('\t},')
+    # gofmt separates the declaration from the comment that follows.
+    lines += ['}', '']
+    return lines
+
+
+def replace_generated(path, comment, generated):
+    """Replace the lines in between the marker comments, and return True if the file content changes."""
+    with open(path) as source:
+        content = source.read()
+    begin = '%s %s - generated by tools/generate_payload_schema.py from include/payload_schema.h, do not edit.' % (comment, BEGIN_MARKER)
+    end = '%s %s' % (comment, END_MARKER)
+    pattern = re.compile(r'^%s %s.*?^%s$' % (re.escape(comment), BEGIN_MARKER, re.escape(end)), re.MULTILINE | re.DOTALL)
+    if not pattern.search(content):
+        raise ValueError('%s lacks the "%s" and "%s" marker comments' % (path, BEGIN_MARKER, END_MARKER))
+    new_content = pattern.sub(lambda _: '\n'.join([begin] + generated + [end]), content)
+    if new_content == content:
+        return False
+    if '--check' not in sys.argv:
+        with open(path, 'w') as source:
+            source.write(new_content)
+    return True
+
+
+def read_define(path, name):
+    """Return the integer value of a #define in a header."""
+    with open(path) as header:
+        match = re.search(r'^#define %s (\d+)' % name, header.read(), re.MULTILINE)
+    if not match:
+        raise ValueError('%s does not define %s' % (path, name))
+    return int(match.group(1))
+
+
+class BitWriter:
+    """BitWriter writes values least significant bit first, like the firmware's DataPacket."""
+
+    def __init__(self):
+        self.bits = []
+
+    def write_bits(self, val, num_bits):
+        self.bits += [(val >> i) & 1 for i in range(num_bits)]
+
+    def write_varint(self, val, group_bits):
+        while True:
+            self.write_bits(val & ((1 << group_bits) - 1), group_bits)
+            val >>= group_bits
+            self.write_bits(1 if val > 0 else 0, 1)
+            if val == 0:
+                break
+
+    def to_bytes(self):
+        return [sum(bit << i for i, bit in enumerate(self.bits[pos:pos + 8])) for pos in range(0, len(self.bits), 8)]
+
+
+def sample_values(fields):
+    """Return a quantised value of each field that exercises its full width, e.g. the sign bit of a signed field."""
+    values = []
+    for i, field in enumerate(fields):
+        bits = int(field['bits'])
+        if field['encoding'] == ENCODINGS['UNSIGNED']:
+            values.append(max(((1 << bits) - 1) - i % 3, 0))
+        elif field['encoding'] == ENCODINGS['SIGNED']:
+            values.append(-(1 << (bits - 1)) + i)
+        else:
+            values.append(1000 + i)
+    return values
+
+
+def encode_frame(version, key_id, fields, values, deltas=None):
+    """Encode a key frame of the quantised values, or a delta frame if deltas (None for unchanged fields) is given."""
+    writer = BitWriter()
+    writer.write_bits(version, 2)
+    writer.write_bits(0 if deltas is None else 1, 1)
+    writer.write_bits(key_id, 5)
+    if deltas is not None:
+        for delta in deltas:
+            writer.write_bits(0 if delta is None else 1, 1)
+        for field, delta in zip(fields, deltas):
+            if delta is not None:
+                # Zig-zag: 0, -1, 1, -2, 2 => 0, 1, 2, 3, 4.
+                writer.write_varint(delta * 2 if delta >= 0 else -delta * 2 - 1, int(field['delta_bits']))
+        return writer.to_bytes()
+    for field, val in zip(fields, values):
+        if field['encoding'] == ENCODINGS['VARINT']:
+            writer.write_varint(val, int(field['bits']))
+        else:
+            writer.write_bits(val & ((1 << int(field['bits'])) - 1), int(field['bits']))
+    return writer.to_bytes()
+
+
+def decode_with_formatter(port, payload):
+    """Return the data decoded by the TTN payload formatter."""
+    script = 'var fs = require("fs");\neval(fs.readFileSync(process.argv[1], "utf8"));\n' \
+             'var input = JSON.parse(fs.readFileSync(0, "utf8"));\nconsole.log(JSON.stringify(decodeUplink(input).data));'
+    output = subprocess.run(['node', '-e', script, JS_PATH], input=json.dumps({'fPort': port, 'bytes': payload}),
+                            capture_output=True, text=True, check=True).stdout
+    return json.loads(output)
+
+
+def check_round_trip(schemas):
+    """Return a list of mismatches between the frames encoded by the schema and the data decoded by the formatter."""
+    version = read_define(COMPACT_FRAME_PATH, 'COMPACT_FRAME_VERSION')
+    # The symbols match the port names, e.g. PAYLOAD_SCHEMA_POS is transmitted to LORAWAN_PORT_GPS_WIFI_COMPACT.
+    ports = {'STATUS': read_define(LORAWAN_PATH, 'LORAWAN_PORT_STATUS_SENSOR_COMPACT'),
+             'POS': read_define(LORAWAN_PATH, 'LORAWAN_PORT_GPS_WIFI_COMPACT')}
+    mismatches = []
+    for symbol, kind, fields in schemas:
+        values = sample_values(fields)
+        key_id = len(fields) % 32
+        data = decode_with_formatter(ports[symbol], encode_frame(version, key_id, fields, values))
+        expected = {'compact_frame_version': version, 'compact_is_delta': False, 'compact_key_id': key_id,
+                    'compact_frame_kind': kind, 'compact_values': values}
+        for i, field in enumerate(fields):
+            if not field['name'].endswith('_mac_hi') and not field['name'].endswith('_mac_lo'):
+                expected[field['name']] = round(values[i] * float(field['resolution']) + float(field['offset']), 5)
+        # Every other field changes, by an amount that takes a few varint groups.
+        deltas = [None if i % 2 else (i + 1) * (-37 if i % 4 else 41) for i in range(len(fields))]
+        delta_data = decode_with_formatter(ports[symbol], encode_frame(version, key_id, fields, values, deltas))
+        for name, want in list(expected.items()) + [('delta compact_deltas', deltas)]:
+            got = delta_data.get('compact_deltas') if name.startswith('delta ') else data.get(name)
+            if got != want:
+                mismatches.append('%s frame field %s: encoded %r, decoded %r' % (kind, name, want, got))
+    return mismatches
+
+
+def main():
+    schemas = parse_schema(SCHEMA_PATH)
+    changed = [path for path, comment, generated in [(JS_PATH, '//', generate_js(schemas)), (GO_PATH, '//', generate_go(schemas))]
+               if replace_generated(path, comment, generated)]
+    for path in changed:
+        print('%s %s' % ('out of date:' if '--check' in sys.argv else 'updated', os.path.relpath(path, REPO_DIR)))
+    if changed and '--check' in sys.argv:
+        sys.exit(1)
+    if shutil.which('node') is None:
+        print('skipped the round trip through %s, node is not installed' % os.path.relpath(JS_PATH, REPO_DIR))
+        return
+    mismatches = check_round_trip(schemas)
+    for mismatch in mismatches:
+        print(mismatch)
+    if mismatches:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
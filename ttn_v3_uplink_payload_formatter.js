@@ -80,9 +80,41 @@ function decodeUplink(input) {
         // Byte 31, 32, 33, 34, 35, 36 - Bluetooth monitor - the loudest sender's MAC address.
         data.bt_loudest_tx_mac = buf[i].toString(16) + ':' + buf[i + 1].toString(16) + ':' + buf[i + 2].toString(16) + ':' + buf[i + 3].toString(16) + ':' + buf[i + 4].toString(16) + ':' + buf[i + 5].toString(16);
         i += 6;
-        // Byte 38 - WiFi monitor - the size of all inflight packets across all channels.
+        // Byte 37, 38 - WiFi monitor - the size of all inflight packets across all channels.
         data.wifi_inflight_pkt_data_len_all_chans = buf[i++];
         data.wifi_inflight_pkt_data_len_all_chans += buf[i++] << 8;
+    } else if (input.fPort == 121) {
+        decode_compact_frame(buf, 'status', COMPACT_STATUS_FIELDS, data);
+    } else if (input.fPort == 122) {
+        decode_compact_frame(buf, 'position', COMPACT_POS_FIELDS, data);
+    } else if (input.fPort == 123) {
+        decode_sensor_series(buf, data);
+    } else if (input.fPort == 129) {
+        data.text = String.fromCharCode.apply(null, buf);
+    } else if (input.fPort == 132) {
+        data.text_encoding = 'compact';
+        data.text = decode_compact_text(buf);
+    } else if (input.fPort == 133) {
+        // Byte 0 - number of routine uplinks suppressed since the previous keepalive because nothing had changed.
+        data.suppressed_frames = buf[i++];
+    } else if (input.fPort == 134) {
+        decode_rx_timing_report(buf, data);
+    } else if (input.fPort == 135) {
+        decode_energy_ledger(buf, data);
+    } else if (input.fPort == 131) {
+        // Byte 0 - ID of the fragmented downlink message.
+        data.fragment_message_id = buf[i++];
+        // Byte 1 - number of fragments.
+        data.fragment_count = buf[i++];
+        // Byte 2 - bitmap of missing fragments, the sender should resend these fragments.
+        var missing = buf[i++];
+        data.fragment_missing = [];
+        for (var f = 0; f < data.fragment_count; f++) {
+            if ((missing >> f) & 1) {
+                data.fragment_missing.push(f);
+            }
+        }
+        data.fragment_complete = missing == 0;
     }
     return {
         data: data,
@@ -101,4 +133,312 @@ function decode_double(b1, b2, b3, b4) {
     }
     ret /= 100000;
     return ret;
-}
\ No newline at end of file
+}
+
+// The compact frame schemas (see compact_frame.h) are generated from the firmware's payload_schema.h.
+// BEGIN GENERATED PAYLOAD SCHEMA - generated by tools/generate_payload_schema.py from include/payload_schema.h, do not edit.
+// encoding: 0 - unsigned fixed-width, 1 - signed fixed-width, 2 - varint.
+var COMPACT_STATUS_FIELDS = [
+    { name: 'last_rx_sec', encoding: 2, bits: 7, delta_bits: 7, resolution: 1, offset: 0 },
+    { name: 'uptime_sec', encoding: 2, bits: 7, delta_bits: 7, resolution: 1, offset: 0 },
+    { name: 'heap_usage_kb', encoding: 2, bits: 4, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'batt_millivolt', encoding: 0, bits: 13, delta_bits: 4, resolution: 1, offset: 0 },
+    { name: 'power_milliamp', encoding: 2, bits: 5, delta_bits: 4, resolution: 1, offset: 0 },
+    { name: 'is_batt_charging', encoding: 0, bits: 1, delta_bits: 1, resolution: 1, offset: 0 },
+    { name: 'ambient_temp_celcius', encoding: 1, bits: 14, delta_bits: 5, resolution: 0.01, offset: 0 },
+    { name: 'ambient_humidity_pct', encoding: 0, bits: 7, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'ambient_pressure_hpa', encoding: 0, bits: 14, delta_bits: 4, resolution: 0.1, offset: 0 },
+    { name: 'ambient_altitude_metre', encoding: 1, bits: 15, delta_bits: 4, resolution: 1, offset: 0 },
+    { name: 'cpu0_reset_reason', encoding: 0, bits: 5, delta_bits: 2, resolution: 1, offset: 0 },
+    { name: 'cpu1_reset_reason', encoding: 0, bits: 5, delta_bits: 2, resolution: 1, offset: 0 },
+    { name: 'cpu_wake_up_cause', encoding: 0, bits: 8, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'esp_reset_reason', encoding: 0, bits: 5, delta_bits: 2, resolution: 1, offset: 0 }
+];
+
+var COMPACT_POS_FIELDS = [
+    { name: 'latitude', encoding: 1, bits: 25, delta_bits: 6, resolution: 0.00001, offset: 0 },
+    { name: 'longitude', encoding: 1, bits: 26, delta_bits: 6, resolution: 0.00001, offset: 0 },
+    { name: 'gps_speed_kmh', encoding: 2, bits: 4, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'gps_heading_deg', encoding: 0, bits: 9, delta_bits: 4, resolution: 1, offset: 0 },
+    { name: 'altitude', encoding: 1, bits: 15, delta_bits: 4, resolution: 1, offset: 0 },
+    { name: 'gps_pos_age_sec', encoding: 2, bits: 4, delta_bits: 4, resolution: 1, offset: 0 },
+    { name: 'hdop', encoding: 0, bits: 8, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'sats', encoding: 0, bits: 6, delta_bits: 2, resolution: 1, offset: 0 },
+    { name: 'wifi_inflight_pkts_all_chans', encoding: 2, bits: 5, delta_bits: 5, resolution: 1, offset: 0 },
+    { name: 'wifi_loudest_tx_chan', encoding: 0, bits: 4, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'wifi_loudest_tx_rssi', encoding: 0, bits: 7, delta_bits: 3, resolution: 1, offset: -120 },
+    { name: 'wifi_loudest_tx_mac_hi', encoding: 0, bits: 24, delta_bits: 7, resolution: 1, offset: 0 },
+    { name: 'wifi_loudest_tx_mac_lo', encoding: 0, bits: 24, delta_bits: 7, resolution: 1, offset: 0 },
+    { name: 'bt_num_devices', encoding: 2, bits: 4, delta_bits: 3, resolution: 1, offset: 0 },
+    { name: 'bt_loudest_tx_rssi', encoding: 0, bits: 7, delta_bits: 3, resolution: 1, offset: -120 },
+    { name: 'bt_loudest_tx_mac_hi', encoding: 0, bits: 24, delta_bits: 7, resolution: 1, offset: 0 },
+    { name: 'bt_loudest_tx_mac_lo', encoding: 0, bits: 24, delta_bits: 7, resolution: 1, offset: 0 },
+    { name: 'wifi_inflight_pkt_data_len_all_chans', encoding: 2, bits: 5, delta_bits: 5, resolution: 1, offset: 0 }
+];
+// END GENERATED PAYLOAD SCHEMA
+
+// new_bit_reader reads values from the bit stream written by the firmware's DataPacket, least significant bit first.
+function new_bit_reader(buf) {
+    var reader = { buf: buf, cursor: 0 };
+    reader.read_bits = function (num_bits) {
+        var ret = 0;
+        for (var b = 0; b < num_bits; b++) {
+            var pos = reader.cursor++;
+            if (pos >> 3 < reader.buf.length && (reader.buf[pos >> 3] >> (pos & 7)) & 1) {
+                ret += Math.pow(2, b);
+            }
+        }
+        return ret;
+    };
+    reader.read_signed_bits = function (num_bits) {
+        var ret = reader.read_bits(num_bits);
+        if (ret >= Math.pow(2, num_bits - 1)) {
+            ret -= Math.pow(2, num_bits);
+        }
+        return ret;
+    };
+    reader.read_varint = function (group_bits) {
+        var ret = 0;
+        var shift = 0;
+        do {
+            ret += reader.read_bits(group_bits) * Math.pow(2, shift);
+            shift += group_bits;
+        } while (reader.read_bits(1) == 1 && shift < 32);
+        return ret;
+    };
+    reader.read_zigzag_varint = function (group_bits) {
+        var ret = reader.read_varint(group_bits);
+        return ret % 2 == 0 ? ret / 2 : -(ret + 1) / 2;
+    };
+    return reader;
+}
+
+// decode_compact_frame decodes a compact frame (see compact_frame.h) into data.
+// A key frame is decoded into the same fields as the fixed-width frames, and its quantised field values are kept in
+// data.compact_values.
+// A delta frame cannot be decoded without its key frame, hence only the quantised differences are kept in
+// data.compact_deltas (null for unchanged fields). The Go ingest resolves them against the key frame.
+function decode_compact_frame(buf, kind, fields, data) {
+    var reader = new_bit_reader(buf);
+    data.compact_frame_version = reader.read_bits(2);
+    data.compact_is_delta = reader.read_bits(1) == 1;
+    data.compact_key_id = reader.read_bits(5);
+    data.compact_frame_kind = kind;
+    var f;
+    if (data.compact_is_delta) {
+        var changed = [];
+        for (f = 0; f < fields.length; f++) {
+            changed.push(reader.read_bits(1) == 1);
+        }
+        data.compact_deltas = [];
+        for (f = 0; f < fields.length; f++) {
+            data.compact_deltas.push(changed[f] ? reader.read_zigzag_varint(fields[f].delta_bits) : null);
+        }
+        return;
+    }
+    data.compact_values = [];
+    for (f = 0; f < fields.length; f++) {
+        var val;
+        if (fields[f].encoding == 0) {
+            val = reader.read_bits(fields[f].bits);
+        } else if (fields[f].encoding == 1) {
+            val = reader.read_signed_bits(fields[f].bits);
+        } else {
+            val = reader.read_varint(fields[f].bits);
+        }
+        data.compact_values.push(val);
+    }
+    compact_values_to_fields(data.compact_values, fields, data);
+}
+
+function compact_values_to_fields(values, fields, data) {
+    for (var f = 0; f < fields.length; f++) {
+        var name = fields[f].name;
+        if (name.endsWith('_mac_hi')) {
+            data[name.replace('_mac_hi', '_mac')] = decode_mac_halves(values[f], values[f + 1]);
+            f++;
+            continue;
+        }
+        // Avoid floating point noise such as 21.450000000000003.
+        data[name] = Number((values[f] * fields[f].resolution + fields[f].offset).toFixed(5));
+    }
+}
+
+function decode_mac_halves(hi, lo) {
+    var bytes = [hi >> 16, (hi >> 8) & 255, hi & 255, lo >> 16, (lo >> 8) & 255, lo & 255];
+    return bytes.map(function (b) { return ('0' + b.toString(16)).slice(-2); }).join(':');
+}
+
+// decode_sensor_series decodes a batch of sensor samples (see env_sensor.h) into data.sensor_series, oldest first.
+// The newest sample is also decoded into the same fields as a status frame.
+function decode_sensor_series(buf, data) {
+    var reader = new_bit_reader(buf);
+    data.sensor_series_version = reader.read_bits(2);
+    var num_samples = reader.read_bits(6);
+    data.sensor_series_interval_sec = reader.read_varint(7);
+    var newest_age_sec = reader.read_varint(7);
+    data.sensor_series = [];
+    var temp = 0, humidity = 0, pressure = 0, batt = 0;
+    for (var s = 0; s < num_samples; s++) {
+        if (s == 0) {
+            temp = reader.read_signed_bits(14);
+            humidity = reader.read_bits(7);
+            pressure = reader.read_bits(14);
+            batt = reader.read_bits(13);
+        } else {
+            temp += reader.read_zigzag_varint(4);
+            humidity += reader.read_zigzag_varint(2);
+            pressure += reader.read_zigzag_varint(3);
+            batt += reader.read_zigzag_varint(3);
+        }
+        data.sensor_series.push({
+            age_sec: newest_age_sec + (num_samples - 1 - s) * data.sensor_series_interval_sec,
+            ambient_temp_celcius: temp / 100,
+            ambient_humidity_pct: humidity,
+            ambient_pressure_hpa: pressure / 10,
+            batt_millivolt: batt
+        });
+    }
+    if (num_samples > 0) {
+        var newest = data.sensor_series[num_samples - 1];
+        data.ambient_temp_celcius = newest.ambient_temp_celcius;
+        data.ambient_humidity_pct = newest.ambient_humidity_pct;
+        data.ambient_pressure_hpa = newest.ambient_pressure_hpa;
+        data.batt_millivolt = newest.batt_millivolt;
+    }
+}
+
+// The upper boundaries in microseconds of the RX timing histogram buckets, see rx_timing.h.
+var RX_TIMING_BUCKET_UPPER_US = [-64000, -32000, -16000, -8000, -4000, -2000, -1000, 0, 1000, 2000, 4000, 8000, 16000, 32000, 64000];
+
+// decode_rx_timing_report decodes a receive window timing report (see rx_timing.h) into data.
+// Each histogram is a list of buckets, a bucket counts the values from its lower boundary (inclusive) to its upper boundary.
+function decode_rx_timing_report(buf, data) {
+    var reader = new_bit_reader(buf);
+    data.rx_timing_version = reader.read_bits(2);
+    data.rx_clock_error_pct = reader.read_bits(7);
+    data.rx_uplinks = reader.read_varint(7);
+    data.rx_windows = reader.read_varint(7);
+    data.rx_preambles = reader.read_varint(7);
+    data.rx_expected_responses = reader.read_varint(7);
+    data.rx_missed_responses = reader.read_varint(7);
+    data.rx_late_windows = reader.read_varint(7);
+    var read_histogram = function () {
+        var histogram = [];
+        for (var b = 0; b <= RX_TIMING_BUCKET_UPPER_US.length; b++) {
+            histogram.push({
+                from_us: b == 0 ? null : RX_TIMING_BUCKET_UPPER_US[b - 1],
+                to_us: b == RX_TIMING_BUCKET_UPPER_US.length ? null : RX_TIMING_BUCKET_UPPER_US[b],
+                count: reader.read_varint(4)
+            });
+        }
+        return histogram;
+    };
+    data.rx_open_late_histogram = read_histogram();
+    data.rx_open_offset_histogram = read_histogram();
+    data.rx_downlink_offset_histogram = read_histogram();
+}
+
+// The states of the energy ledger in the order of their state numbers, see energy_ledger.h.
+var ENERGY_LEDGER_STATES = ['lorawan', 'wifi', 'bluetooth', 'gps', 'oled', 'cpu_full', 'cpu_reduced', 'deep_sleep'];
+// ENERGY_LEDGER_REPORT_UNIT_MAH is the unit of charge in the energy ledger.
+var ENERGY_LEDGER_REPORT_UNIT_MAH = 0.01;
+
+// decode_energy_ledger decodes an energy ledger (see energy_ledger.h) into data. The durations and charges accumulate
+// since the ledger started, the consumption over a period is the difference between two ledgers.
+// The charge attributed to a peripheral is the extra draw while it is on compared to while it is off and the CPUs are
+// awake, times its on-time. Version 1 ledgers did not book deep sleep.
+function decode_energy_ledger(buf, data) {
+    var reader = new_bit_reader(buf);
+    data.energy_version = reader.read_bits(2);
+    data.energy_from_coulomb_counter = reader.read_bits(1) == 1;
+    var total_sec = reader.read_varint(7);
+    var total_mah = reader.read_varint(7) * ENERGY_LEDGER_REPORT_UNIT_MAH;
+    data.energy_total_sec = total_sec;
+    data.energy_total_mah = total_mah;
+    var num_states = data.energy_version >= 2 ? ENERGY_LEDGER_STATES.length : ENERGY_LEDGER_STATES.indexOf('deep_sleep');
+    var states_sec = [], states_mah = [];
+    for (var s = 0; s < num_states; s++) {
+        states_sec.push(reader.read_varint(7));
+        states_mah.push(reader.read_varint(7) * ENERGY_LEDGER_REPORT_UNIT_MAH);
+    }
+    var awake_sec = total_sec, awake_mah = total_mah;
+    if (num_states > ENERGY_LEDGER_STATES.indexOf('deep_sleep')) {
+        awake_sec -= states_sec[ENERGY_LEDGER_STATES.indexOf('deep_sleep')];
+        awake_mah -= states_mah[ENERGY_LEDGER_STATES.indexOf('deep_sleep')];
+    }
+    data.energy_states = {};
+    for (var s = 0; s < num_states; s++) {
+        var on_sec = states_sec[s];
+        var on_mah = states_mah[s];
+        var attributed_mah = on_mah;
+        if (s < ENERGY_LEDGER_STATES.indexOf('cpu_full') && on_sec > 0 && awake_sec > on_sec) {
+            var extra_ma = on_mah / on_sec - (awake_mah - on_mah) / (awake_sec - on_sec);
+            attributed_mah = Math.max(extra_ma, 0) * on_sec;
+        }
+        data.energy_states[ENERGY_LEDGER_STATES[s]] = {
+            active_sec: on_sec,
+            active_mah: on_mah,
+            attributed_mah: attributed_mah
+        };
+    }
+}
+
+// The symbol table and canonical Huffman code lengths of compressed text messages, see text_codec.h.
+var TEXT_CODEC_SYMBOLS = [
+    '', '', ' ',
+    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9',
+    '.', ',', '?', "'", '!', '/', '(', ')', '&', ':', ';', '=', '+', '-', '_', '"', '$', '@',
+    'the ', 'and ', 'ing', 'you', 'to ', 'of ', 'er'
+];
+var TEXT_CODEC_CODE_LENS = [
+    7, 8, 3,
+    4, 6, 6, 5, 4, 6, 6, 5, 4, 10, 7, 5, 6,
+    4, 4, 6, 10, 4, 4, 4, 6, 7, 6, 9, 6, 10,
+    9, 9, 9, 9, 9, 9, 9, 9, 8, 8,
+    7, 7, 8, 9, 8, 10, 11, 11, 11, 10, 11, 11, 11, 9, 11, 11, 11, 11,
+    6, 7, 8, 8, 7, 8, 7
+];
+
+// decode_compact_text decodes a text message compressed by the firmware's text_codec.
+function decode_compact_text(buf) {
+    // Assign the canonical codes: consecutive codes to the symbols ordered by code length and then symbol number.
+    var code_to_symbol = {};
+    var code = 0;
+    for (var len = 1; len <= 11; len++) {
+        for (var sym = 0; sym < TEXT_CODEC_SYMBOLS.length; sym++) {
+            if (TEXT_CODEC_CODE_LENS[sym] == len) {
+                code_to_symbol[len + ':' + code] = sym;
+                code++;
+            }
+        }
+        code *= 2;
+    }
+    var reader = new_bit_reader(buf);
+    var text = '';
+    var is_upper_case = false;
+    while (reader.cursor < buf.length * 8) {
+        var bits = 0;
+        var num_bits = 0;
+        var found = -1;
+        while (found == -1 && num_bits < 11) {
+            bits = bits * 2 + reader.read_bits(1);
+            num_bits++;
+            if ((num_bits + ':' + bits) in code_to_symbol) {
+                found = code_to_symbol[num_bits + ':' + bits];
+            }
+        }
+        if (found <= 0) {
+            break;
+        } else if (found == 1) {
+            is_upper_case = !is_upper_case;
+        } else if (is_upper_case) {
+            text += TEXT_CODEC_SYMBOLS[found].toUpperCase();
+        } else {
+            text += TEXT_CODEC_SYMBOLS[found];
+        }
+    }
+    return text;
+}